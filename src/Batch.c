@@ -0,0 +1,244 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "BitBoard.h"
+#include "LookupTable.h"
+#include "ChessBoard.h"
+#include "Batch.h"
+
+#define LINE_SIZE 256
+#define WINDOW_SIZE 4096 // Lines read ahead of the first one not yet written
+
+/*
+ * A line of a batch, along with its perft once searched
+ */
+typedef struct
+{
+  char fen[LINE_SIZE];
+  int depth;
+  long expected;
+  long nodes;
+  double seconds;
+  int searched;  // Set as soon as it's read if it's malformed, then it's written as is
+} Line;
+
+/*
+ * A window of lines shared by the threads searching it. Lines are read into it while there's
+ * room, taken by the next idle thread, and written in order once searched, so a slow line
+ * only holds up the lines after it from being written. Malformed lines are skipped by the
+ * threads but still written in order.
+ */
+typedef struct
+{
+  LookupTable l;
+  PerftFunction perft;
+  Line *lines;   // The line numbered i is at i % WINDOW_SIZE
+  long read;     // Lines read so far
+  long taken;    // Lines taken by a thread
+  long written;  // Lines written
+  int done;      // Whether every line has been read
+  pthread_mutex_t lock;
+  pthread_cond_t readable; // A line was read, or every line has been
+  pthread_cond_t searched; // The first line not yet written was searched
+} Window;
+
+static int parseLine(char *buffer, Line *line);
+static long writeLines(Window *w, FILE *out, long limit);
+static void *searchLines(void *arg);
+static double elapsed(struct timespec *start);
+
+long BatchRun(LookupTable l, FILE *in, FILE *out, int threads, PerftFunction perft, BatchStats *stats)
+{
+  Line *lines = malloc(WINDOW_SIZE * sizeof(Line));
+  threads = (threads > 0) ? threads : 1;
+  pthread_t *ids = malloc(threads * sizeof(pthread_t));
+  if (lines == NULL || ids == NULL)
+  {
+    fprintf(stderr, "Insufficient memory!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  Window w = {.l = l, .perft = perft, .lines = lines};
+  pthread_mutex_init(&w.lock, NULL);
+  pthread_cond_init(&w.readable, NULL);
+  pthread_cond_init(&w.searched, NULL);
+  for (int i = 0; i < threads; i++)
+    if (pthread_create(&ids[i], NULL, searchLines, &w) != 0)
+    {
+      fprintf(stderr, "Failed to create a batch thread\n");
+      exit(EXIT_FAILURE);
+    }
+
+  long failed = 0, rejected = 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // Only this thread reads and writes lines, so the window's free lines are its own
+  char buffer[2 * LINE_SIZE];
+  while (fgets(buffer, sizeof(buffer), in))
+  {
+    Line *line = &lines[w.read % WINDOW_SIZE];
+    int parsed = parseLine(buffer, line);
+    if (parsed == 0)
+      continue;
+    rejected += (parsed < 0);
+
+    pthread_mutex_lock(&w.lock);
+    line->searched = (parsed < 0);
+    w.read++;
+    pthread_cond_signal(&w.readable);
+    pthread_mutex_unlock(&w.lock);
+    failed += writeLines(&w, out, w.read + 1 - WINDOW_SIZE); // Frees the next line to read
+  }
+
+  pthread_mutex_lock(&w.lock);
+  w.done = 1;
+  pthread_cond_broadcast(&w.readable);
+  pthread_mutex_unlock(&w.lock);
+  failed += writeLines(&w, out, w.read);
+  for (int i = 0; i < threads; i++)
+    pthread_join(ids[i], NULL);
+
+  if (stats != NULL)
+    *stats = (BatchStats){.positions = w.read - rejected, .failed = failed, .rejected = rejected,
+                          .seconds = elapsed(&start)};
+  pthread_cond_destroy(&w.searched);
+  pthread_cond_destroy(&w.readable);
+  pthread_mutex_destroy(&w.lock);
+  free(ids);
+  free(lines);
+  return (w.read > rejected) ? failed + rejected : -1;
+}
+
+// Split a line into its FEN, depth and expected nodes, either "FEN depth nodes" or an EPD
+// line whose ";Dn nodes" operations give the nodes of each depth, of which the deepest is
+// searched. Returns 1 if it was parsed, 0 if it's blank or a comment, -1 if it's malformed or
+// its FEN isn't valid, in which case the line itself is kept as the FEN with a depth of 0.
+static int parseLine(char *buffer, Line *line)
+{
+  buffer[strcspn(buffer, "\r\n")] = '\0';
+  char *ptr = buffer;
+  while (*ptr != '\0' && isspace((unsigned char)*ptr))
+    ptr++;
+  if (*ptr == '\0' || *ptr == '#')
+    return 0;
+
+  char *fenEnd = strchr(ptr, ';');
+  line->depth = 0;
+  if (fenEnd != NULL)
+  {
+    int depth;
+    long nodes;
+    for (char *op = fenEnd; op != NULL; op = strchr(op + 1, ';'))
+      if (sscanf(op, "; D%d %ld", &depth, &nodes) == 2 && depth > line->depth)
+      {
+        line->depth = depth;
+        line->expected = nodes;
+      }
+  }
+  else
+  {
+    // The depth and expected nodes are the last two words, the FEN is everything before them
+    char *nodesSpace = strrchr(ptr, ' ');
+    if (nodesSpace != NULL)
+    {
+      *nodesSpace = '\0';
+      fenEnd = strrchr(ptr, ' ');
+      *nodesSpace = ' ';
+    }
+    if (fenEnd != NULL && sscanf(fenEnd, " %d %ld", &line->depth, &line->expected) != 2)
+      line->depth = 0;
+  }
+
+  while (fenEnd != NULL && fenEnd > ptr && isspace((unsigned char)fenEnd[-1]))
+    fenEnd--;
+  if (line->depth > 0 && fenEnd != NULL && fenEnd > ptr && fenEnd - ptr < LINE_SIZE)
+  {
+    memcpy(line->fen, ptr, fenEnd - ptr);
+    line->fen[fenEnd - ptr] = '\0';
+    if (ChessBoardValidFEN(line->fen))
+      return 1;
+  }
+  snprintf(line->fen, LINE_SIZE, "%.*s", LINE_SIZE - 1, ptr);
+  line->depth = 0;
+  return -1;
+}
+
+// Write the lines before the given one in order, waiting for each to be searched, along with
+// any searched after them. Returns the number whose nodes weren't expected.
+static long writeLines(Window *w, FILE *out, long limit)
+{
+  long failed = 0;
+  pthread_mutex_lock(&w->lock);
+  while (w->written < w->read)
+  {
+    Line *line = &w->lines[w->written % WINDOW_SIZE];
+    if (!line->searched)
+    {
+      if (w->written >= limit)
+        break;
+      pthread_cond_wait(&w->searched, &w->lock);
+      continue;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    if (line->depth == 0)
+      fprintf(out, "%s MALFORMED\n", line->fen);
+    else
+    {
+      int passed = (line->nodes == line->expected);
+      fprintf(out, "%s %d %ld %s %.6fs\n", line->fen, line->depth, line->nodes,
+              passed ? "PASSED" : "FAILED", line->seconds);
+      failed += !passed;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->written++;
+  }
+  pthread_mutex_unlock(&w->lock);
+  return failed;
+}
+
+// Search lines as they're read until every line has been
+static void *searchLines(void *arg)
+{
+  Window *w = arg;
+  LookupTable l = LookupTableLocal(w->l);
+  pthread_mutex_lock(&w->lock);
+  for (;;)
+  {
+    while (w->taken == w->read && !w->done)
+      pthread_cond_wait(&w->readable, &w->lock);
+    if (w->taken == w->read)
+      break;
+    long i = w->taken++;
+    Line *line = &w->lines[i % WINDOW_SIZE];
+    if (line->searched)
+      continue; // Malformed
+    pthread_mutex_unlock(&w->lock);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ChessBoard cb = ChessBoardNew(line->fen);
+    line->nodes = w->perft(l, &cb, line->depth);
+    line->seconds = elapsed(&start);
+
+    pthread_mutex_lock(&w->lock);
+    line->searched = 1;
+    if (i == w->written)
+      pthread_cond_signal(&w->searched);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+static double elapsed(struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -0,0 +1,39 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+#include "BitBoard.h"
+#include "LookupTable.h"
+#include "ChessBoard.h"
+
+/*
+ * A perft of a chess board at a depth, searched by a batch for every position
+ */
+typedef long (*PerftFunction)(LookupTable l, ChessBoard *cb, int depth);
+
+/*
+ * What a batch found over all its lines
+ */
+typedef struct
+{
+  long positions; // Lines searched
+  long failed;    // Lines whose nodes weren't expected
+  long rejected;  // Malformed lines, or lines whose FEN isn't valid, which aren't searched
+  double seconds; // Time taken by the whole batch
+} BatchStats;
+
+/*
+ * Runs the perft of every line of in, each a FEN followed by a depth and the expected
+ * number of nodes like data/testPositions.in, or an EPD line of ";Dn nodes" operations like
+ * data/perftSuite.epd, searched at its deepest depth. Blank lines and lines starting with #
+ * are skipped. The lines are spread over the given number of threads, which share the lookup
+ * table, and each line's FEN, depth, nodes, whether they were expected and time taken are
+ * written to out in input order, while a malformed line or one whose FEN isn't valid is
+ * written followed by MALFORMED. If stats isn't NULL, the totals are written to it. Returns
+ * the number of lines whose nodes weren't expected or that were malformed, or -1 if no line
+ * could be searched.
+ */
+long BatchRun(LookupTable l, FILE *in, FILE *out, int threads, PerftFunction perft, BatchStats *stats);
+
+#endif
@@ -71,4 +71,18 @@ static inline BitBoard BitBoardShiftS(BitBoard b)          { return b << EDGE_SI
 static inline BitBoard BitBoardShiftSE(BitBoard b)         { return (b & ~EAST_EDGE) << 9; }
 static inline BitBoard BitBoardShiftSW(BitBoard b)         { return (b & ~WEST_EDGE) << 7; }
 
+/*
+ * Symmetries of a chess board: flipping swaps the ranks (a byte swap), mirroring swaps
+ * the files (a bit reverse of each byte)
+ */
+static inline BitBoard BitBoardFlip(BitBoard b)            { return __builtin_bswap64(b); }
+static inline Square   BitBoardFlipSquare(Square s)        { return s ^ 56; }
+static inline Square   BitBoardMirrorSquare(Square s)      { return s ^ 7; }
+static inline BitBoard BitBoardMirror(BitBoard b)
+{
+  b = ((b >> 1) & 0x5555555555555555) | ((b & 0x5555555555555555) << 1);
+  b = ((b >> 2) & 0x3333333333333333) | ((b & 0x3333333333333333) << 2);
+  return ((b >> 4) & 0x0F0F0F0F0F0F0F0F) | ((b & 0x0F0F0F0F0F0F0F0F) << 4);
+}
+
 #endif
\ No newline at end of file
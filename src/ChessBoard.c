@@ -7,14 +7,56 @@
 #include "LookupTable.h"
 #include "ChessBoard.h"
 
-#define FEN_SIZE 128
+/*
+ * What the perft breakdown of a chess board's moves needs while it's being counted
+ */
+typedef struct
+{
+  LookupTable l;
+  ChessBoard *cb;
+  Stats *stats;
+  Move *checks;                    // Checking moves are written here if not NULL
+  int numChecks;
+  BitBoard them;
+  Targets targets;                 // Where our moves check their king
+} StatsContext;
+
+static const uint8_t typeMaterial[TYPE_SIZE] = {HasPawns, 0, HasKnights, HasDiagonal, HasOrthogonal,
+                                                HasDiagonal | HasOrthogonal, 0};
 
 static Color getColorFromASCII(char asciiColor);
 static char getASCIIFromType(Type t, Color c);
 static Type getTypeFromASCII(char asciiPiece);
+static int attackedInFEN(const char *squares, int king);
+static BitBoard getChangedSquares(Move m);
+static BitBoard getPieceAttacks(LookupTable l, ChessBoard *cb, Square s, Color c, BitBoard occupancies);
+static BitBoard updateAttacks(LookupTable l, ChessBoard *cb, Color c, BitBoard changed, BitBoard *attacks);
+static void updateCheckingAndPinned(LookupTable l, ChessBoard *cb, Color c, BitBoard changed, Attacks *a);
+static void getCheckingAndPinned(LookupTable l, ChessBoard *cb, Color c, BitBoard *checking, BitBoard *pinned);
+static inline void analyze(LookupTable l, ChessBoard *cb, Analysis *a, BitBoard *attacks);
+static int countMoves(LookupTable l, ChessBoard *cb, Analysis *a);
+static inline int countKernel(LookupTable l, ChessBoard *cb, Analysis *a, const int material);
+static inline int countPawnMoves(LookupTable l, ChessBoard *cb, Analysis *a);
+static inline int countEnPassant(LookupTable l, ChessBoard *cb, Analysis *a);
+static int countEvasions(LookupTable l, ChessBoard *cb, Analysis *a);
+static void analyzeShared(LookupTable l, ChessBoard *cb, Analysis *a, BitBoard *attacks);
+static int countMobility(LookupTable l, ChessBoard *cb, Analysis *a, BitBoard *attacks, int *mobility);
+static int hasMove(LookupTable l, ChessBoard *cb, Analysis *a);
+static int hasPieceMove(LookupTable l, ChessBoard *cb, Analysis *a);
+static int quickAnalyze(LookupTable l, ChessBoard *cb, Analysis *a);
+static Move newMove(ChessBoard *cb, Square from, Square to, Type t);
+static inline void addMoveMap(MoveMap *maps, int *n, BitBoard from, BitBoard to, Type t);
+static void addStats(StatsContext *sc, Square from, BitBoard moves, Type t);
+static void addSpecialStats(StatsContext *sc, Move m);
+static void addCheck(StatsContext *sc, Move m);
+static int legalEnPassant(LookupTable l, ChessBoard *cb);
+static int legalCastling(LookupTable l, ChessBoard *cb, BitBoard toB);
+static int legalEnPassantFrom(LookupTable l, ChessBoard *cb, Square from, BitBoard pinned, BitBoard checkMask);
+static int isAttacked(LookupTable l, ChessBoard *cb, Square s, BitBoard occupancies);
+static inline uint8_t getMaterial(ChessBoard *cb, Color c);
 
 // Assumes FEN is valid
-ChessBoard ChessBoardNew(char *fen)
+ChessBoard ChessBoardNew(const char *fen)
 {
   ChessBoard cb;
   memset(&cb, 0, sizeof(ChessBoard));
@@ -68,6 +110,7 @@ ChessBoard ChessBoardNew(char *fen)
   }
 
   // Parse en passant
+  cb.enPassant = EMPTY_SQUARE;
   if (*fen != '-')
   {
     int file = *fen - 'a';
@@ -76,9 +119,126 @@ ChessBoard ChessBoardNew(char *fen)
     cb.enPassant = rank * EDGE_SIZE + file;
   }
 
+  ChessBoardResetMaterial(&cb);
   return cb;
 }
 
+int ChessBoardValidFEN(const char *fen)
+{
+  char squares[BOARD_SIZE];
+  int kings[2] = {0}, kingSquares[2] = {0};
+  int s = 0;
+  for (int rank = 0; rank < EDGE_SIZE; rank++)
+  {
+    if (rank > 0 && *fen++ != '/')
+      return 0;
+    int end = s + EDGE_SIZE;
+    for (; *fen && *fen != '/' && *fen != ' '; fen++)
+    {
+      if (*fen >= '1' && *fen <= '8' && s + (*fen - '0') <= end)
+      {
+        for (int i = *fen - '0'; i > 0; i--)
+          squares[s++] = '.';
+      }
+      else if (strchr("PKNBRQpknbrq", *fen) && s < end)
+      {
+        if (*fen == 'K' || *fen == 'k')
+        {
+          kings[*fen == 'k']++;
+          kingSquares[*fen == 'k'] = s;
+        }
+        if ((*fen == 'P' || *fen == 'p') && (rank == 0 || rank == EDGE_SIZE - 1))
+          return 0;
+        squares[s++] = *fen;
+      }
+      else
+        return 0;
+    }
+    if (s != end)
+      return 0;
+  }
+  if (kings[0] != 1 || kings[1] != 1 || *fen++ != ' ')
+    return 0;
+
+  // The king of the side not to move can't be captured
+  char turn = *fen;
+  if ((turn != 'w' && turn != 'b') || fen[1] != ' ' || attackedInFEN(squares, kingSquares[turn == 'w']))
+    return 0;
+  fen += 2;
+
+  if (*fen == '-')
+    fen++;
+  else
+  {
+    // King and rook squares of K, Q, k and q, from a8 = 0
+    static const char *rights = "KQkq";
+    static const int kingStarts[4] = {60, 60, 4, 4}, rookStarts[4] = {63, 56, 7, 0};
+    if (*fen == ' ' || *fen == '\0')
+      return 0;
+    for (; *fen && *fen != ' '; fen++)
+    {
+      const char *right = strchr(rights, *fen);
+      if (right == NULL)
+        return 0;
+      int i = right - rights;
+      if (squares[kingStarts[i]] != (i < 2 ? 'K' : 'k') || squares[rookStarts[i]] != (i < 2 ? 'R' : 'r'))
+        return 0;
+    }
+  }
+  if (*fen++ != ' ')
+    return 0;
+
+  if (*fen == '-')
+    return fen[1] == '\0' || fen[1] == ' ';
+
+  // The pawn that just moved two squares is past the en passant square, which it crossed
+  if (fen[0] < 'a' || fen[0] > 'h' || fen[1] != (turn == 'w' ? '6' : '3') || (fen[2] != '\0' && fen[2] != ' '))
+    return 0;
+  int target = (EDGE_SIZE - (fen[1] - '0')) * EDGE_SIZE + (fen[0] - 'a');
+  int forward = (turn == 'w') ? EDGE_SIZE : -EDGE_SIZE;
+  return squares[target] == '.' && squares[target - forward] == '.' &&
+         squares[target + forward] == (turn == 'w' ? 'p' : 'P');
+}
+
+// Whether the king on the given square of a FEN's squares is attacked by the other color: by a
+// knight jumping to it, or by the first piece along one of the eight lines from it
+static int attackedInFEN(const char *squares, int king)
+{
+  static const int steps[8][2] = {{-1, -1}, {-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, -1}, {1, 0}, {1, 1}};
+  static const int jumps[8][2] = {{-2, -1}, {-2, 1}, {-1, -2}, {-1, 2}, {1, -2}, {1, 2}, {2, -1}, {2, 1}};
+  int white = isupper((unsigned char)squares[king]) != 0;
+  int rank = king / EDGE_SIZE, file = king % EDGE_SIZE;
+  for (int i = 0; i < 8; i++)
+  {
+    int r = rank + jumps[i][0], f = file + jumps[i][1];
+    if (r >= 0 && r < EDGE_SIZE && f >= 0 && f < EDGE_SIZE && squares[r * EDGE_SIZE + f] == (white ? 'n' : 'N'))
+      return 1;
+
+    int diagonal = (steps[i][0] != 0 && steps[i][1] != 0);
+    for (int distance = 1;; distance++)
+    {
+      r = rank + steps[i][0] * distance;
+      f = file + steps[i][1] * distance;
+      if (r < 0 || r >= EDGE_SIZE || f < 0 || f >= EDGE_SIZE)
+        break;
+      char square = squares[r * EDGE_SIZE + f];
+      if (square == '.')
+        continue;
+      if ((isupper((unsigned char)square) != 0) == white)
+        break;
+
+      // Their pawns capture towards our side of the board, rank 1 being White's
+      char piece = tolower((unsigned char)square);
+      int pawnStep = white ? -1 : 1;
+      if (piece == 'q' || piece == (diagonal ? 'b' : 'r') || (distance == 1 && piece == 'k') ||
+          (distance == 1 && diagonal && piece == 'p' && steps[i][0] == pawnStep))
+        return 1;
+      break;
+    }
+  }
+  return 0;
+}
+
 static Color getColorFromASCII(char asciiColor)
 {
   return (asciiColor == 'w') ? White : Black;
@@ -130,6 +290,8 @@ void ChessBoardPlayMove(ChessBoard *cb, Move m)
     cb->types[m.captured.type] ^= capBit;
     cb->colors[!us] ^= capBit;
     cb->squares[m.captured.square] = Empty;
+    if (!(cb->types[m.captured.type] & cb->colors[!us])) // Their last piece of that type
+      cb->material[!us] = getMaterial(cb, !us);
   }
 
   // Move piece: remove from origin, place at destination
@@ -138,6 +300,8 @@ void ChessBoardPlayMove(ChessBoard *cb, Move m)
   cb->colors[us] ^= fromBit | toBit;
   cb->squares[m.from.square] = Empty;
   cb->squares[m.to.square]   = m.to.type;
+  if (m.from.type != m.to.type)
+    cb->material[us] = getMaterial(cb, us);
 
   // Castling: move rook if king moved two squares
   if (m.from.type == King) {
@@ -155,6 +319,18 @@ void ChessBoardPlayMove(ChessBoard *cb, Move m)
 
   // Toggle side to move
   cb->turn = !cb->turn;
+
+  // Push the attacks of the new position
+  if (cb->attacks) {
+    AttackStack *as = cb->attacks;
+    BitBoard changed = getChangedSquares(m);
+    Attacks *a = &as->stack[++as->ply];
+    *a = as->stack[as->ply - 1];
+    a->attacked[White] = updateAttacks(as->l, cb, White, changed, a->attacks);
+    a->attacked[Black] = updateAttacks(as->l, cb, Black, changed, a->attacks);
+    updateCheckingAndPinned(as->l, cb, White, changed, a);
+    updateCheckingAndPinned(as->l, cb, Black, changed, a);
+  }
 }
 
 void ChessBoardUndoMove(ChessBoard *cb, Move m)
@@ -186,6 +362,8 @@ void ChessBoardUndoMove(ChessBoard *cb, Move m)
   cb->colors[us] ^= fromBit | toBit;
   cb->squares[m.to.square]   = Empty;
   cb->squares[m.from.square] = m.from.type;
+  if (m.from.type != m.to.type)
+    cb->material[us] = getMaterial(cb, us);
 
   // Restore captured piece
   if (m.captured.type != Empty) {
@@ -193,11 +371,87 @@ void ChessBoardUndoMove(ChessBoard *cb, Move m)
     cb->types[m.captured.type] ^= capBit;
     cb->colors[!us] ^= capBit;
     cb->squares[m.captured.square] = m.captured.type;
+    cb->material[!us] |= typeMaterial[m.captured.type];
   }
 
   // Restore en passant and castling rights
   cb->enPassant = m.enPassant;
   cb->castling = m.castling;
+
+  // Pop the attacks of the position we undid
+  if (cb->attacks)
+    cb->attacks->ply--;
+}
+
+void ChessBoardTrack(LookupTable l, ChessBoard *cb, AttackStack *as)
+{
+  cb->attacks = as;
+  if (as == NULL)
+    return;
+
+  as->l = l;
+  as->ply = 0;
+  Attacks *a = &as->stack[0];
+  a->attacked[White] = updateAttacks(l, cb, White, ~EMPTY_BOARD, a->attacks);
+  a->attacked[Black] = updateAttacks(l, cb, Black, ~EMPTY_BOARD, a->attacks);
+  getCheckingAndPinned(l, cb, White, &a->checking[White], &a->pinned[White]);
+  getCheckingAndPinned(l, cb, Black, &a->checking[Black], &a->pinned[Black]);
+}
+
+// Returns the squares whose piece changed when the move was played
+static BitBoard getChangedSquares(Move m)
+{
+  BitBoard changed = BitBoardAdd(EMPTY_BOARD, m.from.square) | BitBoardAdd(EMPTY_BOARD, m.to.square);
+  if (m.captured.type != Empty)
+    changed = BitBoardAdd(changed, m.captured.square);
+  if (m.from.type == King) {
+    int offset = (int)m.from.square - (int)m.to.square;
+    if (offset == 2)
+      changed = BitBoardAdd(BitBoardAdd(changed, m.to.square - 2), m.to.square + 1);
+    else if (offset == -2)
+      changed = BitBoardAdd(BitBoardAdd(changed, m.to.square + 1), m.to.square - 1);
+  }
+  return changed;
+}
+
+// Returns the squares attacked by the piece of color c on square s
+static BitBoard getPieceAttacks(LookupTable l, ChessBoard *cb, Square s, Color c, BitBoard occupancies)
+{
+  Type t = cb->squares[s];
+  if (t == Pawn)
+    return PAWN_ATTACKS(BitBoardAdd(EMPTY_BOARD, s), c);
+  return LookupTableAttacks(l, s, t, occupancies);
+}
+
+/*
+ * Recompute the attacks of the pieces of color c that stand on a changed square or
+ * whose rays touch one, and return the union of all their attacks. Only the attacks of
+ * squares occupied by color c are read, so stale entries of empty squares are harmless.
+ */
+static BitBoard updateAttacks(LookupTable l, ChessBoard *cb, Color c, BitBoard changed, BitBoard *attacks)
+{
+  const BitBoard occupancies = ChessBoardAll(cb) & ~(cb->types[King] & cb->colors[!c]);
+  const BitBoard sliders = (cb->types[Bishop] | cb->types[Rook] | cb->types[Queen]) & cb->colors[c];
+  BitBoard attacked = EMPTY_BOARD;
+  BitBoard b = cb->colors[c];
+  while (b) {
+    Square s = BitBoardPop(&b);
+    BitBoard piece = BitBoardAdd(EMPTY_BOARD, s);
+    if ((piece & changed) || ((piece & sliders) && (attacks[s] & changed)))
+      attacks[s] = getPieceAttacks(l, cb, s, c, occupancies);
+    attacked |= attacks[s];
+  }
+  return attacked;
+}
+
+// Recompute the checks and pins on the king of color c if a changed square can see it
+static void updateCheckingAndPinned(LookupTable l, ChessBoard *cb, Color c, BitBoard changed, Attacks *a)
+{
+  BitBoard king = cb->types[King] & cb->colors[c];
+  Square s = BitBoardPeek(king);
+  BitBoard lines = LookupTableAttacks(l, s, Queen, EMPTY_BOARD) | LookupTableAttacks(l, s, Knight, EMPTY_BOARD) | king;
+  if (lines & changed)
+    getCheckingAndPinned(l, cb, c, &a->checking[c], &a->pinned[c]);
 }
 
 void ChessBoardPrintBoard(ChessBoard cb)
@@ -217,6 +471,19 @@ void ChessBoardPrintBoard(ChessBoard cb)
   printf("a b c d e f g h\n\n");
 }
 
+char *ChessBoardWriteMove(Move m, char *move)
+{
+  int length = sprintf(move, "%c%d%c%d",
+                       'a' + (m.from.square % EDGE_SIZE),
+                       EDGE_SIZE - (m.from.square / EDGE_SIZE),
+                       'a' + (m.to.square % EDGE_SIZE),
+                       EDGE_SIZE - (m.to.square / EDGE_SIZE));
+  if (m.from.type != m.to.type)
+    move[length++] = "pknbrq"[m.to.type];
+  move[length] = '\0';
+  return move;
+}
+
 void ChessBoardPrintMove(Move m)
 {
   printf("%c%d%c%d",
@@ -235,85 +502,950 @@ ChessBoard ChessBoardFlip(ChessBoard *cb)
   return new;
 }
 
+uint64_t ChessBoardHash(LookupTable l, ChessBoard *cb)
+{
+  uint64_t hash = 0;
+  for (Color c = White; c <= Black; c++) {
+    BitBoard pieces = cb->colors[c];
+    while (pieces) {
+      Square s = BitBoardPop(&pieces);
+      hash ^= LookupTableZobrist(l, c, cb->squares[s], s);
+    }
+
+    // A castling right only counts while both its king and rook squares remain
+    BitBoard kingSide  = KINGSIDE_CASTLING & BACK_RANK(c);
+    BitBoard queenSide = QUEENSIDE_CASTLING & BACK_RANK(c);
+    if ((cb->castling & kingSide) == kingSide)
+      hash ^= LookupTableZobristCastling(l, BitBoardPeek(kingSide & EAST_EDGE));
+    if ((cb->castling & queenSide) == queenSide)
+      hash ^= LookupTableZobristCastling(l, BitBoardPeek(queenSide & WEST_EDGE));
+  }
+
+  if (legalEnPassant(l, cb))
+    hash ^= LookupTableZobristEnPassant(l, cb->enPassant);
+
+  if (cb->turn == Black)
+    hash ^= LookupTableZobristTurn(l);
+  return hash;
+}
+
+uint64_t ChessBoardCanonicalHash(LookupTable l, ChessBoard *cb)
+{
+  // The hashes of the board as is, mirrored, with colors swapped, and both
+  uint64_t hash[4] = {0};
+  int mirror = !ChessBoardHasCastling(cb);
+  for (Color c = White; c <= Black; c++) {
+    BitBoard pieces = cb->colors[c];
+    while (pieces) {
+      Square s = BitBoardPop(&pieces);
+      Square f = BitBoardFlipSquare(s);
+      Type t = cb->squares[s];
+      hash[0] ^= LookupTableZobrist(l, c, t, s);
+      hash[2] ^= LookupTableZobrist(l, !c, t, f);
+      if (mirror) {
+        hash[1] ^= LookupTableZobrist(l, c, t, BitBoardMirrorSquare(s));
+        hash[3] ^= LookupTableZobrist(l, !c, t, BitBoardMirrorSquare(f));
+      }
+    }
+
+    // Castling rights keep the board from being mirrored, so only swapped colors need them
+    BitBoard kingSide  = KINGSIDE_CASTLING & BACK_RANK(c);
+    BitBoard queenSide = QUEENSIDE_CASTLING & BACK_RANK(c);
+    if ((cb->castling & kingSide) == kingSide) {
+      hash[0] ^= LookupTableZobristCastling(l, BitBoardPeek(kingSide & EAST_EDGE));
+      hash[2] ^= LookupTableZobristCastling(l, BitBoardFlipSquare(BitBoardPeek(kingSide & EAST_EDGE)));
+    }
+    if ((cb->castling & queenSide) == queenSide) {
+      hash[0] ^= LookupTableZobristCastling(l, BitBoardPeek(queenSide & WEST_EDGE));
+      hash[2] ^= LookupTableZobristCastling(l, BitBoardFlipSquare(BitBoardPeek(queenSide & WEST_EDGE)));
+    }
+  }
+
+  if (legalEnPassant(l, cb)) {
+    Square f = BitBoardFlipSquare(cb->enPassant);
+    hash[0] ^= LookupTableZobristEnPassant(l, cb->enPassant);
+    hash[1] ^= LookupTableZobristEnPassant(l, BitBoardMirrorSquare(cb->enPassant));
+    hash[2] ^= LookupTableZobristEnPassant(l, f);
+    hash[3] ^= LookupTableZobristEnPassant(l, BitBoardMirrorSquare(f));
+  }
+
+  // Swapping colors passes the turn
+  uint64_t turn = LookupTableZobristTurn(l);
+  hash[(cb->turn == Black) ? 0 : 2] ^= turn;
+  hash[(cb->turn == Black) ? 1 : 3] ^= turn;
+
+  uint64_t canonical = hash[0];
+  for (int i = 1; i < 4; i++)
+    if ((mirror || i == 2) && hash[i] < canonical)
+      canonical = hash[i];
+  return canonical;
+}
+
+ChessBoard ChessBoardMirror(ChessBoard *cb)
+{
+  ChessBoard new;
+  memcpy(&new, cb, sizeof(ChessBoard));
+  for (Type t = Pawn; t < Empty; t++)
+    new.types[t] = BitBoardMirror(cb->types[t]);
+  for (Color c = White; c <= Black; c++)
+    new.colors[c] = BitBoardMirror(cb->colors[c]);
+  for (Square s = 0; s < BOARD_SIZE; s++)
+    new.squares[BitBoardMirrorSquare(s)] = cb->squares[s];
+  if (cb->enPassant != EMPTY_SQUARE)
+    new.enPassant = BitBoardMirrorSquare(cb->enPassant);
+  new.castling = EMPTY_BOARD;
+  new.attacks = NULL;
+  return new;
+}
+
+ChessBoard ChessBoardSwapColors(ChessBoard *cb)
+{
+  ChessBoard new;
+  memcpy(&new, cb, sizeof(ChessBoard));
+  for (Type t = Pawn; t < Empty; t++)
+    new.types[t] = BitBoardFlip(cb->types[t]);
+  for (Color c = White; c <= Black; c++)
+    new.colors[!c] = BitBoardFlip(cb->colors[c]);
+  for (Square s = 0; s < BOARD_SIZE; s++)
+    new.squares[BitBoardFlipSquare(s)] = cb->squares[s];
+  if (cb->enPassant != EMPTY_SQUARE)
+    new.enPassant = BitBoardFlipSquare(cb->enPassant);
+  new.castling = BitBoardFlip(cb->castling);
+  new.turn = !cb->turn;
+  new.attacks = NULL;
+  new.material[White] = cb->material[Black];
+  new.material[Black] = cb->material[White];
+  return new;
+}
+
+int ChessBoardEqual(ChessBoard *cb1, ChessBoard *cb2)
+{
+  for (Type t = Pawn; t < Empty; t++)
+    if (cb1->types[t] != cb2->types[t])
+      return 0;
+  return (cb1->colors[White] == cb2->colors[White]) && (cb1->colors[Black] == cb2->colors[Black]) &&
+         (cb1->turn == cb2->turn) && (cb1->enPassant == cb2->enPassant) && (cb1->castling == cb2->castling);
+}
+
+void ChessBoardResetMaterial(ChessBoard *cb)
+{
+  cb->material[White] = getMaterial(cb, White);
+  cb->material[Black] = getMaterial(cb, Black);
+}
+
+// The classes of pieces of a color, from scratch
+static inline uint8_t getMaterial(ChessBoard *cb, Color c)
+{
+  const BitBoard ours = cb->colors[c];
+  return ((cb->types[Pawn] & ours) ? HasPawns : 0) |
+         ((cb->types[Knight] & ours) ? HasKnights : 0) |
+         (((cb->types[Bishop] | cb->types[Queen]) & ours) ? HasDiagonal : 0) |
+         (((cb->types[Rook] | cb->types[Queen]) & ours) ? HasOrthogonal : 0);
+}
+
+int ChessBoardLegalEnPassant(LookupTable l, ChessBoard *cb)
+{
+  return legalEnPassant(l, cb);
+}
+
+// En passant only counts if it's legal, which is the case if it adds to our moves
+static int legalEnPassant(LookupTable l, ChessBoard *cb)
+{
+  if ((cb->enPassant == EMPTY_SQUARE) ||
+      !(PAWN_ATTACKS(BitBoardAdd(EMPTY_BOARD, cb->enPassant), !cb->turn) & ChessBoardOur(cb, Pawn)))
+    return 0;
+  ChessBoard passed = *cb;
+  passed.enPassant = EMPTY_SQUARE;
+  passed.attacks = NULL;
+  return ChessBoardCount(l, cb) != ChessBoardCount(l, &passed);
+}
+
 int ChessBoardCount(LookupTable l, ChessBoard *cb)
 {
-  int count = 0;
+  Analysis a;
+  ChessBoardAnalyze(l, cb, &a);
+  return countMoves(l, cb, &a);
+}
+
+int ChessBoardCountAnalyzed(LookupTable l, ChessBoard *cb, Analysis *a)
+{
+  return countMoves(l, cb, a);
+}
+
+int ChessBoardHasLegalMove(LookupTable l, ChessBoard *cb)
+{
+  Analysis a;
+  return quickAnalyze(l, cb, &a) || hasMove(l, cb, &a);
+}
+
+Status ChessBoardStatus(LookupTable l, ChessBoard *cb)
+{
+  Analysis a;
+  if (quickAnalyze(l, cb, &a) || hasMove(l, cb, &a))
+    return Ongoing;
+  return a.checking ? Checkmated : Stalemated;
+}
+
+// Returns 1 if a board that isn't in check has a move of a piece other than the king, which
+// only needs its pins. Otherwise returns 0 with the full analysis of the board in a.
+static int quickAnalyze(LookupTable l, ChessBoard *cb, Analysis *a)
+{
+  if (!cb->attacks) {
+    ChessBoardCheckingAndPinned(l, cb, &a->checking, &a->pinned);
+    a->checkMask = ~EMPTY_BOARD;
+    if (a->checking == EMPTY_BOARD && hasPieceMove(l, cb, a))
+      return 1;
+  }
+  ChessBoardAnalyze(l, cb, a);
+  return 0;
+}
+
+void ChessBoardCacheAnalysis(LookupTable l, ChessBoard *cb, AnalysisCache *ac)
+{
+  ChessBoard flip = ChessBoardFlip(cb);
+  analyze(l, &flip, &ac->analysis, ac->attacks);
+}
+
+int ChessBoardCountCached(LookupTable l, ChessBoard *cb, AnalysisCache *ac, Move m)
+{
+  if (cb->attacks)
+    return ChessBoardCount(l, cb);
+
+  Analysis a;
+  const BitBoard changed = getChangedSquares(m);
+  const BitBoard kingB   = ChessBoardOur(cb, King);
+  const Square  kingSq   = BitBoardPeek(kingB);
+  const int     color    = ChessBoardColor(cb);
+
+  // Only the pieces that moved and the sliders whose rays touch a changed square
+  // attack differently than they did before the move
+  const BitBoard occupancies = ChessBoardAll(cb) & ~kingB;
+  const BitBoard sliders = ChessBoardTheir(cb, Bishop) | ChessBoardTheir(cb, Rook) | ChessBoardTheir(cb, Queen);
+  a.attacked = PAWN_ATTACKS(ChessBoardTheir(cb, Pawn), !color);
+  BitBoard b = ChessBoardThem(cb) & ~ChessBoardTheir(cb, Pawn);
+  while (b) {
+    Square s = BitBoardPop(&b);
+    BitBoard piece = BitBoardAdd(EMPTY_BOARD, s);
+    if ((piece & changed) || ((piece & sliders) && (ac->attacks[s] & changed)))
+      a.attacked |= getPieceAttacks(l, cb, s, !color, occupancies);
+    else
+      a.attacked |= ac->attacks[s];
+  }
+
+  // Checks and pins can only change if a changed square can see our king
+  const BitBoard lines = LookupTableAttacks(l, kingSq, Queen, EMPTY_BOARD) |
+                         LookupTableAttacks(l, kingSq, Knight, EMPTY_BOARD) | kingB;
+  if (lines & changed) {
+    getCheckingAndPinned(l, cb, color, &a.checking, &a.pinned);
+  } else {
+    a.checking = ac->analysis.checking;
+    a.pinned   = ac->analysis.pinned;
+  }
+
+  const int numChecks = BitBoardCount(a.checking);
+  if (numChecks == 0) {
+    a.checkMask = ~EMPTY_BOARD;
+  } else if (numChecks == 1) {
+    Square cs = BitBoardPeek(a.checking);
+    a.checkMask = BitBoardAdd(EMPTY_BOARD, cs) | LookupTableSquaresBetween(l, kingSq, cs);
+  } else {
+    a.checkMask = EMPTY_BOARD;
+  }
+
+  return countMoves(l, cb, &a);
+}
+
+int ChessBoardCountStats(LookupTable l, ChessBoard *cb, Stats *stats, Move *checks)
+{
+  Analysis a;
+  ChessBoardAnalyze(l, cb, &a);
   Square s;
-  BitBoard attacked = ChessBoardAttacked(l, cb);
-  BitBoard pinned, checking;
-  ChessBoardCheckingAndPinned(l, cb, &checking, &pinned);
 
   // Cache hot values
-  const BitBoard us    = ChessBoardUs(cb);
-  const BitBoard them  = ChessBoardThem(cb);
-  const BitBoard all   = ChessBoardAll(cb);
+  const BitBoard us        = ChessBoardUs(cb);
+  const BitBoard them      = ChessBoardThem(cb);
+  const BitBoard all       = ChessBoardAll(cb);
+  const BitBoard kingB     = ChessBoardOur(cb, King);
+  const Square  kingSq     = BitBoardPeek(kingB);
+  const int     color      = ChessBoardColor(cb);
+  const BitBoard pinned    = a.pinned;
+  const BitBoard checkMask = a.checkMask;
+  const int     numChecks  = BitBoardCount(a.checking);
+
+  StatsContext sc;
+  sc.l = l;
+  sc.cb = cb;
+  sc.stats = stats;
+  sc.checks = checks;
+  sc.numChecks = 0;
+  sc.them = them;
+  ChessBoardTargets(l, cb, Checks, &sc.targets);
+
+  // King moves, castling is played out since the rook moves too
+  BitBoard moves = LookupTableAttacks(l, kingSq, King, EMPTY_BOARD) & ~us & ~a.attacked;
+  addStats(&sc, kingSq, moves, King);
+  if (numChecks == 0) {
+    int clear = (((a.attacked & ATTACK_MASK) | (all & OCCUPANCY_MASK)) &
+                 (KINGSIDE & ~KINGSIDE_CASTLING) & BACK_RANK(color)) == EMPTY_BOARD;
+    if (ChessBoardKingSide(cb) && clear)
+      addSpecialStats(&sc, newMove(cb, kingSq, kingSq + 2, King));
+
+    clear = (((a.attacked & ATTACK_MASK) | (all & OCCUPANCY_MASK)) &
+             (QUEENSIDE & ~QUEENSIDE_CASTLING) & BACK_RANK(color)) == EMPTY_BOARD;
+    if (ChessBoardQueenSide(cb) && clear)
+      addSpecialStats(&sc, newMove(cb, kingSq, kingSq - 2, King));
+  }
+
+  // If double-check, return early (only king moves allowed)
+  if (numChecks == 2) return sc.numChecks;
+
+  const BitBoard notUsAndCheck = ~us & checkMask;
+
+  // Knight and slider moves
+  BitBoard pieces = ChessBoardOur(cb, Knight) | ChessBoardOur(cb, Bishop) | ChessBoardOur(cb, Rook) | ChessBoardOur(cb, Queen);
+  while (pieces) {
+    s = BitBoardPop(&pieces);
+    Type t = ChessBoardSquare(cb, s);
+    moves = LookupTableAttacks(l, s, t, all) & notUsAndCheck;
+    if (BitBoardAdd(EMPTY_BOARD, s) & pinned)
+      moves &= LookupTableLineOfSight(l, kingSq, s);
+    addStats(&sc, s, moves, t);
+  }
+
+  // Pawn moves, promotions are played out since the promoted piece gives the check
+  const BitBoard promotion = BACK_RANK(White) | BACK_RANK(Black);
+  const BitBoard enpassant = ENPASSANT_RANK(color);
+  BitBoard b1 = ChessBoardOur(cb, Pawn);
+  while (b1) {
+    s = BitBoardPop(&b1);
+    BitBoard b2 = SINGLE_PUSH(BitBoardAdd(EMPTY_BOARD, s), color) & ~all;
+    moves  = PAWN_ATTACKS(BitBoardAdd(EMPTY_BOARD, s), color) & them;
+    moves |= b2 | (SINGLE_PUSH(b2 & enpassant, color) & ~all);
+    moves &= checkMask;
+    if (BitBoardAdd(EMPTY_BOARD, s) & pinned)
+      moves &= LookupTableLineOfSight(l, kingSq, s);
+    addStats(&sc, s, moves & ~promotion, Pawn);
+
+    moves &= promotion;
+    while (moves) {
+      Square to = BitBoardPop(&moves);
+      for (Type t = Knight; t <= Queen; t++)
+        addSpecialStats(&sc, newMove(cb, s, to, t));
+    }
+  }
+
+  // En passant moves are played out since they remove a pawn from another square
+  if ((ChessBoardEnPassant(cb) != EMPTY_SQUARE) &&
+      ((BitBoardAdd(EMPTY_BOARD, ChessBoardEnPassant(cb)) |
+        SINGLE_PUSH(BitBoardAdd(EMPTY_BOARD, ChessBoardEnPassant(cb)), !color)) & checkMask)) {
+    BitBoard epSq = BitBoardAdd(EMPTY_BOARD, ChessBoardEnPassant(cb));
+    b1 = PAWN_ATTACKS(epSq, !color) & ChessBoardOur(cb, Pawn);
+    while (b1) {
+      s = BitBoardPop(&b1);
+      if (LookupTableAttacks(l, kingSq, Rook,
+            all & ~BitBoardAdd(SINGLE_PUSH(epSq, !color), s)) &
+          RANK_OF(kingSq) & (ChessBoardTheir(cb, Rook) | ChessBoardTheir(cb, Queen)))
+        continue;
+      if ((BitBoardAdd(EMPTY_BOARD, s) & pinned) &&
+          !(BitBoardAdd(EMPTY_BOARD, s) & LookupTableLineOfSight(l, kingSq, ChessBoardEnPassant(cb))))
+        continue;
+      addSpecialStats(&sc, newMove(cb, s, ChessBoardEnPassant(cb), Pawn));
+    }
+  }
+
+  return sc.numChecks;
+}
+
+// Adds the breakdown of a piece's regular moves with masks, only checks are played out
+static void addStats(StatsContext *sc, Square from, BitBoard moves, Type t)
+{
+  Stats *stats = sc->stats;
+  stats->nodes    += BitBoardCount(moves);
+  stats->captures += BitBoardCount(moves & sc->them);
+
+  // A move discovers a check if it leaves the line between our slider and their king
+  BitBoard direct     = moves & sc->targets.targets[t];
+  BitBoard discovered = (BitBoardAdd(EMPTY_BOARD, from) & sc->targets.discoverers) ?
+                        moves & ~LookupTableLineOfSight(sc->l, sc->targets.theirKing, from) : EMPTY_BOARD;
+  BitBoard checks     = direct | discovered;
+  stats->checks           += BitBoardCount(checks);
+  stats->discoveredChecks += BitBoardCount(discovered & ~direct);
+  stats->doubleChecks     += BitBoardCount(direct & discovered);
+
+  while (checks)
+    addCheck(sc, newMove(sc->cb, from, BitBoardPop(&checks), t));
+}
+
+// Adds the breakdown of a castling, promotion or en passant move by playing it
+static void addSpecialStats(StatsContext *sc, Move m)
+{
+  Stats *stats = sc->stats;
+  ChessBoard *cb = sc->cb;
+  int castle = (m.from.type == King);
+  stats->nodes++;
+  stats->captures   += (m.captured.type != Empty);
+  stats->enPassant  += (m.from.type == Pawn) && (m.to.square == m.enPassant);
+  stats->castles    += castle;
+  stats->promotions += (m.from.type != m.to.type);
+
+  // The castled rook is a moved piece too, so its check isn't discovered
+  BitBoard moved = BitBoardAdd(EMPTY_BOARD, m.to.square);
+  if (castle)
+    moved = BitBoardAdd(moved, (m.from.square + m.to.square) / 2);
+
+  Analysis a;
+  ChessBoardPlayMove(cb, m);
+  ChessBoardAnalyze(sc->l, cb, &a);
+  ChessBoardUndoMove(cb, m);
+  if (a.checking == EMPTY_BOARD)
+    return;
+
+  stats->checks++;
+  int single = (BitBoardCount(a.checking) == 1);
+  stats->discoveredChecks += single && !(a.checking & moved);
+  stats->doubleChecks     += !single;
+  addCheck(sc, m);
+}
+
+// Records a checking move, or plays it to see if it's checkmate
+static void addCheck(StatsContext *sc, Move m)
+{
+  if (sc->checks) {
+    sc->checks[sc->numChecks++] = m;
+    return;
+  }
+  sc->numChecks++;
+  ChessBoardPlayMove(sc->cb, m);
+  sc->stats->checkmates += !ChessBoardHasLegalMove(sc->l, sc->cb);
+  ChessBoardUndoMove(sc->cb, m);
+}
+
+// Builds the move of our piece between two squares, t is its type after the move
+static Move newMove(ChessBoard *cb, Square from, Square to, Type t)
+{
+  Move m;
+  m.enPassant   = ChessBoardEnPassant(cb);
+  m.castling    = ChessBoardCastling(cb);
+  m.from.square = from;
+  m.from.type   = ChessBoardSquare(cb, from);
+  m.to.square   = to;
+  m.to.type     = t;
+  if ((m.from.type == Pawn) && (to == m.enPassant)) {
+    m.captured.square = (ChessBoardColor(cb) == White) ? to + EDGE_SIZE : to - EDGE_SIZE;
+    m.captured.type   = Pawn;
+  } else {
+    m.captured.square = to;
+    m.captured.type   = ChessBoardSquare(cb, to);
+  }
+  return m;
+}
+
+void ChessBoardMobility(LookupTable l, ChessBoard *cb, Mobility *m)
+{
+  const BitBoard all = ChessBoardAll(cb);
+
+  // Pieces other than pawns attack the same squares whichever color is to move
+  BitBoard attacks[BOARD_SIZE];
+  BitBoard b = all & ~cb->types[Pawn];
+  while (b) {
+    Square s = BitBoardPop(&b);
+    attacks[s] = LookupTableAttacks(l, s, ChessBoardSquare(cb, s), all);
+  }
+
+  for (Color c = White; c <= Black; c++) {
+    m->attacked[c] = PAWN_ATTACKS(cb->types[Pawn] & cb->colors[c], c);
+    b = cb->colors[c] & ~cb->types[Pawn];
+    while (b)
+      m->attacked[c] |= attacks[BitBoardPop(&b)];
+
+    ChessBoard side = *cb;
+    side.turn = c;
+    side.attacks = NULL;
+    if (c != cb->turn)
+      side.enPassant = EMPTY_SQUARE;
+
+    // The color not to move could capture the king it gives check to, which isn't a move
+    Analysis a;
+    analyzeShared(l, &side, &a, attacks);
+    a.checkMask &= ~ChessBoardTheir(&side, King);
+    m->moves[c] = countMobility(l, &side, &a, attacks, m->mobility[c]);
+  }
+}
+
+void ChessBoardMobilityBatch(LookupTable l, ChessBoard *cbs, Mobility *m, int n)
+{
+  for (int i = 0; i < n; i++)
+    ChessBoardMobility(l, &cbs[i], &m[i]);
+}
+
+// Analysis of a chess board given the attacks of each piece other than pawns. Their sliders
+// that see our king attack past it, so only those are looked up again.
+static void analyzeShared(LookupTable l, ChessBoard *cb, Analysis *a, BitBoard *attacks)
+{
   const BitBoard kingB = ChessBoardOur(cb, King);
   const Square  kingSq = BitBoardPeek(kingB);
-  const int     color  = ChessBoardColor(cb);
+  const BitBoard occupancies = ChessBoardAll(cb) & ~kingB;
+
+  a->attacked = PAWN_ATTACKS(ChessBoardTheir(cb, Pawn), !ChessBoardColor(cb));
+  BitBoard b = ChessBoardThem(cb) & ~cb->types[Pawn];
+  while (b) {
+    Square s = BitBoardPop(&b);
+    Type t = ChessBoardSquare(cb, s);
+    if ((attacks[s] & kingB) && (t >= Bishop))
+      a->attacked |= LookupTableAttacks(l, s, t, occupancies);
+    else
+      a->attacked |= attacks[s];
+  }
+  getCheckingAndPinned(l, cb, ChessBoardColor(cb), &a->checking, &a->pinned);
 
-  // Determine check mask
-  BitBoard checkMask;
-  const int numChecks = BitBoardCount(checking);
+  const int numChecks = BitBoardCount(a->checking);
   if (numChecks == 0) {
-    checkMask = ~EMPTY_BOARD;
+    a->checkMask = ~EMPTY_BOARD;
   } else if (numChecks == 1) {
-    Square cs = BitBoardPeek(checking);
-    checkMask = BitBoardAdd(EMPTY_BOARD, cs) | LookupTableSquaresBetween(l, kingSq, cs);
+    Square cs = BitBoardPeek(a->checking);
+    a->checkMask = BitBoardAdd(EMPTY_BOARD, cs) | LookupTableSquaresBetween(l, kingSq, cs);
   } else {
-    checkMask = EMPTY_BOARD;
+    a->checkMask = EMPTY_BOARD;
   }
+}
+
+// Count the legal moves of each type of our pieces given the analysis of the chess board and
+// the attacks of each piece other than pawns, returns their sum
+static int countMobility(LookupTable l, ChessBoard *cb, Analysis *a, BitBoard *attacks, int *mobility)
+{
+  const BitBoard us        = ChessBoardUs(cb);
+  const BitBoard all       = ChessBoardAll(cb);
+  const BitBoard kingB     = ChessBoardOur(cb, King);
+  const Square  kingSq     = BitBoardPeek(kingB);
+  const int     color      = ChessBoardColor(cb);
+  const BitBoard attacked  = a->attacked;
+
+  memset(mobility, 0, TYPE_SIZE * sizeof(int));
 
   // King moves
-  BitBoard moves = LookupTableAttacks(l, kingSq, King, EMPTY_BOARD) & ~us & ~attacked;
-  if (numChecks == 0) {
-    // Kingside: check rights and interior squares f/g
+  BitBoard moves = attacks[kingSq] & ~us & ~attacked;
+  if (a->checking == EMPTY_BOARD) {
     int clear = (((attacked & ATTACK_MASK) | (all & OCCUPANCY_MASK)) &
                  (KINGSIDE & ~KINGSIDE_CASTLING) & BACK_RANK(color)) == EMPTY_BOARD;
     if (ChessBoardKingSide(cb) && clear) moves |= (kingB << 2);
 
-    // Queenside: check rights and interior squares b/c/d
     clear = (((attacked & ATTACK_MASK) | (all & OCCUPANCY_MASK)) &
              (QUEENSIDE & ~QUEENSIDE_CASTLING) & BACK_RANK(color)) == EMPTY_BOARD;
     if (ChessBoardQueenSide(cb) && clear) moves |= (kingB >> 2);
   }
-  count += BitBoardCount(moves);
+  mobility[King] = BitBoardCount(moves);
 
   // If double-check, return early (only king moves allowed)
-  if (numChecks == 2) return count;
+  if (a->checkMask == EMPTY_BOARD) return mobility[King];
+
+  // Knight and slider moves
+  const BitBoard notUsAndCheck = ~us & a->checkMask;
+  BitBoard pieces = us & ~cb->types[Pawn] & ~kingB;
+  while (pieces) {
+    Square s = BitBoardPop(&pieces);
+    moves = attacks[s] & notUsAndCheck;
+    if (BitBoardAdd(EMPTY_BOARD, s) & a->pinned)
+      moves &= LookupTableLineOfSight(l, kingSq, s);
+    mobility[ChessBoardSquare(cb, s)] += BitBoardCount(moves);
+  }
 
-  const BitBoard notUsAndCheck = ~us & checkMask;
+  mobility[Pawn] = countPawnMoves(l, cb, a);
+  return mobility[Pawn] + mobility[King] + mobility[Knight] +
+         mobility[Bishop] + mobility[Rook] + mobility[Queen];
+}
 
-  // Knight moves
-  BitBoard piecesKnight = ChessBoardOur(cb, Knight);
-  while (piecesKnight) {
-    s = BitBoardPop(&piecesKnight);
-    moves = LookupTableAttacks(l, s, Knight, all) & notUsAndCheck;
+void ChessBoardTargets(LookupTable l, ChessBoard *cb, Filter f, Targets *t)
+{
+  const BitBoard all = ChessBoardAll(cb);
+  t->filter = f;
+  t->discoverers = EMPTY_BOARD;
+  t->theirKing = BitBoardPeek(ChessBoardTheir(cb, King));
+
+  BitBoard target = (f == Captures) ? ChessBoardThem(cb) : (f == Quiets) ? ~all : ~(BitBoard)EMPTY_BOARD;
+  for (Type type = Pawn; type <= Empty; type++)
+    t->targets[type] = target;
+  if (f != Checks)
+    return;
+
+  // A slider only checks from a square that sees their king past the other pieces
+  t->targets[Pawn]   = PAWN_ATTACKS(BitBoardAdd(EMPTY_BOARD, t->theirKing), !ChessBoardColor(cb));
+  t->targets[King]   = EMPTY_BOARD;
+  t->targets[Knight] = LookupTableAttacks(l, t->theirKing, Knight, EMPTY_BOARD);
+  t->targets[Bishop] = LookupTableAttacks(l, t->theirKing, Bishop, all);
+  t->targets[Rook]   = LookupTableAttacks(l, t->theirKing, Rook, all);
+  t->targets[Queen]  = t->targets[Bishop] | t->targets[Rook];
+  t->targets[Empty]  = EMPTY_BOARD;
+
+  // Our pieces standing alone between one of our sliders and their king
+  BitBoard b = (LookupTableAttacks(l, t->theirKing, Bishop, EMPTY_BOARD) & (ChessBoardOur(cb, Bishop) | ChessBoardOur(cb, Queen))) |
+               (LookupTableAttacks(l, t->theirKing, Rook, EMPTY_BOARD)   & (ChessBoardOur(cb, Rook)   | ChessBoardOur(cb, Queen)));
+  while (b) {
+    BitBoard between = LookupTableSquaresBetween(l, t->theirKing, BitBoardPop(&b)) & all;
+    if ((BitBoardCount(between) == 1) && (between & ChessBoardUs(cb)))
+      t->discoverers |= between;
+  }
+}
+
+BitBoard ChessBoardTargetsFrom(LookupTable l, Targets *t, Square from, Type type)
+{
+  if (BitBoardAdd(EMPTY_BOARD, from) & t->discoverers)
+    return t->targets[type] | ~LookupTableLineOfSight(l, t->theirKing, from);
+  return t->targets[type];
+}
+
+int ChessBoardGivesCheck(LookupTable l, ChessBoard *cb, Move m)
+{
+  BitBoard checking, pinned;
+  ChessBoardPlayMove(cb, m);
+  ChessBoardCheckingAndPinned(l, cb, &checking, &pinned);
+  ChessBoardUndoMove(cb, m);
+  return checking != EMPTY_BOARD;
+}
+
+int ChessBoardIsLegal(LookupTable l, ChessBoard *cb, Square from, Square to, Type promotion, Move *m)
+{
+  if (from >= BOARD_SIZE || to >= BOARD_SIZE)
+    return 0;
+
+  const BitBoard fromB  = BitBoardAdd(EMPTY_BOARD, from);
+  const BitBoard toB    = BitBoardAdd(EMPTY_BOARD, to);
+  const BitBoard all    = ChessBoardAll(cb);
+  const BitBoard kingB  = ChessBoardOur(cb, King);
+  const Square  kingSq  = BitBoardPeek(kingB);
+  const int     color   = ChessBoardColor(cb);
+  const Type    t       = ChessBoardSquare(cb, from);
+
+  // Only our pieces move, never onto our pieces, and pawns reaching the last rank must promote
+  if (!(fromB & ChessBoardUs(cb)) || (toB & ChessBoardUs(cb)))
+    return 0;
+  const int promotes = (t == Pawn) && (toB & BACK_RANK(!color));
+  if (promotes ? (promotion < Knight || promotion > Queen) : (promotion != Empty))
+    return 0;
+
+  BitBoard checking, pinned;
+  ChessBoardCheckingAndPinned(l, cb, &checking, &pinned);
+
+  int legal;
+  if (t == King) {
+    // Our king doesn't block their attacks on the squares it moves to
+    legal = (LookupTableAttacks(l, kingSq, King, EMPTY_BOARD) & toB) &&
+            !isAttacked(l, cb, to, all & ~kingB);
+    if (!legal && checking == EMPTY_BOARD)
+      legal = legalCastling(l, cb, toB);
+  } else if (checking & (checking - 1)) {
+    legal = 0; // Only the king can answer a double check
+  } else {
+    BitBoard checkMask = ~EMPTY_BOARD;
+    if (checking)
+      checkMask = checking | LookupTableSquaresBetween(l, kingSq, BitBoardPeek(checking));
+    BitBoard targets;
+    if (t == Pawn && to == ChessBoardEnPassant(cb)) {
+      targets = legalEnPassantFrom(l, cb, from, pinned, checkMask) ? toB : EMPTY_BOARD;
+    } else if (t == Pawn) {
+      BitBoard push = SINGLE_PUSH(fromB, color) & ~all;
+      targets = (PAWN_ATTACKS(fromB, color) & ChessBoardThem(cb)) | push |
+                (SINGLE_PUSH(push & ENPASSANT_RANK(color), color) & ~all);
+    } else {
+      targets = LookupTableAttacks(l, from, t, all);
+    }
+    if (fromB & pinned)
+      targets &= LookupTableLineOfSight(l, kingSq, from);
+    legal = (targets & toB & checkMask) != EMPTY_BOARD;
+  }
+
+  if (legal && m)
+    *m = newMove(cb, from, to, promotes ? promotion : t);
+  return legal;
+}
+
+// Whether our king castles to the given square, which needs the rights, the squares between
+// king and rook empty and the squares the king crosses not attacked. Assumes we're not in check.
+static int legalCastling(LookupTable l, ChessBoard *cb, BitBoard toB)
+{
+  const BitBoard kingB   = ChessBoardOur(cb, King);
+  const int      color   = ChessBoardColor(cb);
+  const BitBoard blocked = (ChessBoardAttacked(l, cb) & ATTACK_MASK) | (ChessBoardAll(cb) & OCCUPANCY_MASK);
+  if (toB == (kingB << 2))
+    return ChessBoardKingSide(cb) && !(blocked & (KINGSIDE & ~KINGSIDE_CASTLING) & BACK_RANK(color));
+  if (toB == (kingB >> 2))
+    return ChessBoardQueenSide(cb) && !(blocked & (QUEENSIDE & ~QUEENSIDE_CASTLING) & BACK_RANK(color));
+  return 0;
+}
+
+// Whether our pawn on from can capture en passant, by the same rules as countEnPassant
+static int legalEnPassantFrom(LookupTable l, ChessBoard *cb, Square from, BitBoard pinned, BitBoard checkMask)
+{
+  const BitBoard all    = ChessBoardAll(cb);
+  const Square  kingSq  = BitBoardPeek(ChessBoardOur(cb, King));
+  const int     color   = ChessBoardColor(cb);
+  const BitBoard epSq   = BitBoardAdd(EMPTY_BOARD, ChessBoardEnPassant(cb));
+  if (!(PAWN_ATTACKS(epSq, !color) & BitBoardAdd(EMPTY_BOARD, from)) ||
+      !((epSq | SINGLE_PUSH(epSq, !color)) & checkMask))
+    return 0;
+
+  // Pseudo-pin: both pawns leave the rank of our king
+  if (LookupTableAttacks(l, kingSq, Rook, all & ~BitBoardAdd(SINGLE_PUSH(epSq, !color), from)) &
+      RANK_OF(kingSq) & (ChessBoardTheir(cb, Rook) | ChessBoardTheir(cb, Queen)))
+    return 0;
+
+  return !(BitBoardAdd(EMPTY_BOARD, from) & pinned) ||
+         (BitBoardAdd(EMPTY_BOARD, from) & LookupTableLineOfSight(l, kingSq, ChessBoardEnPassant(cb)));
+}
+
+// Whether any of their pieces attacks a square, given the squares that block their sliders
+static int isAttacked(LookupTable l, ChessBoard *cb, Square s, BitBoard occupancies)
+{
+  const BitBoard b = BitBoardAdd(EMPTY_BOARD, s);
+  return (PAWN_ATTACKS(b, ChessBoardColor(cb)) & ChessBoardTheir(cb, Pawn)) ||
+         (LookupTableAttacks(l, s, Knight, EMPTY_BOARD) & ChessBoardTheir(cb, Knight)) ||
+         (LookupTableAttacks(l, s, King, EMPTY_BOARD) & ChessBoardTheir(cb, King)) ||
+         (LookupTableAttacks(l, s, Bishop, occupancies) & (ChessBoardTheir(cb, Bishop) | ChessBoardTheir(cb, Queen))) ||
+         (LookupTableAttacks(l, s, Rook, occupancies) & (ChessBoardTheir(cb, Rook) | ChessBoardTheir(cb, Queen)));
+}
+
+int ChessBoardCountFiltered(LookupTable l, ChessBoard *cb, Filter f)
+{
+  if (f == AllMoves)
+    return ChessBoardCount(l, cb);
+
+  // A pawn map's promotions count as four moves, a checking promotion's map as one
+  MoveMap maps[MAX_MOVES];
+  int n = ChessBoardFilterMaps(l, cb, f, maps), count = 0;
+  for (int i = 0; i < n; i++) {
+    int from = BitBoardCount(maps[i].from), to = BitBoardCount(maps[i].to);
+    count += (from > to) ? from : to;
+    if (maps[i].type == Pawn)
+      count += BitBoardCount(maps[i].to & (BACK_RANK(White) | BACK_RANK(Black))) * 3;
+  }
+  return count;
+}
+
+int ChessBoardFilterMaps(LookupTable l, ChessBoard *cb, Filter f, MoveMap *maps)
+{
+  Analysis a;
+  Targets t;
+  ChessBoardAnalyze(l, cb, &a);
+  ChessBoardTargets(l, cb, f, &t);
+  int n = 0;
+  Square s;
+
+  // Cache hot values
+  const BitBoard us        = ChessBoardUs(cb);
+  const BitBoard them      = ChessBoardThem(cb);
+  const BitBoard all       = ChessBoardAll(cb);
+  const BitBoard kingB     = ChessBoardOur(cb, King);
+  const Square  kingSq     = BitBoardPeek(kingB);
+  const int     color      = ChessBoardColor(cb);
+  const BitBoard attacked  = a.attacked;
+  const BitBoard pinned    = a.pinned;
+  const BitBoard checkMask = a.checkMask;
+  const int     numChecks  = BitBoardCount(a.checking);
+
+  // King map, castling is a quiet move and is played out to see if the rook checks
+  BitBoard moves = LookupTableAttacks(l, kingSq, King, EMPTY_BOARD) & ~us & ~attacked;
+  moves &= ChessBoardTargetsFrom(l, &t, kingSq, King);
+  if (numChecks == 0 && f != Captures) {
+    int clear = (((attacked & ATTACK_MASK) | (all & OCCUPANCY_MASK)) &
+                 (KINGSIDE & ~KINGSIDE_CASTLING) & BACK_RANK(color)) == EMPTY_BOARD;
+    if (ChessBoardKingSide(cb) && clear &&
+        ((f == Quiets) || ChessBoardGivesCheck(l, cb, newMove(cb, kingSq, kingSq + 2, King))))
+      moves |= (kingB << 2);
+
+    clear = (((attacked & ATTACK_MASK) | (all & OCCUPANCY_MASK)) &
+             (QUEENSIDE & ~QUEENSIDE_CASTLING) & BACK_RANK(color)) == EMPTY_BOARD;
+    if (ChessBoardQueenSide(cb) && clear &&
+        ((f == Quiets) || ChessBoardGivesCheck(l, cb, newMove(cb, kingSq, kingSq - 2, King))))
+      moves |= (kingB >> 2);
+  }
+  addMoveMap(maps, &n, kingB, moves, King);
+
+  // If double-check, return early (only king moves allowed)
+  if (numChecks == 2) return n;
+
+  // Knight and slider maps
+  BitBoard pieces = ChessBoardOur(cb, Knight) | ChessBoardOur(cb, Bishop) | ChessBoardOur(cb, Rook) | ChessBoardOur(cb, Queen);
+  while (pieces) {
+    s = BitBoardPop(&pieces);
+    Type type = ChessBoardSquare(cb, s);
+    moves = LookupTableAttacks(l, s, type, all) & ~us & checkMask & ChessBoardTargetsFrom(l, &t, s, type);
     if (BitBoardAdd(EMPTY_BOARD, s) & pinned)
       moves &= LookupTableLineOfSight(l, kingSq, s);
-    count += BitBoardCount(moves);
+    addMoveMap(maps, &n, BitBoardAdd(EMPTY_BOARD, s), moves, type);
   }
 
-  // Diagonal slider moves (bishops + queens)
-  BitBoard diagSliders = ChessBoardOur(cb, Bishop) | ChessBoardOur(cb, Queen);
-  while (diagSliders) {
-    s = BitBoardPop(&diagSliders);
-    moves = LookupTableAttacks(l, s, Bishop, all) & notUsAndCheck;
-    if (BitBoardAdd(EMPTY_BOARD, s) & pinned)
+  // Pawn maps, every promotion is a capture and a checking one is found by playing it
+  const BitBoard promotion = BACK_RANK(White) | BACK_RANK(Black);
+  const BitBoard enpassant = ENPASSANT_RANK(color);
+  const BitBoard ourPawns  = ChessBoardOur(cb, Pawn);
+  const BitBoard pushes    = (f == Captures) ? promotion : t.targets[Pawn] & ~promotion;
+  const BitBoard captures  = (f == Captures) ? them : t.targets[Pawn] & them & ~promotion;
+
+  BitBoard b1 = ourPawns & ~pinned & ~t.discoverers;
+  moves = PAWN_ATTACKS_LEFT(b1, color) & captures & checkMask;
+  addMoveMap(maps, &n, PAWN_ATTACKS_LEFT(moves, !color), moves, Pawn);
+  moves = PAWN_ATTACKS_RIGHT(b1, color) & captures & checkMask;
+  addMoveMap(maps, &n, PAWN_ATTACKS_RIGHT(moves, !color), moves, Pawn);
+  BitBoard b2 = SINGLE_PUSH(b1, color) & ~all;
+  moves = b2 & pushes & checkMask;
+  addMoveMap(maps, &n, SINGLE_PUSH(moves, !color), moves, Pawn);
+  moves = SINGLE_PUSH(b2 & enpassant, color) & ~all & pushes & checkMask;
+  addMoveMap(maps, &n, DOUBLE_PUSH(moves, !color), moves, Pawn);
+
+  // Pinned pawns move along their pin, discoverers anywhere off their line
+  b1 = ourPawns & (pinned | t.discoverers);
+  while (b1) {
+    s = BitBoardPop(&b1);
+    BitBoard sqBit = BitBoardAdd(EMPTY_BOARD, s);
+    BitBoard off   = ChessBoardTargetsFrom(l, &t, s, Empty) & ~promotion;
+    b2     = SINGLE_PUSH(sqBit, color) & ~all;
+    moves  = PAWN_ATTACKS(sqBit, color) & (captures | (them & off));
+    moves |= (b2 | (SINGLE_PUSH(b2 & enpassant, color) & ~all)) & (pushes | off);
+    moves &= checkMask;
+    if (sqBit & pinned)
       moves &= LookupTableLineOfSight(l, kingSq, s);
-    count += BitBoardCount(moves);
+    addMoveMap(maps, &n, sqBit, moves, Pawn);
+  }
+
+  // Checking promotions get a map of their promoted type each
+  if (f == Checks) {
+    b1 = ourPawns & PROMOTION_RANK(color);
+    while (b1) {
+      s = BitBoardPop(&b1);
+      BitBoard sqBit = BitBoardAdd(EMPTY_BOARD, s);
+      moves  = (PAWN_ATTACKS(sqBit, color) & them) | (SINGLE_PUSH(sqBit, color) & ~all);
+      moves &= checkMask;
+      if (sqBit & pinned)
+        moves &= LookupTableLineOfSight(l, kingSq, s);
+      while (moves) {
+        Square to = BitBoardPop(&moves);
+        for (Type type = Knight; type <= Queen; type++)
+          if (ChessBoardGivesCheck(l, cb, newMove(cb, s, to, type)))
+            addMoveMap(maps, &n, sqBit, BitBoardAdd(EMPTY_BOARD, to), type);
+      }
+    }
+  }
+
+  // En passant map, its moves are captures and are played out to see if removing a pawn checks
+  if ((f == Quiets) || (ChessBoardEnPassant(cb) == EMPTY_SQUARE))
+    return n;
+  b1 = PAWN_ATTACKS(BitBoardAdd(EMPTY_BOARD, ChessBoardEnPassant(cb)), !color) & ourPawns;
+  b2 = EMPTY_BOARD;
+  while (b1) {
+    s = BitBoardPop(&b1);
+    if (legalEnPassantFrom(l, cb, s, pinned, checkMask) &&
+        ((f == Captures) || ChessBoardGivesCheck(l, cb, newMove(cb, s, ChessBoardEnPassant(cb), Pawn))))
+      b2 = BitBoardAdd(b2, s);
+  }
+  addMoveMap(maps, &n, b2, BitBoardAdd(EMPTY_BOARD, ChessBoardEnPassant(cb)), Pawn);
+  return n;
+}
+
+// Add the map of the moves from one set of squares to another to maps, unless it has none
+static inline void addMoveMap(MoveMap *maps, int *n, BitBoard from, BitBoard to, Type t)
+{
+  if (from != EMPTY_BOARD && to != EMPTY_BOARD)
+    maps[(*n)++] = (MoveMap){.from = from, .to = to, .type = t};
+}
+
+// Count the legal number of moves given the analysis of the chess board
+static int countMoves(LookupTable l, ChessBoard *cb, Analysis *a)
+{
+  if (a->checking)
+    return countEvasions(l, cb, a);
+
+  int count = 0;
+  MATERIAL_DISPATCH(cb->material[cb->turn], count = countKernel, l, cb, a);
+  return count;
+}
+
+// Count the legal moves of a board that isn't in check, given the material of the side to
+// move. The loops of the classes it doesn't have compile away when material is a constant.
+static inline int countKernel(LookupTable l, ChessBoard *cb, Analysis *a, const int material)
+{
+  int count = 0;
+  Square s;
+
+  // Cache hot values
+  const BitBoard us        = ChessBoardUs(cb);
+  const BitBoard all       = ChessBoardAll(cb);
+  const BitBoard kingB     = ChessBoardOur(cb, King);
+  const Square  kingSq     = BitBoardPeek(kingB);
+  const int     color      = ChessBoardColor(cb);
+  const BitBoard attacked  = a->attacked;
+  const BitBoard pinned    = a->pinned;
+
+  // King moves
+  BitBoard moves = LookupTableAttacks(l, kingSq, King, EMPTY_BOARD) & ~us & ~attacked;
+  if (cb->castling) {
+    // Kingside: check rights and interior squares f/g
+    int clear = (((attacked & ATTACK_MASK) | (all & OCCUPANCY_MASK)) &
+                 (KINGSIDE & ~KINGSIDE_CASTLING) & BACK_RANK(color)) == EMPTY_BOARD;
+    if (ChessBoardKingSide(cb) && clear) moves |= (kingB << 2);
+
+    // Queenside: check rights and interior squares b/c/d
+    clear = (((attacked & ATTACK_MASK) | (all & OCCUPANCY_MASK)) &
+             (QUEENSIDE & ~QUEENSIDE_CASTLING) & BACK_RANK(color)) == EMPTY_BOARD;
+    if (ChessBoardQueenSide(cb) && clear) moves |= (kingB >> 2);
+  }
+  count += BitBoardCount(moves);
+
+  // Knight moves
+  if (material & HasKnights) {
+    BitBoard piecesKnight = ChessBoardOur(cb, Knight);
+    while (piecesKnight) {
+      s = BitBoardPop(&piecesKnight);
+      moves = LookupTableAttacks(l, s, Knight, all) & ~us;
+      if (BitBoardAdd(EMPTY_BOARD, s) & pinned)
+        moves &= LookupTableLineOfSight(l, kingSq, s);
+      count += BitBoardCount(moves);
+    }
+  }
+
+  // Diagonal slider moves (bishops + queens)
+  if (material & HasDiagonal) {
+    BitBoard diagSliders = ChessBoardOur(cb, Bishop) | ChessBoardOur(cb, Queen);
+    while (diagSliders) {
+      s = BitBoardPop(&diagSliders);
+      moves = LookupTableAttacks(l, s, Bishop, all) & ~us;
+      if (BitBoardAdd(EMPTY_BOARD, s) & pinned)
+        moves &= LookupTableLineOfSight(l, kingSq, s);
+      count += BitBoardCount(moves);
+    }
   }
 
   // Orthogonal slider moves (rooks + queens)
-  BitBoard orthoSliders = ChessBoardOur(cb, Rook) | ChessBoardOur(cb, Queen);
-  while (orthoSliders) {
-    s = BitBoardPop(&orthoSliders);
-    moves = LookupTableAttacks(l, s, Rook, all) & notUsAndCheck;
-    if (BitBoardAdd(EMPTY_BOARD, s) & pinned)
-      moves &= LookupTableLineOfSight(l, kingSq, s);
-    count += BitBoardCount(moves);
+  if (material & HasOrthogonal) {
+    BitBoard orthoSliders = ChessBoardOur(cb, Rook) | ChessBoardOur(cb, Queen);
+    while (orthoSliders) {
+      s = BitBoardPop(&orthoSliders);
+      moves = LookupTableAttacks(l, s, Rook, all) & ~us;
+      if (BitBoardAdd(EMPTY_BOARD, s) & pinned)
+        moves &= LookupTableLineOfSight(l, kingSq, s);
+      count += BitBoardCount(moves);
+    }
   }
 
-  // Pawn moves
+  // Pawn moves, en passant included
+  if (material & HasPawns)
+    count += countPawnMoves(l, cb, a);
+  return count;
+}
+
+// Count the legal number of pawn moves given the analysis of the chess board, en passant included
+static inline int countPawnMoves(LookupTable l, ChessBoard *cb, Analysis *a)
+{
+  int count = 0;
+  Square s;
+  BitBoard moves;
+
+  // Cache hot values
+  const BitBoard them      = ChessBoardThem(cb);
+  const BitBoard all       = ChessBoardAll(cb);
+  const Square  kingSq     = BitBoardPeek(ChessBoardOur(cb, King));
+  const int     color      = ChessBoardColor(cb);
+  const BitBoard pinned    = a->pinned;
+  const BitBoard checkMask = a->checkMask;
+
   const BitBoard promotion = BACK_RANK(White) | BACK_RANK(Black);
   const BitBoard enpassant = ENPASSANT_RANK(color);
   const BitBoard ourPawns  = ChessBoardOur(cb, Pawn);
@@ -341,34 +1473,170 @@ int ChessBoardCount(LookupTable l, ChessBoard *cb)
            + BitBoardCount((moves & b3 & checkMask) & promotion) * 3;
   }
 
-  // En passant moves
-  if (ChessBoardEnPassant(cb) != EMPTY_SQUARE) {
-    BitBoard epSq = BitBoardAdd(EMPTY_BOARD, ChessBoardEnPassant(cb));
-    b1 = PAWN_ATTACKS(epSq, !color) & ourPawns;
-    b2 = EMPTY_BOARD;
-    while (b1) {
-      s = BitBoardPop(&b1);
+  return count + countEnPassant(l, cb, a);
+}
 
-      // Pseudo-pin check for en passant
-      if (LookupTableAttacks(l, kingSq, Rook,
-            all & ~BitBoardAdd(SINGLE_PUSH(epSq, !color), s)) &
-          RANK_OF(kingSq) & (ChessBoardTheir(cb, Rook) | ChessBoardTheir(cb, Queen)))
-        continue;
+// Count the legal en passant captures, in check only if they capture the checker or block the check
+static inline int countEnPassant(LookupTable l, ChessBoard *cb, Analysis *a)
+{
+  if (ChessBoardEnPassant(cb) == EMPTY_SQUARE)
+    return 0;
 
-      b2 |= BitBoardAdd(EMPTY_BOARD, s);
-      if (b2 & pinned)
-        b2 &= LookupTableLineOfSight(l, kingSq, ChessBoardEnPassant(cb));
-    }
-    if (b2 != EMPTY_BOARD)
-      count += BitBoardCount(b2);
-  }
+  const BitBoard all    = ChessBoardAll(cb);
+  const Square  kingSq  = BitBoardPeek(ChessBoardOur(cb, King));
+  const int     color   = ChessBoardColor(cb);
+  const BitBoard epSq   = BitBoardAdd(EMPTY_BOARD, ChessBoardEnPassant(cb));
+  if (!((epSq | SINGLE_PUSH(epSq, !color)) & a->checkMask))
+    return 0;
+
+  int count = 0;
+  BitBoard b = PAWN_ATTACKS(epSq, !color) & ChessBoardOur(cb, Pawn);
+  while (b) {
+    Square s = BitBoardPop(&b);
+
+    // Pseudo-pin check for en passant
+    if (LookupTableAttacks(l, kingSq, Rook,
+          all & ~BitBoardAdd(SINGLE_PUSH(epSq, !color), s)) &
+        RANK_OF(kingSq) & (ChessBoardTheir(cb, Rook) | ChessBoardTheir(cb, Queen)))
+      continue;
+
+    // A pinned pawn can only capture along its pin
+    if ((BitBoardAdd(EMPTY_BOARD, s) & a->pinned) &&
+        !(BitBoardAdd(EMPTY_BOARD, s) & LookupTableLineOfSight(l, kingSq, ChessBoardEnPassant(cb))))
+      continue;
 
+    count++;
+  }
   return count;
 }
 
+// Count the legal moves of a board in check. Only the king can answer a double check, a
+// single check is also answered by capturing the checker or moving in between, which the
+// check mask holds. A pinned piece can never do either, so pins, castling and pinned pawns
+// are skipped altogether.
+static int countEvasions(LookupTable l, ChessBoard *cb, Analysis *a)
+{
+  const BitBoard all       = ChessBoardAll(cb);
+  const Square  kingSq     = BitBoardPeek(ChessBoardOur(cb, King));
+  const int     color      = ChessBoardColor(cb);
+  const BitBoard checkMask = a->checkMask;
+
+  int count = BitBoardCount(LookupTableAttacks(l, kingSq, King, EMPTY_BOARD) & ~ChessBoardUs(cb) & ~a->attacked);
+  if (a->checking & (a->checking - 1))
+    return count;
+
+  // Pieces capturing the checker or moving in between, the mask never holds one of ours
+  const BitBoard unpinned = ~a->pinned;
+  BitBoard b = ChessBoardOur(cb, Knight) & unpinned;
+  while (b)
+    count += BitBoardCount(LookupTableAttacks(l, BitBoardPop(&b), Knight, all) & checkMask);
+  b = (ChessBoardOur(cb, Bishop) | ChessBoardOur(cb, Queen)) & unpinned;
+  while (b)
+    count += BitBoardCount(LookupTableAttacks(l, BitBoardPop(&b), Bishop, all) & checkMask);
+  b = (ChessBoardOur(cb, Rook) | ChessBoardOur(cb, Queen)) & unpinned;
+  while (b)
+    count += BitBoardCount(LookupTableAttacks(l, BitBoardPop(&b), Rook, all) & checkMask);
+
+  // Pawns capturing the checker or pushing in between
+  const BitBoard promotion = BACK_RANK(White) | BACK_RANK(Black);
+  const BitBoard between   = checkMask & ~a->checking;
+  const BitBoard pawns     = ChessBoardOur(cb, Pawn) & unpinned;
+  const int captures = BitBoardCount(PAWN_ATTACKS(a->checking, !color) & pawns);
+  count += (a->checking & promotion) ? captures * 4 : captures;
+  const BitBoard pushed = SINGLE_PUSH(pawns, color) & ~all;
+  const BitBoard moves  = pushed & between;
+  count += BitBoardCount(moves) + BitBoardCount(moves & promotion) * 3;
+  count += BitBoardCount(SINGLE_PUSH(pushed & ENPASSANT_RANK(color), color) & ~all & between);
+
+  return count + countEnPassant(l, cb, a);
+}
+
+// Returns whether there's a legal move given the analysis of the chess board. Castling is
+// never needed: a king that can castle can also step towards its rook.
+static int hasMove(LookupTable l, ChessBoard *cb, Analysis *a)
+{
+  const Square kingSq = BitBoardPeek(ChessBoardOur(cb, King));
+
+  // King steps, the only moves out of a double check
+  if (LookupTableAttacks(l, kingSq, King, EMPTY_BOARD) & ~ChessBoardUs(cb) & ~a->attacked)
+    return 1;
+  if (a->checkMask == EMPTY_BOARD)
+    return 0;
+  if (hasPieceMove(l, cb, a))
+    return 1;
+
+  // En passant, the rarest and most expensive to check. Every other move was ruled out,
+  // so any move counted is one.
+  return (ChessBoardEnPassant(cb) != EMPTY_SQUARE) && countMoves(l, cb, a) > 0;
+}
+
+// Returns whether a piece other than the king has a move other than en passant, given the
+// pins and check mask of the chess board. Looks where moves are cheapest to find first.
+static int hasPieceMove(LookupTable l, ChessBoard *cb, Analysis *a)
+{
+  Square s;
+  const BitBoard us        = ChessBoardUs(cb);
+  const BitBoard them      = ChessBoardThem(cb);
+  const BitBoard all       = ChessBoardAll(cb);
+  const Square  kingSq     = BitBoardPeek(ChessBoardOur(cb, King));
+  const int     color      = ChessBoardColor(cb);
+  const BitBoard pinned    = a->pinned;
+  const BitBoard checkMask = a->checkMask;
+
+  // Unpinned pawn pushes and captures, all at once
+  const BitBoard ourPawns = ChessBoardOur(cb, Pawn);
+  BitBoard b1 = ourPawns & ~pinned;
+  BitBoard b2 = SINGLE_PUSH(b1, color) & ~all;
+  if ((b2 | (SINGLE_PUSH(b2 & ENPASSANT_RANK(color), color) & ~all)) & checkMask)
+    return 1;
+  if ((PAWN_ATTACKS_LEFT(b1, color) | PAWN_ATTACKS_RIGHT(b1, color)) & them & checkMask)
+    return 1;
+
+  // Knights, which can't move at all when pinned
+  const BitBoard notUsAndCheck = ~us & checkMask;
+  b1 = ChessBoardOur(cb, Knight) & ~pinned;
+  while (b1) {
+    s = BitBoardPop(&b1);
+    if (LookupTableAttacks(l, s, Knight, EMPTY_BOARD) & notUsAndCheck)
+      return 1;
+  }
+
+  // Sliders, along their pin if they're pinned
+  b1 = ChessBoardOur(cb, Bishop) | ChessBoardOur(cb, Rook) | ChessBoardOur(cb, Queen);
+  while (b1) {
+    s = BitBoardPop(&b1);
+    Type t = ChessBoardSquare(cb, s);
+    BitBoard moves = (t == Queen)
+      ? LookupTableAttacks(l, s, Bishop, all) | LookupTableAttacks(l, s, Rook, all)
+      : LookupTableAttacks(l, s, t, all);
+    moves &= notUsAndCheck;
+    if (BitBoardAdd(EMPTY_BOARD, s) & pinned)
+      moves &= LookupTableLineOfSight(l, kingSq, s);
+    if (moves)
+      return 1;
+  }
+
+  // Pinned pawns, along their pin
+  b1 = ourPawns & pinned;
+  while (b1) {
+    s = BitBoardPop(&b1);
+    BitBoard moves = PAWN_ATTACKS(BitBoardAdd(EMPTY_BOARD, s), color) & them;
+    b2 = SINGLE_PUSH(BitBoardAdd(EMPTY_BOARD, s), color) & ~all;
+    moves |= b2 | (SINGLE_PUSH(b2 & ENPASSANT_RANK(color), color) & ~all);
+    if (moves & checkMask & LookupTableLineOfSight(l, kingSq, s))
+      return 1;
+  }
+  return 0;
+}
+
 char *ChessBoardToFEN(ChessBoard *cb)
 {
   static char fen[FEN_SIZE];
+  return ChessBoardWriteFEN(cb, fen);
+}
+
+char *ChessBoardWriteFEN(ChessBoard *cb, char *fen)
+{
   int index = 0;
 
   // 1) Piece placement from rank 8 down to rank 1 (which in your indexing is rank=0..7)
@@ -462,22 +1730,121 @@ char *ChessBoardToFEN(ChessBoard *cb)
   return fen;
 }
 
+void ChessBoardAnalyze(LookupTable l, ChessBoard *cb, Analysis *a)
+{
+  analyze(l, cb, a, NULL);
+}
+
+// If attacks isn't NULL, the squares attacked by each of their pieces other than pawns are stored in it
+static inline void analyze(LookupTable l, ChessBoard *cb, Analysis *a, BitBoard *attacks)
+{
+  const BitBoard kingB  = ChessBoardOur(cb, King);
+  const Square  kingSq  = BitBoardPeek(kingB);
+  const BitBoard all    = ChessBoardAll(cb);
+  const BitBoard us     = ChessBoardUs(cb);
+  const int      color  = ChessBoardColor(cb);
+
+  if (cb->attacks && !attacks) {
+    Attacks *frame = &cb->attacks->stack[cb->attacks->ply];
+    a->attacked = frame->attacked[!color];
+    a->checking = frame->checking[color];
+    a->pinned   = frame->pinned[color];
+  } else {
+    // Our king doesn't block their attacks
+    const BitBoard occupancies = all & ~kingB;
+    BitBoard b = ChessBoardTheir(cb, Pawn);
+    a->attacked = PAWN_ATTACKS(b, !color);
+    a->checking = PAWN_ATTACKS(kingB, color) & b;
+    a->pinned   = EMPTY_BOARD;
+
+    b = ChessBoardTheir(cb, Knight);
+    a->checking |= LookupTableAttacks(l, kingSq, Knight, EMPTY_BOARD) & b;
+    while (b) {
+      Square s = BitBoardPop(&b);
+      BitBoard moves = LookupTableAttacks(l, s, Knight, occupancies);
+      a->attacked |= moves;
+      if (attacks) attacks[s] = moves;
+    }
+
+    // Sliders on a line with our king either check it, pin one of our pieces or neither
+    const BitBoard diagonal = LookupTableAttacks(l, kingSq, Bishop, EMPTY_BOARD);
+    b = ChessBoardTheir(cb, Bishop) | ChessBoardTheir(cb, Queen);
+    while (b) {
+      Square s = BitBoardPop(&b);
+      BitBoard moves = LookupTableAttacks(l, s, Bishop, occupancies);
+      a->attacked |= moves;
+      if (attacks) attacks[s] = moves;
+      if (BitBoardAdd(EMPTY_BOARD, s) & diagonal) {
+        BitBoard between = LookupTableSquaresBetween(l, kingSq, s) & all;
+        if (between == EMPTY_BOARD)
+          a->checking = BitBoardAdd(a->checking, s);
+        else if (((between & (between - 1)) == EMPTY_BOARD) && (between & us))
+          a->pinned |= between;
+      }
+    }
+
+    const BitBoard orthogonal = LookupTableAttacks(l, kingSq, Rook, EMPTY_BOARD);
+    b = ChessBoardTheir(cb, Rook) | ChessBoardTheir(cb, Queen);
+    while (b) {
+      Square s = BitBoardPop(&b);
+      BitBoard moves = LookupTableAttacks(l, s, Rook, occupancies);
+      a->attacked |= moves;
+      if (attacks) attacks[s] = (ChessBoardSquare(cb, s) == Queen) ? attacks[s] | moves : moves;
+      if (BitBoardAdd(EMPTY_BOARD, s) & orthogonal) {
+        BitBoard between = LookupTableSquaresBetween(l, kingSq, s) & all;
+        if (between == EMPTY_BOARD)
+          a->checking = BitBoardAdd(a->checking, s);
+        else if (((between & (between - 1)) == EMPTY_BOARD) && (between & us))
+          a->pinned |= between;
+      }
+    }
+
+    Square s = BitBoardPeek(ChessBoardTheir(cb, King));
+    a->attacked |= LookupTableAttacks(l, s, King, EMPTY_BOARD);
+    if (attacks) attacks[s] = LookupTableAttacks(l, s, King, EMPTY_BOARD);
+  }
+
+  // Determine check mask
+  const int numChecks = BitBoardCount(a->checking);
+  if (numChecks == 0) {
+    a->checkMask = ~EMPTY_BOARD;
+  } else if (numChecks == 1) {
+    Square cs = BitBoardPeek(a->checking);
+    a->checkMask = BitBoardAdd(EMPTY_BOARD, cs) | LookupTableSquaresBetween(l, kingSq, cs);
+  } else {
+    a->checkMask = EMPTY_BOARD;
+  }
+}
+
 void ChessBoardCheckingAndPinned(LookupTable l, ChessBoard *cb, BitBoard *checking, BitBoard *pinned)
 {
-  Square ourKing = BitBoardPeek(ChessBoardOur(cb, King));
+  if (cb->attacks) {
+    Attacks *a = &cb->attacks->stack[cb->attacks->ply];
+    *checking = a->checking[cb->turn];
+    *pinned = a->pinned[cb->turn];
+    return;
+  }
+  getCheckingAndPinned(l, cb, cb->turn, checking, pinned);
+}
+
+// Checking pieces and pinned pieces for the king of color c
+static void getCheckingAndPinned(LookupTable l, ChessBoard *cb, Color c, BitBoard *checking, BitBoard *pinned)
+{
+  BitBoard king = cb->types[King] & cb->colors[c];
+  BitBoard them = cb->colors[!c];
+  Square ourKing = BitBoardPeek(king);
 
-  *checking = (PAWN_ATTACKS(ChessBoardOur(cb, King), ChessBoardColor(cb)) & ChessBoardTheir(cb, Pawn)) |
-              (LookupTableAttacks(l, ourKing, Knight, EMPTY_BOARD) & ChessBoardTheir(cb, Knight));
+  *checking = (PAWN_ATTACKS(king, c) & cb->types[Pawn] & them) |
+              (LookupTableAttacks(l, ourKing, Knight, EMPTY_BOARD) & cb->types[Knight] & them);
   *pinned = EMPTY_BOARD;
 
-  BitBoard candidates = (LookupTableAttacks(l, ourKing, Bishop, ChessBoardThem(cb)) & (ChessBoardTheir(cb, Bishop) |
-                         ChessBoardTheir(cb, Queen))) | (LookupTableAttacks(l, ourKing, Rook, ChessBoardThem(cb)) &
-                        (ChessBoardTheir(cb, Rook) | ChessBoardTheir(cb, Queen)));
+  BitBoard candidates = (LookupTableAttacks(l, ourKing, Bishop, them) & (cb->types[Bishop] | cb->types[Queen]) & them) |
+                        (LookupTableAttacks(l, ourKing, Rook, them) & (cb->types[Rook] | cb->types[Queen]) & them);
 
   while (candidates)
   {
     Square s = BitBoardPop(&candidates);
-    BitBoard b = LookupTableSquaresBetween(l, ourKing, s) & ChessBoardAll(cb) & ~ChessBoardThem(cb);
+    BitBoard b = LookupTableSquaresBetween(l, ourKing, s) & ChessBoardAll(cb) & ~them;
     if (b == EMPTY_BOARD)
       *checking |= BitBoardAdd(EMPTY_BOARD, s);
     else if ((b & (b - 1)) == EMPTY_BOARD)
@@ -487,6 +1854,9 @@ void ChessBoardCheckingAndPinned(LookupTable l, ChessBoard *cb, BitBoard *checki
 
 BitBoard ChessBoardAttacked(LookupTable l, ChessBoard *cb)
 {
+  if (cb->attacks)
+    return cb->attacks->stack[cb->attacks->ply].attacked[!cb->turn];
+
   BitBoard occupancies = ChessBoardAll(cb) & ~ChessBoardOur(cb, King);
   BitBoard attacked = PAWN_ATTACKS(ChessBoardTheir(cb, Pawn), !ChessBoardColor(cb));
   BitBoard b = ChessBoardTheir(cb, Knight);
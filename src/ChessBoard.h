@@ -1,6 +1,86 @@
 #ifndef CHESSBOARD_H
 #define CHESSBOARD_H
 
+#define MAX_PLY 128   // Deepest search supported by incremental attacks
+#define MAX_MOVES 256 // More than the legal moves of any chess board
+#define FEN_SIZE 128  // Longer than the FEN string of any chess board
+#define MOVE_SIZE 6   // Longer than any move in UCI notation, e.g. e7e8q
+
+/*
+ * Attacks, checks and pins of a chess board for both colors. A color's attacks are
+ * computed with the other color's king removed from the occupancies.
+ */
+typedef struct
+{
+  BitBoard attacks[BOARD_SIZE];  // Squares attacked by the piece on each square
+  BitBoard attacked[COLOR_SIZE]; // Squares attacked by each color
+  BitBoard checking[COLOR_SIZE]; // Pieces checking each color's king
+  BitBoard pinned[COLOR_SIZE];   // Pieces pinned to each color's king
+} Attacks;
+
+/*
+ * A stack of attacks, one per ply, used to maintain attacks incrementally as moves
+ * are played and undone on a chess board.
+ */
+typedef struct
+{
+  LookupTable l;
+  int ply;
+  Attacks stack[MAX_PLY];
+} AttackStack;
+
+/*
+ * The classes of pieces a color has, one bit each. Moves are counted and generated by
+ * kernels specialized on the material of the side to move, which skip the classes it
+ * doesn't have.
+ */
+typedef enum
+{
+  HasPawns = 1,
+  HasKnights = 2,
+  HasDiagonal = 4,  // Bishops or queens
+  HasOrthogonal = 8 // Rooks or queens
+} Material;
+
+#define MATERIAL_SIZE 16
+#define FULL_MATERIAL (HasPawns | HasKnights | HasDiagonal | HasOrthogonal)
+
+/*
+ * Calls kernel(..., material) with a material signature turned into a constant, so the kernel
+ * is inlined once per signature and the classes it doesn't have compile away. Full material is
+ * by far the most common, so it's tested before the jump table. Moves are counted and filled
+ * by dispatching on the material of the side to move only: their pieces are only read by the
+ * analysis, whose loops over a class they don't have stop at once, and keying it on their
+ * material as well measured no faster. Nothing is skipped at full material, so the kernels
+ * only pay off in endgames.
+ */
+#define MATERIAL_DISPATCH(material, kernel, ...)                             \
+  do {                                                                       \
+    const int signature = (material);                                        \
+    if (signature == FULL_MATERIAL) {                                        \
+      kernel(__VA_ARGS__, FULL_MATERIAL);                                    \
+      break;                                                                 \
+    }                                                                        \
+    switch (signature) {                                                     \
+    case 0:  kernel(__VA_ARGS__, 0); break;                                  \
+    case 1:  kernel(__VA_ARGS__, 1); break;                                  \
+    case 2:  kernel(__VA_ARGS__, 2); break;                                  \
+    case 3:  kernel(__VA_ARGS__, 3); break;                                  \
+    case 4:  kernel(__VA_ARGS__, 4); break;                                  \
+    case 5:  kernel(__VA_ARGS__, 5); break;                                  \
+    case 6:  kernel(__VA_ARGS__, 6); break;                                  \
+    case 7:  kernel(__VA_ARGS__, 7); break;                                  \
+    case 8:  kernel(__VA_ARGS__, 8); break;                                  \
+    case 9:  kernel(__VA_ARGS__, 9); break;                                  \
+    case 10: kernel(__VA_ARGS__, 10); break;                                 \
+    case 11: kernel(__VA_ARGS__, 11); break;                                 \
+    case 12: kernel(__VA_ARGS__, 12); break;                                 \
+    case 13: kernel(__VA_ARGS__, 13); break;                                 \
+    case 14: kernel(__VA_ARGS__, 14); break;                                 \
+    default: __builtin_unreachable(); /* Full material is above */         \
+    }                                                                        \
+  } while (0)
+
 /*
  * Representation of a chess board. Note that castling rights are representated as a set of
  * squares where if the original square of a king and the original square of a rook is present,
@@ -14,6 +94,8 @@ typedef struct
   Color turn;
   Square enPassant;
   BitBoard castling;
+  AttackStack *attacks;            // Incrementally maintained attacks, NULL if computed from scratch
+  uint8_t material[COLOR_SIZE];    // Material of each color, updated by captures and promotions
 } ChessBoard;
 
 /*
@@ -37,16 +119,138 @@ typedef struct
   BitBoard castling; // castling rights before the move
 } Move;
 
+/*
+ * Whether the side to move of a chess board has a legal move, and if not, whether it's in check
+ */
+typedef enum
+{
+  Ongoing,
+  Checkmated,
+  Stalemated
+} Status;
+
+/*
+ * What our moves must respect in a chess board: the squares attacked by their pieces,
+ * their pieces checking our king, our pieces pinned to our king and the squares our
+ * other pieces must move to if we're in check.
+ */
+typedef struct
+{
+  BitBoard attacked;
+  BitBoard checking;
+  BitBoard pinned;
+  BitBoard checkMask;
+} Analysis;
+
+/*
+ * The analysis of a chess board from their point of view, along with the squares attacked
+ * by each of our pieces other than pawns. After any one of our moves it can be patched for
+ * the moved pieces instead of being recomputed.
+ */
+typedef struct
+{
+  Analysis analysis;            // Analysis of the flipped board
+  BitBoard attacks[BOARD_SIZE]; // Squares attacked by our piece on each square
+} AnalysisCache;
+
+/*
+ * The standard perft breakdown of a number of moves. Captures include en passant and
+ * capturing promotions, checks include discovered and double checks, and discovered
+ * checks don't include double checks.
+ */
+typedef struct
+{
+  long nodes;
+  long captures;
+  long enPassant;
+  long castles;
+  long promotions;
+  long checks;
+  long discoveredChecks;
+  long doubleChecks;
+  long checkmates;
+} Stats;
+
+/*
+ * The mobility of both colors of a chess board, each counted as if it were to move, so
+ * only the color to move can capture en passant. A promotion counts as four moves, while
+ * capturing the king of the color in check isn't a move.
+ */
+typedef struct
+{
+  BitBoard attacked[COLOR_SIZE];       // Squares attacked by each color's pieces
+  int moves[COLOR_SIZE];               // Legal moves of each color
+  int mobility[COLOR_SIZE][TYPE_SIZE]; // Legal moves of each color's pieces of each type
+} Mobility;
+
+/*
+ * Which of the legal moves of a chess board to generate or count. Captures include en
+ * passant and every promotion, quiets are every other move, castling included.
+ */
+typedef enum
+{
+  AllMoves,
+  Captures,
+  Quiets,
+  Checks
+} Filter;
+
+/*
+ * Moves of our pieces of one type, from the one square of from to every square of to, from
+ * every square of from to the one square of to, or pairing pawns with the squares they push
+ * or capture to in order. A pawn's move to the last rank is each of its promotions.
+ */
+typedef struct
+{
+  BitBoard from;
+  BitBoard to;
+  Type type;
+} MoveMap;
+
+/*
+ * The squares each type of our pieces must move to for its move to pass a filter. For
+ * checks, a move of one of the discoverers also passes if it leaves the line between our
+ * slider and their king. Castling, en passant and checking promotions aren't covered,
+ * since they move or remove more than one piece.
+ */
+typedef struct
+{
+  Filter filter;
+  BitBoard targets[TYPE_SIZE]; // By type, Empty for what any move passes on
+  BitBoard discoverers;        // Our pieces alone between one of our sliders and their king
+  Square theirKing;
+} Targets;
+
 /*
  * Creates a new chess board with the given FEN string
  */
-ChessBoard ChessBoardNew(char *fen); // Stack allocated
+ChessBoard ChessBoardNew(const char *fen); // Stack allocated
+
+/*
+ * Returns whether a FEN string can be parsed safely by ChessBoardNew: eight ranks of eight
+ * squares with one king of each color and no pawn on the back ranks, a turn whose opponent
+ * isn't in check, castling rights whose king and rook are in place, and an en passant square
+ * on the third or sixth rank
+ */
+int ChessBoardValidFEN(const char *fen);
 
 /*
- * Given a chess board, return it's FEN string representation
+ * Recompute the material of both colors of a chess board whose pieces were set directly
+ */
+void ChessBoardResetMaterial(ChessBoard *cb);
+
+/*
+ * Given a chess board, return it's FEN string representation. The string is overwritten by
+ * the next call, so this isn't thread-safe, see ChessBoardWriteFEN.
  */
 char *ChessBoardToFEN(ChessBoard *cb);
 
+/*
+ * Given a chess board, write its FEN string representation to fen, of at least FEN_SIZE
+ * characters, and return it
+ */
+char *ChessBoardWriteFEN(ChessBoard *cb, char *fen);
+
 /*
  * Play a move on the given board in-place, recording undo info in Move
  */
@@ -57,11 +261,23 @@ void ChessBoardPlayMove(ChessBoard *cb, Move m);
  */
 void ChessBoardUndoMove(ChessBoard *cb, Move m);
 
+/*
+ * Maintain the attacks, checks and pins of the given board incrementally in the given
+ * stack as moves are played and undone, instead of recomputing them at every position.
+ * If the stack is NULL, they are computed from scratch again.
+ */
+void ChessBoardTrack(LookupTable l, ChessBoard *cb, AttackStack *as);
+
 /*
  * Prints a chess board to stdout
  */
 void ChessBoardPrintBoard(ChessBoard cb);
 
+/*
+ * Write a move in UCI notation to move, of at least MOVE_SIZE characters, and return it
+ */
+char *ChessBoardWriteMove(Move m, char *move);
+
 /*
  * Prints a move to stdout
  */
@@ -72,11 +288,136 @@ void ChessBoardPrintMove(Move m);
  */
 ChessBoard ChessBoardFlip(ChessBoard *cb);
 
+/*
+ * Given a chess board, return its Zobrist hash. The en passant square is only part of the
+ * hash if we can legally capture on it, and a castling right only while both its
+ * king and rook squares remain, so transpositions hash the same.
+ */
+uint64_t ChessBoardHash(LookupTable l, ChessBoard *cb);
+
+/*
+ * Given a chess board, return the smallest Zobrist hash among the boards with the same
+ * perft: the board with colors swapped and, without castling rights, either mirrored.
+ */
+uint64_t ChessBoardCanonicalHash(LookupTable l, ChessBoard *cb);
+
+/*
+ * Returns 1 if we can legally capture en passant on a chess board. A board whose en passant
+ * square can't be captured on has the same moves as without it.
+ */
+int ChessBoardLegalEnPassant(LookupTable l, ChessBoard *cb);
+
+/*
+ * Given a chess board, return it with files a and h swapped. Castling rights are dropped,
+ * so it only has the same perft if there weren't any.
+ */
+ChessBoard ChessBoardMirror(ChessBoard *cb);
+
+/*
+ * Given a chess board, return it with ranks 1 and 8 swapped, white and black swapped,
+ * and the other color to move. It always has the same perft.
+ */
+ChessBoard ChessBoardSwapColors(ChessBoard *cb);
+
+/*
+ * Returns 1 if both chess boards have the same pieces, turn, en passant and castling
+ */
+int ChessBoardEqual(ChessBoard *cb1, ChessBoard *cb2);
+
 /*
  * Directly count the legal number of moves in a given chess board
  */
 int ChessBoardCount(LookupTable l, ChessBoard *cb);
 
+/*
+ * Returns whether a chess board has any legal move, stopping at the first one found
+ */
+int ChessBoardHasLegalMove(LookupTable l, ChessBoard *cb);
+
+/*
+ * Given a chess board, return whether the side to move is checkmated, stalemated or neither
+ */
+Status ChessBoardStatus(LookupTable l, ChessBoard *cb);
+
+/*
+ * Computes the analysis of a chess board in a single pass over their pieces
+ */
+void ChessBoardAnalyze(LookupTable l, ChessBoard *cb, Analysis *a);
+
+/*
+ * Directly count the legal number of moves in a chess board given its analysis
+ */
+int ChessBoardCountAnalyzed(LookupTable l, ChessBoard *cb, Analysis *a);
+
+/*
+ * Computes the analysis of the flipped chess board, keeping what's needed to patch it
+ */
+void ChessBoardCacheAnalysis(LookupTable l, ChessBoard *cb, AnalysisCache *ac);
+
+/*
+ * Directly count the legal number of moves in a chess board reached by playing the given
+ * move on the board whose analysis was cached
+ */
+int ChessBoardCountCached(LookupTable l, ChessBoard *cb, AnalysisCache *ac, Move m);
+
+/*
+ * Adds the perft breakdown of the legal moves of a chess board to stats. If checks isn't
+ * NULL, the checking moves are written to it and checkmates are left to the caller,
+ * otherwise each checking move is played to find checkmates. Returns the number of
+ * checking moves.
+ */
+int ChessBoardCountStats(LookupTable l, ChessBoard *cb, Stats *stats, Move *checks);
+
+/*
+ * Computes the mobility of both colors of a chess board. The attacks of each piece are
+ * looked up once and shared by both colors' analyses and moves.
+ */
+void ChessBoardMobility(LookupTable l, ChessBoard *cb, Mobility *m);
+
+/*
+ * Computes the mobility of each of n chess boards into the matching entry of m. Boards
+ * are independent, so callers may split an array between threads.
+ */
+void ChessBoardMobilityBatch(LookupTable l, ChessBoard *cbs, Mobility *m, int n);
+
+/*
+ * Computes the targets of the moves of a chess board that pass the given filter
+ */
+void ChessBoardTargets(LookupTable l, ChessBoard *cb, Filter f, Targets *t);
+
+/*
+ * Given the targets of a chess board, return the squares our piece of that type on from must
+ * move to for its move to pass the filter
+ */
+BitBoard ChessBoardTargetsFrom(LookupTable l, Targets *t, Square from, Type type);
+
+/*
+ * Returns whether the given move of a chess board checks their king, by playing it
+ */
+int ChessBoardGivesCheck(LookupTable l, ChessBoard *cb, Move m);
+
+/*
+ * Returns whether moving our piece on from to the square to is legal on a chess board, with
+ * promotion the type a pawn promotes to, Empty if the move isn't a promotion, and castling
+ * given as the king moving two squares. Answers from the moves of that one piece, its pin
+ * and the check on our king, without generating any other moves, so it suits validating
+ * moves sent by users. If the move is legal and m isn't NULL, the move is written to m.
+ */
+int ChessBoardIsLegal(LookupTable l, ChessBoard *cb, Square from, Square to, Type promotion, Move *m);
+
+/*
+ * Directly count the legal moves of a chess board that pass the given filter
+ */
+int ChessBoardCountFiltered(LookupTable l, ChessBoard *cb, Filter f);
+
+/*
+ * Writes the legal moves of a chess board that pass the given filter, other than AllMoves, to
+ * maps as sets of moves and returns their number, of at most MAX_MOVES. A checking promotion
+ * gets a map of its own whose type is the promoted piece, every other map keeps the type of
+ * its pieces. Empty maps are left out.
+ */
+int ChessBoardFilterMaps(LookupTable l, ChessBoard *cb, Filter f, MoveMap *maps);
+
 /*
  * Adds sets of squares corresponding to their checking pieces,
  * our pinned pieces and squares attacked by their pieces
@@ -100,5 +441,13 @@ static inline BitBoard ChessBoardTheir(ChessBoard *cb, Type t) { return cb->type
 static inline BitBoard ChessBoardAll(ChessBoard *cb)           { return cb->colors[White] | cb->colors[Black]; }
 static inline BitBoard ChessBoardUs(ChessBoard *cb)            { return cb->colors[cb->turn]; }
 static inline BitBoard ChessBoardThem(ChessBoard *cb)          { return cb->colors[!cb->turn]; }
+static inline int ChessBoardHasCastling(ChessBoard *cb)
+{
+  // A castling right needs both its king and rook squares
+  return ((cb->castling & KINGSIDE_CASTLING & SOUTH_EDGE) == (KINGSIDE_CASTLING & SOUTH_EDGE)) ||
+         ((cb->castling & KINGSIDE_CASTLING & NORTH_EDGE) == (KINGSIDE_CASTLING & NORTH_EDGE)) ||
+         ((cb->castling & QUEENSIDE_CASTLING & SOUTH_EDGE) == (QUEENSIDE_CASTLING & SOUTH_EDGE)) ||
+         ((cb->castling & QUEENSIDE_CASTLING & NORTH_EDGE) == (QUEENSIDE_CASTLING & NORTH_EDGE));
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "BitBoard.h"
+#include "LookupTable.h"
+#include "ChessBoard.h"
+#include "MoveSet.h"
+#include "Estimator.h"
+
+#define MIN_SAMPLES 32 // Samples needed before the variance is trusted
+#define BATCH 256      // Samples of a random path each thread takes between merges
+#define Z_95 1.959964  // Standard normal quantile of a 95% confidence interval
+
+/*
+ * What all the sampling threads share: the running sums of their samples, and whether
+ * they should stop
+ */
+typedef struct
+{
+  LookupTable l;
+  ChessBoard *cb;
+  EstimateOptions *o;
+  struct timespec start;
+  pthread_mutex_t lock;
+  double sum, sumSquares;
+  long samples;
+  int done;
+} Sampler;
+
+/*
+ * A sampling thread, with its own copy of the chess board, its own random numbers and the
+ * lookup table of its node
+ */
+typedef struct
+{
+  Sampler *s;
+  LookupTable l;
+  ChessBoard cb;
+  uint64_t state;
+} Worker;
+
+static void *sample(void *arg);
+static double expand(Worker *w, int depth, int plies);
+static double randomPath(Worker *w, int depth);
+static int merge(Sampler *s, double sum, double sumSquares, long n);
+static double halfWidth(double sum, double sumSquares, long n);
+static double elapsed(struct timespec *start);
+
+Estimate EstimatorRun(LookupTable l, ChessBoard *cb, EstimateOptions *o)
+{
+  Estimate e = {0};
+  if (o->depth == 0)
+  {
+    e.nodes = 1;
+    return e;
+  }
+
+  Sampler s = {.l = l, .cb = cb, .o = o};
+  clock_gettime(CLOCK_MONOTONIC, &s.start);
+  pthread_mutex_init(&s.lock, NULL);
+
+  int threads = (o->threads > 0) ? o->threads : 1;
+  Worker *workers = malloc(threads * sizeof(Worker));
+  pthread_t *ids = malloc(threads * sizeof(pthread_t));
+  if (workers == NULL || ids == NULL)
+  {
+    fprintf(stderr, "Insufficient memory!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < threads; i++)
+  {
+    workers[i].s = &s;
+    workers[i].cb = *cb;
+    ChessBoardTrack(l, &workers[i].cb, NULL); // Attack stacks can't be shared between threads
+    workers[i].state = o->seed + (uint64_t)i * 0x9E3779B97F4A7C15ULL;
+    if (pthread_create(&ids[i], NULL, sample, &workers[i]) != 0)
+    {
+      fprintf(stderr, "Failed to create a sampling thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int i = 0; i < threads; i++)
+    pthread_join(ids[i], NULL);
+
+  e.nodes = s.sum / s.samples;
+  e.halfWidth = (o->expand >= o->depth - 1) ? 0 : halfWidth(s.sum, s.sumSquares, s.samples);
+  e.samples = s.samples;
+
+  pthread_mutex_destroy(&s.lock);
+  free(ids);
+  free(workers);
+  return e;
+}
+
+// Take samples until the sampler is done, merging them into its sums every so often
+static void *sample(void *arg)
+{
+  Worker *w = arg;
+  Sampler *s = w->s;
+  w->l = LookupTableLocal(s->l);
+  int expanded = s->o->expand > 0;
+  int batch = expanded ? 1 : BATCH; // A sample that expands plies takes long enough already
+
+  for (;;)
+  {
+    double sum = 0, sumSquares = 0;
+    for (int i = 0; i < batch; i++)
+    {
+      double x = expanded ? expand(w, s->o->depth, s->o->expand) : randomPath(w, s->o->depth);
+      sum += x;
+      sumSquares += x * x;
+    }
+    if (merge(s, sum, sumSquares, batch))
+      return NULL;
+  }
+}
+
+// Sum the random paths from every position reached after the given number of plies
+static double expand(Worker *w, int depth, int plies)
+{
+  if (plies == 0 || depth == 1)
+    return randomPath(w, depth);
+
+  LookupTable l = w->l;
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, &w->cb, &ms);
+
+  double nodes = 0;
+  while (!MoveSetIsEmpty(&ms))
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(&w->cb, m);
+    nodes += expand(w, depth - 1, plies - 1);
+    ChessBoardUndoMove(&w->cb, m);
+  }
+  return nodes;
+}
+
+// Follow one uniformly random path, returning the product of the number of moves along it
+static double randomPath(Worker *w, int depth)
+{
+  LookupTable l = w->l;
+  if (depth == 1)
+    return ChessBoardCount(l, &w->cb);
+
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, &w->cb, &ms);
+  int n = MoveSetCount(&ms);
+  if (n == 0)
+    return 0;
+
+  Move m = MoveSetPick(&ms, MoveSetRandom(&w->state) % n);
+
+  ChessBoardPlayMove(&w->cb, m);
+  double nodes = n * randomPath(w, depth - 1);
+  ChessBoardUndoMove(&w->cb, m);
+  return nodes;
+}
+
+// Add a batch of samples to the sampler, returns 1 if sampling should stop
+static int merge(Sampler *s, double sum, double sumSquares, long n)
+{
+  EstimateOptions *o = s->o;
+  pthread_mutex_lock(&s->lock);
+  s->sum += sum;
+  s->sumSquares += sumSquares;
+  s->samples += n;
+  if (o->expand >= o->depth - 1)
+    s->done = 1; // Every sample is the exact perft
+  else if (!s->done && s->samples >= MIN_SAMPLES)
+  {
+    double mean = s->sum / s->samples;
+    if (o->error > 0 && halfWidth(s->sum, s->sumSquares, s->samples) <= o->error * mean)
+      s->done = 1;
+    if (o->seconds > 0 && elapsed(&s->start) >= o->seconds)
+      s->done = 1;
+  }
+  int done = s->done;
+  pthread_mutex_unlock(&s->lock);
+  return done;
+}
+
+// Half-width of the 95% confidence interval of the mean of n samples
+static double halfWidth(double sum, double sumSquares, long n)
+{
+  if (n < 2)
+    return INFINITY;
+  double mean = sum / n;
+  double variance = (sumSquares - n * mean * mean) / (n - 1);
+  return (variance > 0) ? Z_95 * sqrt(variance / n) : 0;
+}
+
+static double elapsed(struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -0,0 +1,43 @@
+#ifndef ESTIMATOR_H
+#define ESTIMATOR_H
+
+#include <stdint.h>
+
+#include "BitBoard.h"
+#include "LookupTable.h"
+#include "ChessBoard.h"
+
+/*
+ * How a perft estimate is sampled and when sampling stops. Sampling stops once the
+ * confidence interval is within the target error, or once the time limit is reached.
+ */
+typedef struct
+{
+  int depth;       // Depth of the perft to estimate
+  int expand;      // Plies searched exhaustively before sampling, 0 to sample from the root
+  double error;    // Target half-width of the confidence interval relative to the estimate, 0 for none
+  double seconds;  // Time limit, 0 for none
+  int threads;     // Threads sampling at once
+  uint64_t seed;   // Seed of the random paths, each thread derives its own from it
+} EstimateOptions;
+
+/*
+ * An estimate of a perft, as the mean of independent samples of it
+ */
+typedef struct
+{
+  double nodes;     // Estimated number of paths
+  double halfWidth; // Half-width of the 95% confidence interval around nodes
+  long samples;     // Number of samples averaged
+} Estimate;
+
+/*
+ * Estimates the perft of a chess board far beyond exact reach. Each sample expands the
+ * first plies fully, then follows one random path from every position it reached, and
+ * multiplies the number of moves along the path. The last ply is counted directly, so
+ * expanding depth - 1 plies gives the exact perft. At least one of error and seconds
+ * must be set.
+ */
+Estimate EstimatorRun(LookupTable l, ChessBoard *cb, EstimateOptions *o);
+
+#endif
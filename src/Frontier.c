@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "BitBoard.h"
+#include "LookupTable.h"
+#include "ChessBoard.h"
+#include "MoveSet.h"
+#include "Perft.h"
+#include "PackedBoard.h"
+#include "Memory.h"
+#include "Frontier.h"
+
+#define MIN_ENTRIES 64
+
+/*
+ * A board of the frontier and the number of paths reaching it
+ */
+typedef struct
+{
+  PackedBoard board;
+  long paths;
+} Entry;
+
+/*
+ * The boards in memory, plus the sorted runs that were spilled to a file each time memory
+ * filled up with distinct boards
+ */
+typedef struct
+{
+  Entry *entries;
+  size_t size;       // Number of entries in memory
+  size_t capacity;
+  FILE *file;        // Spilled runs one after another, NULL if never spilled
+  long *runs;        // Number of entries in each spilled run
+  int numRuns;
+  long paths;
+} Frontier;
+
+/*
+ * A reader over one spilled run of the frontier's file, through its share of the memory
+ */
+typedef struct
+{
+  long offset;       // Index in the file of the next entry to read
+  long remaining;    // Entries left to read from the file
+  Entry *buffer;
+  size_t size, position, length;
+} Run;
+
+static void expand(LookupTable l, ChessBoard *cb, Frontier *f, int plies);
+static void add(LookupTable l, Frontier *f, ChessBoard *cb);
+static void compact(Frontier *f);
+static void spill(Frontier *f);
+static long searchRuns(LookupTable l, Frontier *f, int depth, long *positions);
+static long search(LookupTable l, Entry *e, int depth);
+static int nextEntry(FILE *file, Run *r, Entry *e);
+static void siftDown(int *heap, int n, int i, Entry *heads);
+static int compareEntries(const void *a, const void *b);
+static void *allocate(size_t bytes);
+
+long FrontierCount(LookupTable l, ChessBoard *cb, int depth, int split, size_t bytes, FrontierStats *stats)
+{
+  split = (split < depth) ? split : depth;
+  split = (split > 0) ? split : 0;
+
+  Frontier f = {0};
+  f.capacity = bytes / sizeof(Entry);
+  f.capacity = (f.capacity > MIN_ENTRIES) ? f.capacity : MIN_ENTRIES;
+  f.entries = MemoryAlloc(f.capacity * sizeof(Entry), MEMORY_LOCAL, "frontier");
+  expand(l, cb, &f, split);
+
+  long nodes = 0, positions = 0;
+  if (f.numRuns == 0)
+  {
+    compact(&f);
+    positions = f.size;
+    for (size_t i = 0; i < f.size; i++)
+      nodes += search(l, &f.entries[i], depth - split);
+  }
+  else
+  {
+    // Spill what's left in memory so every board is in a sorted run
+    if (f.size > 0)
+      spill(&f);
+    nodes = searchRuns(l, &f, depth - split, &positions);
+  }
+
+  if (stats != NULL)
+  {
+    stats->paths = f.paths;
+    stats->positions = positions;
+    stats->runs = f.numRuns;
+  }
+  if (f.file != NULL)
+    fclose(f.file); // Temporary files are removed when closed
+  free(f.runs);
+  MemoryFree(f.entries);
+  return nodes;
+}
+
+// Add every board the given number of plies down to the frontier, one per path
+static void expand(LookupTable l, ChessBoard *cb, Frontier *f, int plies)
+{
+  if (plies == 0)
+  {
+    add(l, f, cb);
+    return;
+  }
+
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  while (!MoveSetIsEmpty(&ms))
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, m);
+    expand(l, cb, f, plies - 1);
+    ChessBoardUndoMove(cb, m);
+  }
+}
+
+// Pack a board into the frontier. A full frontier is merged, and spilled if merging didn't
+// free at least half of it, since it would soon fill up again.
+static void add(LookupTable l, Frontier *f, ChessBoard *cb)
+{
+  Entry *e = &f->entries[f->size++];
+  e->board = PackedBoardPack(cb);
+  if (e->board.enPassant != EMPTY_SQUARE && !ChessBoardLegalEnPassant(l, cb))
+    e->board.enPassant = EMPTY_SQUARE;
+  e->paths = 1;
+  f->paths++;
+
+  if (f->size == f->capacity)
+  {
+    compact(f);
+    if (f->size > f->capacity / 2)
+      spill(f);
+  }
+}
+
+// Sort the boards in memory and merge identical ones, adding up their paths
+static void compact(Frontier *f)
+{
+  if (f->size == 0)
+    return;
+  qsort(f->entries, f->size, sizeof(Entry), compareEntries);
+
+  size_t n = 0;
+  for (size_t i = 1; i < f->size; i++)
+  {
+    if (compareEntries(&f->entries[n], &f->entries[i]) == 0)
+      f->entries[n].paths += f->entries[i].paths;
+    else
+      f->entries[++n] = f->entries[i];
+  }
+  f->size = n + 1;
+}
+
+// Merge the boards in memory and append them to the file as a new run, clearing memory
+static void spill(Frontier *f)
+{
+  compact(f);
+  if (f->file == NULL)
+    f->file = tmpfile();
+  if (f->file == NULL)
+  {
+    fprintf(stderr, "Failed to create a file to spill the frontier to\n");
+    exit(EXIT_FAILURE);
+  }
+  fseek(f->file, 0, SEEK_END);
+  if (fwrite(f->entries, sizeof(Entry), f->size, f->file) != f->size)
+  {
+    fprintf(stderr, "Failed to spill the frontier to disk\n");
+    exit(EXIT_FAILURE);
+  }
+
+  f->runs = realloc(f->runs, (f->numRuns + 1) * sizeof(long));
+  if (f->runs == NULL)
+  {
+    fprintf(stderr, "Insufficient memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  f->runs[f->numRuns++] = f->size;
+  f->size = 0;
+}
+
+// Merge the spilled runs in sorted order, searching each distinct board once with the
+// paths of all its entries. Every board is on disk by now, so the memory of the frontier
+// is split between the runs to read them through, and a heap picks the smallest head.
+static long searchRuns(LookupTable l, Frontier *f, int depth, long *positions)
+{
+  Run *runs = allocate(f->numRuns * sizeof(Run));
+  Entry *heads = allocate(f->numRuns * sizeof(Entry));
+  int *heap = allocate(f->numRuns * sizeof(int));
+  size_t share = f->capacity / f->numRuns;
+  Entry *buffers = f->entries, *extra = NULL;
+  if (share == 0)
+  {
+    share = 1;
+    buffers = extra = allocate(f->numRuns * sizeof(Entry));
+  }
+
+  long offset = 0;
+  int n = 0;
+  for (int i = 0; i < f->numRuns; i++)
+  {
+    runs[i].offset = offset;
+    runs[i].remaining = f->runs[i];
+    runs[i].buffer = buffers + i * share;
+    runs[i].size = share;
+    runs[i].position = runs[i].length = 0;
+    offset += f->runs[i];
+    if (nextEntry(f->file, &runs[i], &heads[i]))
+      heap[n++] = i;
+  }
+  for (int i = n / 2 - 1; i >= 0; i--)
+    siftDown(heap, n, i, heads);
+
+  long nodes = 0;
+  Entry last;
+  int pending = 0; // Whether last holds a board yet to be searched
+  while (n > 0)
+  {
+    int min = heap[0];
+
+    // Runs are sorted, so a board differing from the last one has no entries left
+    if (pending && compareEntries(&last, &heads[min]) == 0)
+      last.paths += heads[min].paths;
+    else
+    {
+      if (pending)
+      {
+        nodes += search(l, &last, depth);
+        (*positions)++;
+      }
+      last = heads[min];
+      pending = 1;
+    }
+    if (!nextEntry(f->file, &runs[min], &heads[min]))
+      heap[0] = heap[--n];
+    siftDown(heap, n, 0, heads);
+  }
+  if (pending)
+  {
+    nodes += search(l, &last, depth);
+    (*positions)++;
+  }
+
+  free(extra);
+  free(heap);
+  free(heads);
+  free(runs);
+  return nodes;
+}
+
+// The paths of the given depth through a board of the frontier
+static long search(LookupTable l, Entry *e, int depth)
+{
+  ChessBoard cb = PackedBoardUnpack(&e->board);
+  return e->paths * PerftCount(l, &cb, depth);
+}
+
+// Read the next entry of a run, returns 0 if the run is exhausted
+static int nextEntry(FILE *file, Run *r, Entry *e)
+{
+  if (r->position == r->length)
+  {
+    if (r->remaining == 0)
+      return 0;
+    size_t n = ((size_t)r->remaining < r->size) ? (size_t)r->remaining : r->size;
+    fseek(file, r->offset * sizeof(Entry), SEEK_SET);
+    if (fread(r->buffer, sizeof(Entry), n, file) != n)
+    {
+      fprintf(stderr, "Failed to read the spilled frontier from disk\n");
+      exit(EXIT_FAILURE);
+    }
+    r->offset += n;
+    r->remaining -= n;
+    r->position = 0;
+    r->length = n;
+  }
+  *e = r->buffer[r->position++];
+  return 1;
+}
+
+// Move the run at index i of a heap of n runs down until its head is no larger than its
+// children's
+static void siftDown(int *heap, int n, int i, Entry *heads)
+{
+  for (;;)
+  {
+    int min = i, left = 2 * i + 1, right = left + 1;
+    if (left < n && compareEntries(&heads[heap[left]], &heads[heap[min]]) < 0)
+      min = left;
+    if (right < n && compareEntries(&heads[heap[right]], &heads[heap[min]]) < 0)
+      min = right;
+    if (min == i)
+      return;
+    int t = heap[i];
+    heap[i] = heap[min];
+    heap[min] = t;
+    i = min;
+  }
+}
+
+// Packed boards have no padding, so identical boards have identical bytes
+static int compareEntries(const void *a, const void *b)
+{
+  return memcmp(&((const Entry *)a)->board, &((const Entry *)b)->board, sizeof(PackedBoard));
+}
+
+static void *allocate(size_t bytes)
+{
+  void *p = malloc(bytes);
+  if (p == NULL)
+  {
+    fprintf(stderr, "Insufficient memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
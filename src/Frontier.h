@@ -0,0 +1,31 @@
+#ifndef FRONTIER_H
+#define FRONTIER_H
+
+#include <stddef.h>
+
+#include "BitBoard.h"
+#include "LookupTable.h"
+#include "ChessBoard.h"
+
+/*
+ * What a breadth-first search found at its frontier
+ */
+typedef struct
+{
+  long paths;     // Boards reached at the frontier, one per path
+  long positions; // Distinct boards among them, each searched once
+  int runs;       // Sorted runs of boards spilled to disk
+} FrontierStats;
+
+/*
+ * Count the paths of the given depth from a chess board breadth first. Every board split
+ * plies down is packed into a frontier along with the number of paths reaching it, and
+ * identical boards are merged by sorting, so the subtree of each distinct board is only
+ * searched once and multiplied by its paths. The frontier takes at most bytes of memory,
+ * beyond which it's spilled to temporary files as sorted runs that are merged at the end.
+ * Boards only differing by an en passant square that can't be captured on are merged. If
+ * stats isn't NULL, what the frontier held is written to it.
+ */
+long FrontierCount(LookupTable l, ChessBoard *cb, int depth, int split, size_t bytes, FrontierStats *stats);
+
+#endif
@@ -0,0 +1,206 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "BitBoard.h"
+#include "LookupTable.h"
+#include "ChessBoard.h"
+#include "MoveSet.h"
+#include "PackedBoard.h"
+#include "Game.h"
+
+#define FIFTY_MOVES 100               // Plies without a capture or pawn move that draw the game
+#define LIGHT_SQUARES 0xAA55AA55AA55AA55
+#define LINE_SIZE (64 + MAX_GAME_PLIES * MOVE_SIZE) // A space and a move per ply
+
+/*
+ * What the threads generating games share, each taking the next game not yet taken
+ */
+typedef struct
+{
+  LookupTable l;
+  ChessBoard *start;
+  long games;
+  long next;
+  int maxPlies;
+  uint64_t seed;
+  FILE *out;
+  FILE *positions;
+  pthread_mutex_t lock;
+  long plies;
+} Generator;
+
+static int insufficientMaterial(ChessBoard *cb);
+static int repeated(uint64_t *history, int ply, int halfmoves);
+static void *generate(void *arg);
+static void writeGame(Generator *gen, long index, Game *g);
+
+void GamePlayRandom(LookupTable l, ChessBoard *start, int maxPlies, uint64_t seed, Game *g)
+{
+  uint64_t history[MAX_GAME_PLIES + 1];
+  int halfmoves = 0;
+  ChessBoard cb = *start;
+  ChessBoardTrack(l, &cb, NULL);
+  if (maxPlies > MAX_GAME_PLIES)
+    maxPlies = MAX_GAME_PLIES;
+
+  g->start = cb;
+  g->plies = 0;
+  g->ending = Unfinished;
+  history[0] = ChessBoardHash(l, &cb);
+
+  for (;;)
+  {
+    MoveSet ms = MoveSetNew();
+    MoveSetFill(l, &cb, &ms);
+    int n = MoveSetCount(&ms);
+    if (n == 0)
+    {
+      g->ending = (ChessBoardStatus(l, &cb) == Checkmated) ? Checkmate : Stalemate;
+      break;
+    }
+    if (halfmoves >= FIFTY_MOVES)
+      g->ending = FiftyMoves;
+    else if (repeated(history, g->plies, halfmoves))
+      g->ending = Repetition;
+    else if (insufficientMaterial(&cb))
+      g->ending = InsufficientMaterial;
+    if (g->ending != Unfinished || g->plies == maxPlies)
+      break;
+
+    Move m = MoveSetPick(&ms, MoveSetRandom(&seed) % n);
+    ChessBoardPlayMove(&cb, m);
+    g->moves[g->plies++] = m;
+    halfmoves = (m.from.type == Pawn || m.captured.type != Empty) ? 0 : halfmoves + 1;
+    history[g->plies] = ChessBoardHash(l, &cb);
+  }
+  g->turn = ChessBoardColor(&cb);
+}
+
+const char *GameResult(Game *g)
+{
+  if (g->ending == Unfinished)
+    return "*";
+  if (g->ending != Checkmate)
+    return "1/2-1/2";
+  return (g->turn == White) ? "0-1" : "1-0";
+}
+
+const char *GameEnding(Game *g)
+{
+  static const char *names[] = {"unfinished", "checkmate", "stalemate", "fifty-moves", "repetition", "material"};
+  return names[g->ending];
+}
+
+long GameGenerate(LookupTable l, ChessBoard *start, long games, int maxPlies, int threads,
+                  uint64_t seed, FILE *out, FILE *positions)
+{
+  Generator gen = {.l = l, .start = start, .games = games, .maxPlies = maxPlies, .seed = seed,
+                   .out = out, .positions = positions};
+  pthread_mutex_init(&gen.lock, NULL);
+  threads = (threads > 0) ? threads : 1;
+  pthread_t *ids = malloc(threads * sizeof(pthread_t));
+  if (ids == NULL)
+  {
+    fprintf(stderr, "Insufficient memory!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < threads; i++)
+    if (pthread_create(&ids[i], NULL, generate, &gen) != 0)
+    {
+      fprintf(stderr, "Failed to create a game thread\n");
+      exit(EXIT_FAILURE);
+    }
+  for (int i = 0; i < threads; i++)
+    pthread_join(ids[i], NULL);
+
+  pthread_mutex_destroy(&gen.lock);
+  free(ids);
+  return gen.plies;
+}
+
+// Neither side can checkmate with only kings and at most one minor piece, or with only
+// kings and bishops all on squares of the same color
+static int insufficientMaterial(ChessBoard *cb)
+{
+  if (cb->types[Pawn] | cb->types[Rook] | cb->types[Queen])
+    return 0;
+  BitBoard minors = cb->types[Knight] | cb->types[Bishop];
+  if (BitBoardCount(minors) <= 1)
+    return 1;
+  return !cb->types[Knight] && (!(minors & LIGHT_SQUARES) || !(minors & ~LIGHT_SQUARES));
+}
+
+// Whether the position at ply has occurred twice before, only positions since the last
+// capture or pawn move can repeat it, and only with the same side to move
+static int repeated(uint64_t *history, int ply, int halfmoves)
+{
+  int count = 1;
+  for (int i = ply - 2; i >= ply - halfmoves; i -= 2)
+    if (history[i] == history[ply] && ++count == 3)
+      return 1;
+  return 0;
+}
+
+static void *generate(void *arg)
+{
+  Generator *gen = arg;
+  LookupTable l = LookupTableLocal(gen->l);
+  Game *g = malloc(sizeof(Game));
+  if (g == NULL)
+  {
+    fprintf(stderr, "Insufficient memory!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  long i;
+  while ((i = __atomic_fetch_add(&gen->next, 1, __ATOMIC_RELAXED)) < gen->games)
+  {
+    GamePlayRandom(l, gen->start, gen->maxPlies, gen->seed + i, g);
+    writeGame(gen, i, g);
+  }
+  free(g);
+  return NULL;
+}
+
+// Write a game's line, and its positions, without interleaving them with other threads
+static void writeGame(Generator *gen, long index, Game *g)
+{
+  char *line = malloc(LINE_SIZE);
+  PackedBoard *pbs = gen->positions ? malloc((g->plies + 1) * sizeof(PackedBoard)) : NULL;
+  if (line == NULL || (gen->positions && pbs == NULL))
+  {
+    fprintf(stderr, "Insufficient memory!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int length = sprintf(line, "%ld %s %s %d", index, GameResult(g), GameEnding(g), g->plies);
+  ChessBoard cb = g->start;
+  for (int i = 0; i < g->plies; i++)
+  {
+    Move m = g->moves[i];
+    line[length++] = ' ';
+    length += strlen(ChessBoardWriteMove(m, line + length));
+    if (pbs)
+      pbs[i] = PackedBoardPack(&cb);
+    ChessBoardPlayMove(&cb, m);
+  }
+  line[length] = '\0';
+  if (pbs)
+    pbs[g->plies] = PackedBoardPack(&cb);
+
+  pthread_mutex_lock(&gen->lock);
+  fprintf(gen->out, "%s\n", line);
+  if (pbs && fwrite(pbs, sizeof(PackedBoard), g->plies + 1, gen->positions) != (size_t)(g->plies + 1))
+  {
+    fprintf(stderr, "Failed to write positions\n");
+    exit(EXIT_FAILURE);
+  }
+  gen->plies += g->plies;
+  pthread_mutex_unlock(&gen->lock);
+
+  free(pbs);
+  free(line);
+}
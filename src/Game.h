@@ -0,0 +1,65 @@
+#ifndef GAME_H
+#define GAME_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "BitBoard.h"
+#include "LookupTable.h"
+#include "ChessBoard.h"
+
+#define MAX_GAME_PLIES 1024
+
+/*
+ * How a game ended, Unfinished if it reached its maximum number of plies first
+ */
+typedef enum
+{
+  Unfinished,
+  Checkmate,
+  Stalemate,
+  FiftyMoves,
+  Repetition,
+  InsufficientMaterial
+} Ending;
+
+/*
+ * A game played from a chess board, as the moves played from it
+ */
+typedef struct
+{
+  ChessBoard start;
+  Move moves[MAX_GAME_PLIES];
+  int plies;
+  Ending ending;
+  Color turn;        // Side to move when the game ended, the loser if checkmated
+} Game;
+
+/*
+ * Play a game from a chess board where every move is picked uniformly at random among the
+ * legal moves, until it ends or reaches the given number of plies. The fifty-move rule and
+ * repetitions are counted from the start of the game.
+ */
+void GamePlayRandom(LookupTable l, ChessBoard *start, int maxPlies, uint64_t seed, Game *g);
+
+/*
+ * Return the result of a game: "1-0", "0-1", "1/2-1/2", or "*" if unfinished
+ */
+const char *GameResult(Game *g);
+
+/*
+ * Return the name of the way a game ended
+ */
+const char *GameEnding(Game *g);
+
+/*
+ * Play the given number of random games from a chess board over the given number of
+ * threads, game i using seed + i. Each game is written to out as a line with its index,
+ * result, ending, number of plies and moves. If positions isn't NULL, every position of
+ * each game, from its start to its end, is written to it as packed boards, in the same
+ * order as the lines of out. Returns the total number of plies played.
+ */
+long GameGenerate(LookupTable l, ChessBoard *start, long games, int maxPlies, int threads,
+                  uint64_t seed, FILE *out, FILE *positions);
+
+#endif
@@ -1,9 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <immintrin.h>
 #include "BitBoard.h"
 #include "LookupTable.h"
+#include "Memory.h"
 
 # if defined(__BMI2__)
 #   define BMI2 1
@@ -18,6 +20,7 @@
 #define BISHOP_ATTACKS_POWERSET 512
 #define ROOK_ATTACKS_POWERSET 4096
 #define MAGIC_NUMBERS "data/magicNumbers.out"
+#define ZOBRIST_SEED 0x9E3779B97F4A7C15
 
 typedef enum
 {
@@ -48,11 +51,17 @@ struct lookupTable
   BitBoard rookMasks[BOARD_SIZE];
   BitBoard squaresBetween[BOARD_SIZE][BOARD_SIZE]; // Squares Between exclusive
   BitBoard lineOfSight[BOARD_SIZE][BOARD_SIZE];    // All squares of a rank/file/diagonal/antidiagonal
+  uint64_t zobrist[COLOR_SIZE][TYPE_SIZE][BOARD_SIZE]; // Zobrist keys of each piece on each square
+  uint64_t zobristCastling[BOARD_SIZE];              // Zobrist keys of each castling square
+  uint64_t zobristEnPassant[BOARD_SIZE + 1];         // Zobrist keys of each en passant square, zero if none
+  uint64_t zobristTurn;                              // Zobrist key of black to move
   
   #if !BMI2
   Magic bishopMagics[BOARD_SIZE]; // Used for bishop attacks
   Magic rookMagics[BOARD_SIZE];   // Used for rook attacks
   #endif
+
+  LookupTable *replicas; // One per NUMA node, NULL if not replicated
 };
 
 static BitBoard getMove(Square s, Type t, Direction d, int steps);
@@ -63,6 +72,8 @@ static BitBoard getSquaresBetween(LookupTable l, Square s1, Square s2);
 static BitBoard getLineOfSight(LookupTable l, Square s1, Square s2);
 static void initializeLookupTable(LookupTable l);
 static inline int hash(LookupTable l, Square s, Type t, BitBoard o); // The hash fn for our lookup table
+static void initializeZobrist(LookupTable l);
+static uint64_t splitMix(uint64_t *state);
 
 #if !BMI2
 static Magic getMagic(Square s, Type t, FILE *fp);
@@ -73,26 +84,48 @@ static uint32_t xorshift();
 
 LookupTable LookupTableNew(void)
 {
-  LookupTable l = malloc(sizeof(struct lookupTable));
+  LookupTable l = MemoryTryAlloc(sizeof(struct lookupTable), MEMORY_LOCAL, "lookup table");
   if (l == NULL)
+    return NULL;
+  initializeLookupTable(l);
+  initializeZobrist(l);
+  l->replicas = NULL;
+
+  return l;
+}
+
+void LookupTableReplicate(LookupTable l)
+{
+  if (l->replicas != NULL)
+    return;
+
+  int nodes = MemoryNodes();
+  LookupTable *replicas = malloc(nodes * sizeof(LookupTable));
+  if (replicas == NULL)
   {
     fprintf(stderr, "Insufficient memory!\n");
     exit(EXIT_FAILURE);
   }
+  for (int n = 0; n < nodes; n++)
+  {
+    replicas[n] = MemoryAlloc(sizeof(struct lookupTable), n, "lookup table replica");
+    memcpy(replicas[n], l, sizeof(struct lookupTable));
+  }
+  l->replicas = replicas;
+}
 
-  initializeLookupTable(l);
-
-  return l;
+LookupTable LookupTableLocal(LookupTable l)
+{
+  return (l->replicas != NULL) ? l->replicas[MemoryNode()] : l;
 }
 
 void initializeLookupTable(LookupTable l)
 {
+#if !BMI2
+  // Only magic bitboards need the magic numbers, PEXT doesn't. The file is relative to the
+  // working directory and only caches them, so without it they're all found again.
   FILE *fp = fopen(MAGIC_NUMBERS, "a+");
-  if (fp == NULL)
-  {
-    fprintf(stderr, "Failed to open '%s' for reading/writing\n", MAGIC_NUMBERS);
-    exit(EXIT_FAILURE);
-  }
+#endif
 
   for (Square s = 0; s < BOARD_SIZE; s++)
   {
@@ -136,7 +169,10 @@ void initializeLookupTable(LookupTable l)
     }
 #endif
   }
-  fclose(fp);
+#if !BMI2
+  if (fp != NULL)
+    fclose(fp);
+#endif
 
   // Helper tables
   for (Square s1 = 0; s1 < BOARD_SIZE; s1++)
@@ -151,7 +187,13 @@ void initializeLookupTable(LookupTable l)
 
 void LookupTableFree(LookupTable l)
 {
-  free(l);
+  if (l->replicas != NULL)
+  {
+    for (int n = 0; n < MemoryNodes(); n++)
+      MemoryFree(l->replicas[n]);
+    free(l->replicas);
+  }
+  MemoryFree(l);
 }
 
 BitBoard LookupTableAttacks(LookupTable l, Square s, Type t, BitBoard occupancies)
@@ -186,6 +228,26 @@ BitBoard LookupTableLineOfSight(LookupTable l, Square s1, Square s2)
   return l->lineOfSight[s1][s2];
 }
 
+uint64_t LookupTableZobrist(LookupTable l, Color c, Type t, Square s)
+{
+  return l->zobrist[c][t][s];
+}
+
+uint64_t LookupTableZobristCastling(LookupTable l, Square s)
+{
+  return l->zobristCastling[s];
+}
+
+uint64_t LookupTableZobristEnPassant(LookupTable l, Square s)
+{
+  return l->zobristEnPassant[s];
+}
+
+uint64_t LookupTableZobristTurn(LookupTable l)
+{
+  return l->zobristTurn;
+}
+
 static BitBoard getAttacks(Square s, Type t, BitBoard occupancies)
 {
   BitBoard attacks = EMPTY_BOARD;
@@ -292,8 +354,7 @@ static Magic getMagic(Square s, Type t, FILE *fp)
   m.bits = getRelevantBits(s, t);
   m.bitShift = BOARD_SIZE - BitBoardCount(m.bits);
   // Attempt to read magic number from file
-  int result = fscanf(fp, "%lu", &m.magicNumber);
-  if (result == 1)
+  if (fp != NULL && fscanf(fp, "%lu", &m.magicNumber) == 1)
     return m;
 
   // Generate magic number if reading failed
@@ -331,7 +392,8 @@ static Magic getMagic(Square s, Type t, FILE *fp)
     }
     if (!collision)
     {
-      fprintf(fp, "%lu\n", m.magicNumber); // Write the new magic number to file
+      if (fp != NULL)
+        fprintf(fp, "%lu\n", m.magicNumber); // Write the new magic number to file
       break;
     }
   }
@@ -410,3 +472,29 @@ static BitBoard getLineOfSight(LookupTable l, Square s1, Square s2)
   }
   return lineOfSight;
 }
+
+// Fill the Zobrist keys from a fixed seed so hashes are the same across runs
+static void initializeZobrist(LookupTable l)
+{
+  uint64_t state = ZOBRIST_SEED;
+  for (Color c = White; c <= Black; c++)
+    for (Type t = Pawn; t < TYPE_SIZE; t++)
+      for (Square s = 0; s < BOARD_SIZE; s++)
+        l->zobrist[c][t][s] = (t == Empty) ? 0 : splitMix(&state);
+
+  for (Square s = 0; s < BOARD_SIZE; s++)
+  {
+    l->zobristCastling[s] = splitMix(&state);
+    l->zobristEnPassant[s] = splitMix(&state);
+  }
+  l->zobristEnPassant[EMPTY_SQUARE] = 0;
+  l->zobristTurn = splitMix(&state);
+}
+
+static uint64_t splitMix(uint64_t *state)
+{
+  uint64_t z = (*state += 0x9E3779B97F4A7C15);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+  return z ^ (z >> 31);
+}
@@ -26,15 +26,28 @@ typedef enum
 } Color;
 
 /*
- * Creates a new lookup table, roughly 2MB in size on the heap.
+ * Creates a new lookup table, roughly 2MB in size, on huge pages if the system grants them.
+ * Returns NULL if there isn't enough memory for it.
  */
 LookupTable LookupTableNew(void);
 
 /*
- * Free the lookup table from memory.
+ * Free the lookup table from memory, along with its replicas.
  */
 void LookupTableFree(LookupTable l);
 
+/*
+ * Copy the lookup table onto every NUMA node, so that threads can read it from the memory
+ * of their own node. Calling it again does nothing.
+ */
+void LookupTableReplicate(LookupTable l);
+
+/*
+ * Return the replica of the lookup table on the node the calling thread is running on, or
+ * the table itself if it was never replicated.
+ */
+LookupTable LookupTableLocal(LookupTable l);
+
 /*
  * Given a square, type of piece, and a set of occupancies, return a bitboard
  * representing the squares that the piece could attack.
@@ -52,4 +65,24 @@ BitBoard LookupTableSquaresBetween(LookupTable l, Square s1, Square s2);
  */
 BitBoard LookupTableLineOfSight(LookupTable l, Square s1, Square s2);
 
+/*
+ * Given a color, type of piece and square, return the Zobrist key of that piece on that square.
+ */
+uint64_t LookupTableZobrist(LookupTable l, Color c, Type t, Square s);
+
+/*
+ * Given a square, return the Zobrist key of a castling right on that square.
+ */
+uint64_t LookupTableZobristCastling(LookupTable l, Square s);
+
+/*
+ * Given a square, return the Zobrist key of en passant on that square (zero if EMPTY_SQUARE).
+ */
+uint64_t LookupTableZobristEnPassant(LookupTable l, Square s);
+
+/*
+ * Return the Zobrist key of black to move.
+ */
+uint64_t LookupTableZobristTurn(LookupTable l);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,318 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "Memory.h"
+
+#define HUGE_PAGE_SIZE (2 << 20)
+#define MAX_NODES 64 // Nodes in a mask of one word, any beyond are left out
+#define MPOL_BIND 2
+#define MPOL_INTERLEAVE 3
+#define NODES_ONLINE "/sys/devices/system/node/online"
+#define HUGE_PAGES_MODE "/sys/kernel/mm/transparent_hugepage/enabled"
+#define SMAPS_ROLLUP "/proc/self/smaps_rollup"
+#define LINE_SIZE 256
+#define MEGABYTES(b) ((double)(b) / (1 << 20))
+
+typedef enum
+{
+  Explicit,    // Reserved up front from the pool of huge pages
+  Transparent, // Advised, the kernel backs them with huge pages when it can
+  Normal
+} Pages;
+
+/*
+ * A table handed out by MemoryAlloc, and what it got
+ */
+typedef struct region
+{
+  void *address;
+  size_t bytes;  // Asked for
+  size_t length; // Mapped, a whole number of pages
+  Pages pages;
+  int node;      // Placement, MEMORY_LOCAL if the one asked for was refused
+  const char *name;
+  struct region *next;
+} Region;
+
+static const char *pageNames[] = {"explicit huge pages", "transparent huge pages", "normal pages"};
+
+static Region *regions = NULL;
+static pthread_mutex_t regionsLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long onlineNodes = 1; // Mask of the nodes with memory
+static int numNodes = 1;
+static pthread_once_t nodesOnce = PTHREAD_ONCE_INIT;
+
+static void *mapHuge(size_t length, Pages *pages);
+static void *mapAligned(size_t length);
+static int place(void *address, size_t length, int node);
+static void findNodes(void);
+static void printPlacement(FILE *out, int node);
+static long hugeKilobytes(void);
+
+void *MemoryAlloc(size_t bytes, int node, const char *name)
+{
+  void *p = MemoryTryAlloc(bytes, node, name);
+  if (p == NULL)
+  {
+    fprintf(stderr, "Insufficient memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+void *MemoryTryAlloc(size_t bytes, int node, const char *name)
+{
+  Region *r = malloc(sizeof(Region));
+  if (r == NULL)
+    return NULL;
+
+  if (bytes >= HUGE_PAGE_SIZE)
+  {
+    r->length = (bytes + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    r->address = mapHuge(r->length, &r->pages);
+  }
+  else
+  {
+    size_t page = sysconf(_SC_PAGESIZE);
+    r->length = (bytes + page - 1) & ~(page - 1);
+    r->address = mmap(NULL, r->length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    r->pages = Normal;
+  }
+  if (r->address == MAP_FAILED || r->address == NULL)
+  {
+    free(r);
+    return NULL;
+  }
+
+  // Nothing has touched the pages yet, so they're placed wherever the policy says
+  r->node = place(r->address, r->length, node) ? node : MEMORY_LOCAL;
+  r->bytes = bytes;
+  r->name = name;
+
+  // Appended, so the report lists the tables in the order they were allocated
+  r->next = NULL;
+  pthread_mutex_lock(&regionsLock);
+  Region **last = &regions;
+  while (*last != NULL)
+    last = &(*last)->next;
+  *last = r;
+  pthread_mutex_unlock(&regionsLock);
+  return r->address;
+}
+
+void MemoryFree(void *p)
+{
+  if (p == NULL)
+    return;
+
+  pthread_mutex_lock(&regionsLock);
+  Region **r = &regions;
+  while (*r != NULL && (*r)->address != p)
+    r = &(*r)->next;
+  Region *found = *r;
+  if (found != NULL)
+    *r = found->next;
+  pthread_mutex_unlock(&regionsLock);
+
+  if (found != NULL)
+  {
+    munmap(found->address, found->length);
+    free(found);
+  }
+}
+
+int MemoryNodes(void)
+{
+  pthread_once(&nodesOnce, findNodes);
+  return numNodes;
+}
+
+int MemoryNode(void)
+{
+  unsigned cpu, node = 0;
+#ifdef SYS_getcpu
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+    node = 0;
+#else
+  (void)cpu;
+#endif
+  return ((int)node < MemoryNodes()) ? (int)node : 0;
+}
+
+void MemoryReport(FILE *out)
+{
+  char mode[LINE_SIZE] = "unavailable";
+  FILE *fp = fopen(HUGE_PAGES_MODE, "r");
+  if (fp != NULL)
+  {
+    if (fgets(mode, LINE_SIZE, fp) != NULL)
+      mode[strcspn(mode, "\n")] = '\0';
+    fclose(fp);
+  }
+  fprintf(out, "Memory: %d NUMA node%s, transparent huge pages: %s\n", MemoryNodes(),
+          (MemoryNodes() == 1) ? "" : "s", mode);
+
+  // Tables of the same name that got the same pages and placement are summed up in one line
+  pthread_mutex_lock(&regionsLock);
+  for (Region *r = regions; r != NULL; r = r->next)
+  {
+    int seen = 0;
+    for (Region *s = regions; s != r && !seen; s = s->next)
+      seen = !strcmp(s->name, r->name) && s->pages == r->pages && s->node == r->node;
+    if (seen)
+      continue;
+
+    int count = 0;
+    size_t length = 0;
+    for (Region *s = r; s != NULL; s = s->next)
+    {
+      if (!strcmp(s->name, r->name) && s->pages == r->pages && s->node == r->node)
+      {
+        count++;
+        length += s->length;
+      }
+    }
+    fprintf(out, "  %-22s %4d x %9.1f MB  %-22s  ", r->name, count, MEGABYTES(length) / count,
+            pageNames[r->pages]);
+    printPlacement(out, r->node);
+  }
+  pthread_mutex_unlock(&regionsLock);
+
+  long huge = hugeKilobytes();
+  if (huge >= 0)
+    fprintf(out, "  Memory of the process in transparent huge pages: %.1f MB\n", huge / 1024.0);
+}
+
+// Map whole huge pages, reserving explicit ones if there are any spare, else advising
+// transparent ones on a mapping aligned to a huge page
+static void *mapHuge(size_t length, Pages *pages)
+{
+#ifdef MAP_HUGETLB
+  void *p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p != MAP_FAILED)
+  {
+    *pages = Explicit;
+    return p;
+  }
+#endif
+
+  void *q = mapAligned(length);
+  *pages = Normal;
+#ifdef MADV_HUGEPAGE
+  if (q != MAP_FAILED && madvise(q, length, MADV_HUGEPAGE) == 0)
+    *pages = Transparent;
+#endif
+  return q;
+}
+
+// Map one huge page more than needed, then unmap the ends around the first aligned address
+static void *mapAligned(size_t length)
+{
+  char *p = mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return MAP_FAILED;
+
+  char *aligned = (char *)(((uintptr_t)p + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+  if (aligned > p)
+    munmap(p, aligned - p);
+  if (aligned + length < p + length + HUGE_PAGE_SIZE)
+    munmap(aligned + length, p + HUGE_PAGE_SIZE - aligned);
+  return aligned;
+}
+
+// Set the NUMA policy of a mapping, returns 1 if the system accepted it. Uses the system
+// call directly, so there's no dependency on libnuma.
+static int place(void *address, size_t length, int node)
+{
+  if (node == MEMORY_LOCAL)
+    return 1;
+#ifdef SYS_mbind
+  unsigned long mask;
+  int mode;
+  if (node == MEMORY_INTERLEAVED)
+  {
+    MemoryNodes();
+    mask = onlineNodes;
+    mode = MPOL_INTERLEAVE;
+  }
+  else if (node >= 0 && node < MemoryNodes())
+  {
+    mask = 1UL << node;
+    mode = MPOL_BIND;
+  }
+  else
+    return 0;
+  return syscall(SYS_mbind, address, length, mode, &mask, MAX_NODES + 1, 0) == 0;
+#else
+  (void)address;
+  (void)length;
+  return 0;
+#endif
+}
+
+// Read the nodes with memory from a list of ranges like 0-3,6, assuming node 0 alone if
+// the system doesn't list any
+static void findNodes(void)
+{
+  char line[LINE_SIZE];
+  FILE *fp = fopen(NODES_ONLINE, "r");
+  if (fp == NULL)
+    return;
+  if (fgets(line, LINE_SIZE, fp) != NULL)
+  {
+    unsigned long mask = 0;
+    char *ptr = line;
+    while (*ptr >= '0' && *ptr <= '9')
+    {
+      long first = strtol(ptr, &ptr, 10), last = first;
+      if (*ptr == '-')
+        last = strtol(ptr + 1, &ptr, 10);
+      for (long n = first; n <= last && n < MAX_NODES; n++)
+        mask |= 1UL << n;
+      if (*ptr == ',')
+        ptr++;
+    }
+    if (mask != 0)
+    {
+      onlineNodes = mask;
+      numNodes = MAX_NODES - __builtin_clzl(mask);
+    }
+  }
+  fclose(fp);
+}
+
+static void printPlacement(FILE *out, int node)
+{
+  if (node == MEMORY_INTERLEAVED)
+    fprintf(out, "interleaved over %d nodes\n", MemoryNodes());
+  else if (node == MEMORY_LOCAL)
+    fprintf(out, "first touch\n");
+  else
+    fprintf(out, "node %d\n", node);
+}
+
+// Kilobytes of the process's anonymous memory backed by transparent huge pages, or -1 if
+// the system doesn't say
+static long hugeKilobytes(void)
+{
+  char line[LINE_SIZE];
+  long kilobytes = -1;
+  FILE *fp = fopen(SMAPS_ROLLUP, "r");
+  if (fp == NULL)
+    return -1;
+  while (fgets(line, LINE_SIZE, fp) != NULL)
+  {
+    if (sscanf(line, "AnonHugePages: %ld kB", &kilobytes) == 1)
+      break;
+  }
+  fclose(fp);
+  return kilobytes;
+}
@@ -0,0 +1,45 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define MEMORY_LOCAL -1       // Pages placed on the node of the thread that first touches them
+#define MEMORY_INTERLEAVED -2 // Pages spread round robin over every node, for tables shared by threads
+
+/*
+ * Allocate zeroed memory for a large table, named in the report. A table of at least a
+ * huge page is backed by 2MB pages if the system grants them: explicit huge pages first,
+ * then transparent ones, and normal pages otherwise. node is the NUMA node to bind its
+ * pages to, or MEMORY_LOCAL or MEMORY_INTERLEAVED; a placement the system refuses falls
+ * back to MEMORY_LOCAL. Exits if there isn't enough memory.
+ */
+void *MemoryAlloc(size_t bytes, int node, const char *name);
+
+/*
+ * Allocate memory like MemoryAlloc, but return NULL if there isn't enough of it.
+ */
+void *MemoryTryAlloc(size_t bytes, int node, const char *name);
+
+/*
+ * Free memory from MemoryAlloc.
+ */
+void MemoryFree(void *p);
+
+/*
+ * Return the number of NUMA nodes, 1 on a system without NUMA.
+ */
+int MemoryNodes(void);
+
+/*
+ * Return the NUMA node of the CPU the calling thread is running on.
+ */
+int MemoryNode(void);
+
+/*
+ * Write what the tables allocated so far actually got: their size, pages and placement,
+ * along with the memory of the whole process that's in huge pages.
+ */
+void MemoryReport(FILE *out);
+
+#endif
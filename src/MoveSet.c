@@ -5,20 +5,77 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <immintrin.h>
+
+# if defined(__BMI2__)
+#   define BMI2 1
+# else
+#   define BMI2 0
+# endif
+
+#define PROMOTION (BACK_RANK(White) | BACK_RANK(Black))
 
 static void addMap(MoveSet *ms, BitBoard to, BitBoard from, Type type);
+static void setCaptured(ChessBoard *cb, Move *m);
+static inline Square nthSquare(BitBoard b, int n);
+static void removeMap(MoveSet *ms, int i);
 static BitBoard pawnMoves(BitBoard p, Color c);
-
-// Add the map to moveset if it's non empty
+static void fillMoves(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a);
+static void fillStage(StagedMoveSet *sms);
+static inline void fillKing(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a);
+static inline void fillKnights(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a);
+static inline void fillSliders(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a, const int material);
+static inline void fillPawns(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a);
+static inline void fillEnPassant(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a);
+static void fillEvasions(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a);
+static inline void fillKernel(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a, const int material);
+static void splitMoves(LookupTable l, MoveSet *ms, ChessBoard *flip, AnalysisCache *ac, MoveSet *removed, MoveSet *next, int stats);
+static void filterMoves(MoveSet *ms, BitBoard squares, MoveSet *removed);
+static long countReplies(LookupTable l, MoveSet *ms, AnalysisCache *ac);
+
+// Add the map to moveset if it's non empty. Pawn maps are split so that
+// every move of a map is a promotion or none of them are.
 static void addMap(MoveSet *ms, BitBoard to, BitBoard from, Type type)
 {
   if (to == EMPTY_BOARD || from == EMPTY_BOARD)
     return;
-  Map m;
-  m.to = to;
-  m.from = from;
-  m.type = type;
-  ms->maps[ms->size++] = m;
+  int offset = BitBoardCount(to) - BitBoardCount(from);
+  BitBoard promotion = (type == Pawn) ? (to & PROMOTION) : EMPTY_BOARD;
+
+  if (promotion != EMPTY_BOARD && promotion != to)
+  {
+    if (offset > 0)
+    {
+      addMap(ms, to & ~promotion, from, type);
+      addMap(ms, promotion, from, type);
+    }
+    else // Bijective, en passant maps never promote
+    {
+      int squareOffset = BitBoardPeek(to) - BitBoardPeek(from);
+      BitBoard quiet = to & ~promotion;
+      addMap(ms, quiet, (squareOffset >= 0) ? (quiet >> squareOffset) : (quiet << -squareOffset), type);
+      addMap(ms, promotion, (squareOffset >= 0) ? (promotion >> squareOffset) : (promotion << -squareOffset), type);
+    }
+    return;
+  }
+
+  int i = ms->size++;
+  ms->to[i] = to;
+  ms->from[i] = from;
+  ms->type[i] = type;
+  ms->kind[i] = (offset > 0) ? Injective : (offset == 0) ? Bijective : Surjective;
+  ms->promotion[i] = (promotion != EMPTY_BOARD);
+}
+
+// Replace the map at index i with the last map in the moveset
+static void removeMap(MoveSet *ms, int i)
+{
+  int j = --ms->size;
+  ms->to[i] = ms->to[j];
+  ms->from[i] = ms->from[j];
+  ms->type[i] = ms->type[j];
+  ms->kind[i] = ms->kind[j];
+  ms->promotion[i] = ms->promotion[j];
 }
 
 static BitBoard pawnMoves(BitBoard p, Color c)
@@ -33,45 +90,117 @@ MoveSet MoveSetNew()
 {
   MoveSet ms;
   ms.size = 0;
-  ms.prev.from.square = EMPTY_SQUARE;
-  ms.prev.from.type = Empty;
-  ms.prev.to.square = EMPTY_SQUARE;
-  ms.prev.to.type = Empty;
+  ms.next = Knight;
   return ms;
 }
 
 void MoveSetFill(LookupTable l, ChessBoard *cb, MoveSet *ms)
 {
+  Analysis a;
+  ChessBoardAnalyze(l, cb, &a);
+  fillMoves(l, cb, ms, &a);
+}
+
+void MoveSetStage(LookupTable l, ChessBoard *cb, StagedMoveSet *sms)
+{
+  sms->ms = MoveSetNew();
+  sms->ms.cb = cb;
+  sms->l = l;
+  sms->stage = Kings;
+  ChessBoardAnalyze(l, cb, &sms->analysis);
+}
+
+void MoveSetFillFiltered(LookupTable l, ChessBoard *cb, MoveSet *ms, Filter f)
+{
+  if (f == AllMoves) {
+    MoveSetFill(l, cb, ms);
+    return;
+  }
+
+  MoveMap maps[MAX_MOVES];
+  int n = ChessBoardFilterMaps(l, cb, f, maps);
   ms->cb = cb;
-  Square s;
-  BitBoard pinned, checking;
-  ChessBoardCheckingAndPinned(l, cb, &checking, &pinned);
-  BitBoard attacked = ChessBoardAttacked(l, cb);
+  for (int i = 0; i < n; i++)
+    addMap(ms, maps[i].to, maps[i].from, maps[i].type);
+}
 
-  // Cache hot values
-  const BitBoard us    = ChessBoardUs(cb);
-  const BitBoard them  = ChessBoardThem(cb);
-  const BitBoard all   = ChessBoardAll(cb);
-  const BitBoard kingB = ChessBoardOur(cb, King);
-  const Square  kingSq = BitBoardPeek(kingB);
-  const int     color  = ChessBoardColor(cb);
-
-  // Determine check mask
-  BitBoard checkMask;
-  int numChecks = BitBoardCount(checking);
-  if (numChecks == 0) {
-    checkMask = ~EMPTY_BOARD;
-  } else if (numChecks == 1) {
-    Square cs = BitBoardPeek(checking);
-    checkMask = BitBoardAdd(EMPTY_BOARD, cs) |
-                LookupTableSquaresBetween(l, kingSq, cs);
-  } else {
-    checkMask = EMPTY_BOARD;
+int MoveSetNext(StagedMoveSet *sms, Move *m)
+{
+  if (sms->ms.size == 0)
+    fillStage(sms);
+  if (sms->ms.size == 0)
+    return 0;
+  *m = MoveSetPop(&sms->ms);
+  return 1;
+}
+
+// Fill the moveset given the analysis of the chess board
+static void fillMoves(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a)
+{
+  ms->cb = cb;
+  if (a->checking) {
+    fillEvasions(l, cb, ms, a);
+    return;
+  }
+
+  MATERIAL_DISPATCH(cb->material[cb->turn], fillKernel, l, cb, ms, a);
+}
+
+// Fill the maps of a board that isn't in check, given the material of the side to move. The
+// maps of the classes it doesn't have compile away when material is a constant.
+static inline void fillKernel(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a, const int material)
+{
+  fillKing(l, cb, ms, a);
+  if (material & HasKnights)
+    fillKnights(l, cb, ms, a);
+  fillSliders(l, cb, ms, a, material);
+  if (material & HasPawns) {
+    fillPawns(l, cb, ms, a);
+    fillEnPassant(l, cb, ms, a);
+  }
+}
+
+// Fill the next stage of a staged moveset, stages whose maps are all empty are skipped
+static void fillStage(StagedMoveSet *sms)
+{
+  LookupTable l = sms->l;
+  MoveSet *ms = &sms->ms;
+  ChessBoard *cb = ms->cb;
+  Analysis *a = &sms->analysis;
+  while (ms->size == 0 && sms->stage != Filled) {
+    switch (sms->stage++) {
+    case Kings:
+      fillKing(l, cb, ms, a);
+      if (BitBoardCount(a->checking) == 2)
+        sms->stage = Filled;
+      break;
+    case Pawns:
+      fillPawns(l, cb, ms, a);
+      break;
+    case Knights:
+      fillKnights(l, cb, ms, a);
+      break;
+    case Sliders:
+      fillSliders(l, cb, ms, a, HasDiagonal | HasOrthogonal);
+      break;
+    default:
+      fillEnPassant(l, cb, ms, a);
+      break;
+    }
   }
+}
 
-  // King map
-  BitBoard moves = LookupTableAttacks(l, kingSq, King, EMPTY_BOARD) & ~us & ~attacked;
-  if ((~checkMask) == EMPTY_BOARD) {
+// King map, with castling
+static inline void fillKing(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a)
+{
+  const BitBoard all       = ChessBoardAll(cb);
+  const BitBoard kingB     = ChessBoardOur(cb, King);
+  const Square  kingSq     = BitBoardPeek(kingB);
+  const int     color      = ChessBoardColor(cb);
+  const BitBoard attacked  = a->attacked;
+
+  BitBoard moves = LookupTableAttacks(l, kingSq, King, EMPTY_BOARD) & ~ChessBoardUs(cb) & ~attacked;
+  if ((~a->checkMask) == EMPTY_BOARD) {
     // Kingside: check rights and interior squares f/g
     int clear = (((attacked & ATTACK_MASK) | (all & OCCUPANCY_MASK)) &
                  (KINGSIDE & ~KINGSIDE_CASTLING) & BACK_RANK(color)) == EMPTY_BOARD;
@@ -84,47 +213,66 @@ void MoveSetFill(LookupTable l, ChessBoard *cb, MoveSet *ms)
       moves |= (kingB >> 2);
   }
   addMap(ms, moves, kingB, King);
+}
 
-  // If double-check, return early
-  if (numChecks == 2) return;
-
-  const BitBoard notUsAndCheck = ~us & checkMask;
+// Knight maps
+static inline void fillKnights(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a)
+{
+  const BitBoard all           = ChessBoardAll(cb);
+  const BitBoard notUsAndCheck = ~ChessBoardUs(cb) & a->checkMask;
+  const Square  kingSq         = BitBoardPeek(ChessBoardOur(cb, King));
 
-  // Knight maps
   BitBoard piecesKnight = ChessBoardOur(cb, Knight);
   while (piecesKnight) {
-    s = BitBoardPop(&piecesKnight);
+    Square s = BitBoardPop(&piecesKnight);
     BitBoard sqBit = BitBoardAdd(EMPTY_BOARD, s);
-    moves = LookupTableAttacks(l, s, Knight, all) & notUsAndCheck;
-    if (sqBit & pinned)
+    BitBoard moves = LookupTableAttacks(l, s, Knight, all) & notUsAndCheck;
+    if (sqBit & a->pinned)
       moves &= LookupTableLineOfSight(l, kingSq, s);
     addMap(ms, moves, sqBit, Knight);
   }
+}
 
-  // Diagonal slider maps (bishops + queens)
-  BitBoard diagSliders = ChessBoardOur(cb, Bishop) | ChessBoardOur(cb, Queen);
+// Slider maps, diagonal (bishops + queens) then orthogonal (rooks + queens), of the classes
+// in material
+static inline void fillSliders(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a, const int material)
+{
+  const BitBoard all           = ChessBoardAll(cb);
+  const BitBoard notUsAndCheck = ~ChessBoardUs(cb) & a->checkMask;
+  const Square  kingSq         = BitBoardPeek(ChessBoardOur(cb, King));
+
+  BitBoard diagSliders = (material & HasDiagonal) ? ChessBoardOur(cb, Bishop) | ChessBoardOur(cb, Queen) : EMPTY_BOARD;
   while (diagSliders) {
-    s = BitBoardPop(&diagSliders);
+    Square s = BitBoardPop(&diagSliders);
     BitBoard sqBit = BitBoardAdd(EMPTY_BOARD, s);
-    moves = LookupTableAttacks(l, s, Bishop, all) & notUsAndCheck;
-    if (sqBit & pinned)
+    BitBoard moves = LookupTableAttacks(l, s, Bishop, all) & notUsAndCheck;
+    if (sqBit & a->pinned)
       moves &= LookupTableLineOfSight(l, kingSq, s);
     addMap(ms, moves, sqBit, ChessBoardSquare(cb, s));
   }
 
-  // Orthogonal slider maps (rooks + queens)
-  BitBoard orthoSliders = ChessBoardOur(cb, Rook) | ChessBoardOur(cb, Queen);
+  BitBoard orthoSliders = (material & HasOrthogonal) ? ChessBoardOur(cb, Rook) | ChessBoardOur(cb, Queen) : EMPTY_BOARD;
   while (orthoSliders) {
-    s = BitBoardPop(&orthoSliders);
+    Square s = BitBoardPop(&orthoSliders);
     BitBoard sqBit = BitBoardAdd(EMPTY_BOARD, s);
-    moves = LookupTableAttacks(l, s, Rook, all) & notUsAndCheck;
-    if (sqBit & pinned)
+    BitBoard moves = LookupTableAttacks(l, s, Rook, all) & notUsAndCheck;
+    if (sqBit & a->pinned)
       moves &= LookupTableLineOfSight(l, kingSq, s);
     addMap(ms, moves, sqBit, ChessBoardSquare(cb, s));
   }
+}
 
-  // Pawn maps
-  BitBoard b1, b2, b3;
+// Pawn maps, all unpinned pawns at once, then each pinned pawn along its pin
+static inline void fillPawns(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a)
+{
+  const BitBoard them      = ChessBoardThem(cb);
+  const BitBoard all       = ChessBoardAll(cb);
+  const Square  kingSq     = BitBoardPeek(ChessBoardOur(cb, King));
+  const int     color      = ChessBoardColor(cb);
+  const BitBoard pinned    = a->pinned;
+  const BitBoard checkMask = a->checkMask;
+
+  BitBoard b1, b2, b3, moves;
   b1 = ChessBoardOur(cb, Pawn) & ~pinned;
   moves = PAWN_ATTACKS_LEFT(b1, color) & them & checkMask;
   addMap(ms, moves, PAWN_ATTACKS_LEFT(moves, (!color)), Pawn);
@@ -138,7 +286,7 @@ void MoveSetFill(LookupTable l, ChessBoard *cb, MoveSet *ms)
 
   b1 = ChessBoardOur(cb, Pawn) & pinned;
   while (b1) {
-    s  = BitBoardPop(&b1);
+    Square s = BitBoardPop(&b1);
     b3 = LookupTableLineOfSight(l, kingSq, s);
     moves  = PAWN_ATTACKS(BitBoardAdd(EMPTY_BOARD, s), color) & them;
     b2     = SINGLE_PUSH(BitBoardAdd(EMPTY_BOARD, s), color) & ~all;
@@ -146,41 +294,95 @@ void MoveSetFill(LookupTable l, ChessBoard *cb, MoveSet *ms)
     moves |= SINGLE_PUSH(b2 & ENPASSANT_RANK(color), color) & ~all;
     addMap(ms, moves & b3 & checkMask, BitBoardAdd(EMPTY_BOARD, s), Pawn);
   }
+}
+
+// En passant map, in check only if it captures the checker or blocks the check
+static inline void fillEnPassant(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a)
+{
+  const BitBoard all    = ChessBoardAll(cb);
+  const Square  kingSq  = BitBoardPeek(ChessBoardOur(cb, King));
+  const int     color   = ChessBoardColor(cb);
 
-  // En passant map
-  if (ChessBoardEnPassant(cb) != EMPTY_SQUARE) {
-    b3 = BitBoardAdd(EMPTY_BOARD, ChessBoardEnPassant(cb));
+  BitBoard b1, b2, b3;
+  b3 = (ChessBoardEnPassant(cb) != EMPTY_SQUARE) ? BitBoardAdd(EMPTY_BOARD, ChessBoardEnPassant(cb)) : EMPTY_BOARD;
+  if ((b3 | SINGLE_PUSH(b3, (!color))) & a->checkMask) {
     b1 = PAWN_ATTACKS(b3, (!color)) & ChessBoardOur(cb, Pawn);
     b2 = EMPTY_BOARD;
     while (b1) {
-      s = BitBoardPop(&b1);
+      Square s = BitBoardPop(&b1);
       // Pseudo-pinning check for en passant
       if (LookupTableAttacks(l, kingSq, Rook,
             all & ~BitBoardAdd(SINGLE_PUSH(b3, (!color)), s)) &
           RANK_OF(kingSq) & (ChessBoardTheir(cb, Rook) | ChessBoardTheir(cb, Queen)))
         continue;
+      // A pinned pawn can only capture along its pin
+      if ((BitBoardAdd(EMPTY_BOARD, s) & a->pinned) &&
+          !(BitBoardAdd(EMPTY_BOARD, s) & LookupTableLineOfSight(l, kingSq, ChessBoardEnPassant(cb))))
+        continue;
       b2 |= BitBoardAdd(EMPTY_BOARD, s);
-      if (b2 & pinned)
-        b2 &= LookupTableLineOfSight(l, kingSq, ChessBoardEnPassant(cb));
     }
     if (b2 != EMPTY_BOARD)
       addMap(ms, b3, b2, Pawn);
   }
 }
 
+// Maps of a board in check. Only the king can answer a double check, a single check is also
+// answered by capturing the checker or moving in between, which the check mask holds. A
+// pinned piece can never do either, so pins, castling and pinned pawns are skipped altogether.
+static void fillEvasions(LookupTable l, ChessBoard *cb, MoveSet *ms, Analysis *a)
+{
+  const BitBoard all       = ChessBoardAll(cb);
+  const BitBoard kingB     = ChessBoardOur(cb, King);
+  const int     color      = ChessBoardColor(cb);
+  const BitBoard checkMask = a->checkMask;
+
+  BitBoard moves = LookupTableAttacks(l, BitBoardPeek(kingB), King, EMPTY_BOARD) & ~ChessBoardUs(cb) & ~a->attacked;
+  addMap(ms, moves, kingB, King);
+  if (a->checking & (a->checking - 1))
+    return;
+
+  // Pieces capturing the checker or moving in between, the mask never holds one of ours
+  const BitBoard unpinned = ~a->pinned;
+  BitBoard b = ChessBoardOur(cb, Knight) & unpinned;
+  while (b) {
+    Square s = BitBoardPop(&b);
+    addMap(ms, LookupTableAttacks(l, s, Knight, all) & checkMask, BitBoardAdd(EMPTY_BOARD, s), Knight);
+  }
+  b = (ChessBoardOur(cb, Bishop) | ChessBoardOur(cb, Queen)) & unpinned;
+  while (b) {
+    Square s = BitBoardPop(&b);
+    addMap(ms, LookupTableAttacks(l, s, Bishop, all) & checkMask, BitBoardAdd(EMPTY_BOARD, s), ChessBoardSquare(cb, s));
+  }
+  b = (ChessBoardOur(cb, Rook) | ChessBoardOur(cb, Queen)) & unpinned;
+  while (b) {
+    Square s = BitBoardPop(&b);
+    addMap(ms, LookupTableAttacks(l, s, Rook, all) & checkMask, BitBoardAdd(EMPTY_BOARD, s), ChessBoardSquare(cb, s));
+  }
+
+  // Pawns capturing the checker or pushing in between
+  const BitBoard between = checkMask & ~a->checking;
+  const BitBoard pawns   = ChessBoardOur(cb, Pawn) & unpinned;
+  moves = PAWN_ATTACKS_LEFT(pawns, color) & a->checking;
+  addMap(ms, moves, PAWN_ATTACKS_LEFT(moves, (!color)), Pawn);
+  moves = PAWN_ATTACKS_RIGHT(pawns, color) & a->checking;
+  addMap(ms, moves, PAWN_ATTACKS_RIGHT(moves, (!color)), Pawn);
+  b = SINGLE_PUSH(pawns, color) & ~all;
+  moves = b & between;
+  addMap(ms, moves, SINGLE_PUSH(moves, (!color)), Pawn);
+  moves = SINGLE_PUSH(b & ENPASSANT_RANK(color), color) & ~all & between;
+  addMap(ms, moves, DOUBLE_PUSH(moves, (!color)), Pawn);
+
+  // En passant answers the check of the pawn it captures
+  fillEnPassant(l, cb, ms, a);
+}
 
 int MoveSetCount(MoveSet *ms)
 {
   int nodes = 0;
   for (int i = 0; i < ms->size; i++)
   {
-    int offset = BitBoardCount(ms->maps[i].to) - BitBoardCount(ms->maps[i].from);
-    BitBoard promotion = EMPTY_BOARD;
-    if (ms->maps[i].type == Pawn)
-      promotion |= ((BACK_RANK(White) | BACK_RANK(Black)) & ms->maps[i].to);
-    if (offset < 0)
-      nodes++;
-    nodes += BitBoardCount(ms->maps[i].to) + BitBoardCount(promotion) * 3;
+    BitBoard b = (ms->kind[i] == Surjective) ? ms->from[i] : ms->to[i];
+    nodes += BitBoardCount(b) << (ms->promotion[i] << 1);
   }
   return nodes;
 }
@@ -189,7 +391,6 @@ int MoveSetCount(MoveSet *ms)
 Move MoveSetPop(MoveSet *ms)
 {
   int i = ms->size - 1;
-  int offset = BitBoardCount(ms->maps[i].to) - BitBoardCount(ms->maps[i].from);
   Move m;
   ChessBoard *cb = ms->cb;
 
@@ -197,56 +398,90 @@ Move MoveSetPop(MoveSet *ms)
   m.enPassant = ChessBoardEnPassant(cb);
   m.castling  = ChessBoardCastling(cb);
 
-  // Pop a single square from each map to form the move
-  Square fromSq = BitBoardPop(&ms->maps[i].from);
-  Square toSq   = BitBoardPop(&ms->maps[i].to);
+  // The next move of a map is always its lowest from and to squares
+  Square fromSq = BitBoardPeek(ms->from[i]);
+  Square toSq   = BitBoardPeek(ms->to[i]);
   m.from.square = fromSq;
   m.to.square   = toSq;
-  m.to.type     = ms->maps[i].type;
-
-  // If not surjective/bijective, put back excess squares
-  if (offset > 0)
-    ms->maps[i].from = BitBoardAdd(ms->maps[i].from, fromSq);
-  else if (offset < 0)
-    ms->maps[i].to = BitBoardAdd(ms->maps[i].to, toSq);
-
-  // Handle pawn promotions: iterate piece types beyond Pawn
-  if ((m.to.type == Pawn) && (BitBoardAdd(EMPTY_BOARD, toSq) & (BACK_RANK(White) | BACK_RANK(Black)))) {
-    // First promotion popped: yield Knight
-    if ((ms->prev.from.square != fromSq) || (ms->prev.to.square != toSq)) {
-      m.to.type = Knight;
-      ms->maps[i].from = BitBoardAdd(ms->maps[i].from, fromSq);
-      ms->maps[i].to   = BitBoardAdd(ms->maps[i].to, toSq);
-    } else {
-      // Subsequent promotions: increment type
-      Type prevType = ms->prev.to.type;
-      m.to.type = (Type)(prevType + 1);
-      if (prevType != Rook) {
-        ms->maps[i].from = BitBoardAdd(ms->maps[i].from, fromSq);
-        ms->maps[i].to   = BitBoardAdd(ms->maps[i].to, toSq);
-      }
-    }
+  m.to.type     = ms->type[i];
+
+  // Promotion maps yield the same move for Knight, Bishop, Rook then Queen
+  if (ms->promotion[i]) {
+    m.to.type = ms->next;
+    ms->next  = (ms->next == Queen) ? Knight : (Type)(ms->next + 1);
   }
 
-  // If this map is exhausted, shrink size
-  if (ms->maps[i].to == EMPTY_BOARD)
-    ms->size--;
+  // Once a move has been fully yielded, remove it from the map
+  if (ms->next == Knight) {
+    if (ms->kind[i] != Surjective)
+      ms->to[i] &= ms->to[i] - 1;
+    if (ms->kind[i] != Injective)
+      ms->from[i] &= ms->from[i] - 1;
+    if ((ms->to[i] == EMPTY_BOARD) || (ms->from[i] == EMPTY_BOARD))
+      ms->size--;
+  }
 
-  // Populate origin and captured pieces for undo
-  m.from.type = ChessBoardSquare(cb, fromSq);
-  if ((m.from.type == Pawn) && (toSq == m.enPassant)) {
-    m.captured.square = (ChessBoardColor(cb) == White) ? toSq + EDGE_SIZE : toSq - EDGE_SIZE;
-    m.captured.type   = Pawn;
-  } else {
-    m.captured.square = toSq;
-    m.captured.type   = ChessBoardSquare(cb, toSq);
+  setCaptured(cb, &m);
+  return m;
+}
+
+Move MoveSetPick(MoveSet *ms, int index)
+{
+  Move m;
+  ChessBoard *cb = ms->cb;
+  m.enPassant = ChessBoardEnPassant(cb);
+  m.castling  = ChessBoardCastling(cb);
+
+  // Skip whole maps by their number of moves, then find the move within the map
+  int i = 0;
+  for (;; i++) {
+    BitBoard b = (ms->kind[i] == Surjective) ? ms->from[i] : ms->to[i];
+    int moves = BitBoardCount(b) << (ms->promotion[i] << 1);
+    if (index < moves)
+      break;
+    index -= moves;
   }
 
-  // Record this move for promotion sequencing
-  ms->prev = m;
+  m.to.type = ms->type[i];
+  if (ms->promotion[i]) {
+    m.to.type = (Type)(Knight + (index & 3));
+    index >>= 2;
+  }
+
+  // A bijective map pairs its from and to squares in order
+  BitBoard from = ms->from[i], to = ms->to[i];
+  m.from.square = (ms->kind[i] == Injective)  ? BitBoardPeek(from) : nthSquare(from, index);
+  m.to.square   = (ms->kind[i] == Surjective) ? BitBoardPeek(to)   : nthSquare(to, index);
+  setCaptured(cb, &m);
   return m;
 }
 
+// Populate origin and captured pieces for undo
+static void setCaptured(ChessBoard *cb, Move *m)
+{
+  Square toSq = m->to.square;
+  m->from.type = ChessBoardSquare(cb, m->from.square);
+  if ((m->from.type == Pawn) && (toSq == m->enPassant)) {
+    m->captured.square = (ChessBoardColor(cb) == White) ? toSq + EDGE_SIZE : toSq - EDGE_SIZE;
+    m->captured.type   = Pawn;
+  } else {
+    m->captured.square = toSq;
+    m->captured.type   = ChessBoardSquare(cb, toSq);
+  }
+}
+
+// The nth lowest square of a bitboard
+static inline Square nthSquare(BitBoard b, int n)
+{
+#if BMI2
+  return BitBoardPeek(_pdep_u64((BitBoard)1 << n, b));
+#else
+  while (n--)
+    b &= b - 1;
+  return BitBoardPeek(b);
+#endif
+}
+
 int MoveSetIsEmpty(MoveSet *ms)
 {
   return ms->size == 0;
@@ -272,16 +507,72 @@ void MoveSetPrint(MoveSet ms)
  * the number of edges that would've been searched had that edge been explored to "depth 1".
  * Found by: Alex Jasson
  */
-int MoveSetMultiply(LookupTable l, MoveSet *ms)
+int MoveSetMultiply(LookupTable l, MoveSet *ms, AnalysisCache *ac)
+{
+  ChessBoard flip = ChessBoardFlip(ms->cb);
+  MoveSet next = MoveSetNew();
+  MoveSet removed = MoveSetNew();
+  splitMoves(l, ms, &flip, ac, &removed, &next, 0);
+  return MoveSetCount(&removed) * MoveSetCount(&next);
+}
+
+void MoveSetMultiplyStats(LookupTable l, MoveSet *ms, Stats *stats)
 {
   ChessBoard *curr = ms->cb;
   ChessBoard flip = ChessBoardFlip(curr);
-  MoveSet next = MoveSetNew();    // Next set of moves
-  MoveSet removed = MoveSetNew(); // Moves that will be removed from ms
+  AnalysisCache ac;
+  MoveSet next = MoveSetNew();
+  MoveSet removed = MoveSetNew();
+  splitMoves(l, ms, &flip, &ac, &removed, &next, 1);
+  if (MoveSetIsEmpty(&removed))
+    return;
+
+  // Their replies have the same breakdown after each of our removed moves
+  Stats replies = {0};
+  Move checks[MAX_MOVES];
+  int numChecks = ChessBoardCountStats(l, &flip, &replies, checks);
+  long n = MoveSetCount(&removed);
+  stats->nodes            += n * replies.nodes;
+  stats->captures         += n * replies.captures;
+  stats->enPassant        += n * replies.enPassant;
+  stats->castles          += n * replies.castles;
+  stats->promotions       += n * replies.promotions;
+  stats->checks           += n * replies.checks;
+  stats->discoveredChecks += n * replies.discoveredChecks;
+  stats->doubleChecks     += n * replies.doubleChecks;
+
+  // Except checkmates, which depend on how we can answer the check
+  removed.cb = curr;
+  while (!MoveSetIsEmpty(&removed))
+  {
+    Move m = MoveSetPop(&removed);
+    ChessBoardPlayMove(curr, m);
+    for (int i = 0; i < numChecks; i++)
+    {
+      Move c = checks[i];
+      c.enPassant = ChessBoardEnPassant(curr);
+      c.castling  = ChessBoardCastling(curr);
+      ChessBoardPlayMove(curr, c);
+      stats->checkmates += !ChessBoardHasLegalMove(l, curr);
+      ChessBoardUndoMove(curr, c);
+    }
+    ChessBoardUndoMove(curr, m);
+  }
+}
+
+/*
+ * Fill next with their moves in the flipped board, then move our moves that can't change
+ * their moves from ms to removed. Each move left in removed is followed by exactly the
+ * moves in next.
+ */
+static void splitMoves(LookupTable l, MoveSet *ms, ChessBoard *flip, AnalysisCache *ac, MoveSet *removed, MoveSet *next, int stats)
+{
+  ChessBoard *curr = ms->cb;
   BitBoard from = EMPTY_BOARD;    // 'from' squares to be removed
   BitBoard to[TYPE_SIZE];         // Type-specific 'to' squares (Empty index = all)
   memset(to, EMPTY_BOARD, sizeof(to));
-  MoveSetFill(l, &flip, &next);
+  ChessBoardCacheAnalysis(l, curr, ac);
+  fillMoves(l, flip, next, &ac->analysis);
 
   // Cache hot values
   const BitBoard them       = ChessBoardThem(curr);
@@ -300,15 +591,19 @@ int MoveSetMultiply(LookupTable l, MoveSet *ms)
 
   // 1) Our moves that could disrupt their moves (captures or blocking)
   BitBoard theirMoves = pawnMoves(theirPawns, !color);
-  for (int i = 0; i < next.size; i++) {
-    if (next.maps[i].type < Bishop) continue;
-    theirMoves |= next.maps[i].to;
+  for (int i = 0; i < next->size; i++) {
+    if (next->type[i] < Bishop) continue;
+    theirMoves |= next->to[i];
   }
   to[Empty] |= theirMoves | them;
   from      |= theirMoves;
 
-  // 2) Our moves that could disrupt their king moves
+  // 2) Our moves that could disrupt their king moves, including castling through attacked squares
   BitBoard kingRelevant = (LookupTableAttacks(l, BitBoardPeek(theirKing), King, EMPTY_BOARD) & ~them) | theirKing;
+  if (ChessBoardKingSide(flip))
+    kingRelevant |= ATTACK_MASK & KINGSIDE & BACK_RANK(!color) & ~them;
+  if (ChessBoardQueenSide(flip))
+    kingRelevant |= ATTACK_MASK & QUEENSIDE & BACK_RANK(!color) & ~them;
 
   // Pawns
   BitBoard projection    = PAWN_ATTACKS(kingRelevant, !color);
@@ -385,43 +680,179 @@ int MoveSetMultiply(LookupTable l, MoveSet *ms)
     }
   }
 
-  // 3) Special moves
+  // 3) For the breakdown of their moves to stay the same, our moves must not touch a square
+  // they move to, which would change what they capture, nor the lines to our king that
+  // their checks go through
+  if (stats) {
+    BitBoard targets = PAWN_ATTACKS(theirPawns, !color) | pawnMoves(theirPawns, !color);
+    for (int i = 0; i < next->size; i++)
+      targets |= next->to[i];
+    const BitBoard all = ChessBoardAll(curr);
+    BitBoard lines = LookupTableAttacks(l, BitBoardPeek(ourKing), Queen, all);
+    lines |= LookupTableAttacks(l, BitBoardPeek(ourKing), Queen, all & ~lines);
+    to[Empty] |= targets | lines;
+    from      |= targets | lines | ourKing;
+  }
+
+  // 4) Special moves
   to[Pawn] |= SINGLE_PUSH(SINGLE_PUSH(ourPawns, color) & PAWN_ATTACKS(theirPawns, !color), color); // Double push causing ep
   if (ChessBoardEnPassant(curr) != EMPTY_SQUARE)
     to[Pawn] |= BitBoardAdd(EMPTY_BOARD, ChessBoardEnPassant(curr)); // En passant
   to[Pawn] |= BACK_RANK(!color);                                     // Promotion
   to[King] |= (ourKing >> 2) | (ourKing << 2);                       // Castling
 
-  // 4) Remove moves from ms and put them in removed
+  // 5) Remove moves from ms and put them in removed
   for (int i = 0; i < ms->size;) {
-    Map *m = &ms->maps[i];
-    Type t = m->type;
-    BitBoard origTo   = m->to;
-    BitBoard origFrom = m->from;
-    int mapOffset = BitBoardCount(m->to) - BitBoardCount(m->from);
-
-    if (mapOffset > 0) {  // Injective
-      if ((m->from & from) == 0)
-        m->to &= (to[Empty] | to[t]);
-    } else if (mapOffset == 0) {  // Bijective
-      int squareOffset = BitBoardPeek(m->to) - BitBoardPeek(m->from);
+    Type t = ms->type[i];
+    BitBoard origTo   = ms->to[i];
+    BitBoard origFrom = ms->from[i];
+
+    if (ms->kind[i] == Injective) {
+      if ((ms->from[i] & from) == 0)
+        ms->to[i] &= (to[Empty] | to[t]);
+    } else if (ms->kind[i] == Bijective) {
+      int squareOffset = BitBoardPeek(ms->to[i]) - BitBoardPeek(ms->from[i]);
       BitBoard fromShifted = (squareOffset >= 0) ? (from << squareOffset) : (from >> -squareOffset);
-      m->to   &= (to[Empty] | to[t] | fromShifted);
-      m->from  = (squareOffset >= 0) ? (m->to >> squareOffset) : (m->to << -squareOffset);
+      ms->to[i]  &= (to[Empty] | to[t] | fromShifted);
+      ms->from[i] = (squareOffset >= 0) ? (ms->to[i] >> squareOffset) : (ms->to[i] << -squareOffset);
     }
 
-    BitBoard removedTo   = origTo   & ~m->to;
-    BitBoard removedFrom = origFrom & ~m->from;
+    BitBoard removedTo   = origTo   & ~ms->to[i];
+    BitBoard removedFrom = origFrom & ~ms->from[i];
     if (removedTo != EMPTY_BOARD || removedFrom != EMPTY_BOARD) {
-      addMap(&removed, removedTo   != EMPTY_BOARD ? removedTo   : origTo,
+      addMap(removed, removedTo   != EMPTY_BOARD ? removedTo   : origTo,
              removedFrom != EMPTY_BOARD ? removedFrom : origFrom, t);
     }
 
-    if ((m->to == EMPTY_BOARD) || (m->from == EMPTY_BOARD))
-      ms->maps[i] = ms->maps[--ms->size];
+    if ((ms->to[i] == EMPTY_BOARD) || (ms->from[i] == EMPTY_BOARD))
+      removeMap(ms, i);
     else
       i++;
   }
+}
 
-  return MoveSetCount(&removed) * MoveSetCount(&next);
+/*
+ * Counts specific paths at "depth 3" in the tree of moves. Our moves that can't change
+ * their replies are removed from ms, and for each of them the paths through their replies
+ * are counted. Their replies that can't change our moves, and that don't touch the lines
+ * of the piece we moved, leave us with the moves we'd have if they had passed, so each
+ * of those pairs of moves is counted as a product instead of being played. When too few
+ * pairs are independent, our move is multiplied at "depth 2" instead.
+ */
+long MoveSetMultiplyDepth3(LookupTable l, MoveSet *ms)
+{
+  ChessBoard *curr = ms->cb;
+  ChessBoard flip = ChessBoardFlip(curr);
+  ChessBoard back = ChessBoardFlip(&flip);
+  AnalysisCache ac, prev;
+  MoveSet ours = MoveSetNew();    // Our moves that can't change their replies
+  MoveSet theirs = MoveSetNew();  // Their replies
+  MoveSet quiet = MoveSetNew();   // Their replies that can't change our moves
+  MoveSet next = MoveSetNew();    // Our moves if they had passed
+  splitMoves(l, ms, &flip, &ac, &ours, &theirs, 0);
+  splitMoves(l, &theirs, &back, &prev, &quiet, &next, 0);
+  ours.cb = curr;
+
+  long nodes = 0;
+  while (!MoveSetIsEmpty(&ours))
+  {
+    Move m = MoveSetPop(&ours);
+    ChessBoardPlayMove(curr, m);
+    ChessBoardCacheAnalysis(l, curr, &ac);
+
+    // Squares where their replies could change what the moved piece, the sliders it
+    // uncovered, or any of our pieces it pinned or unpinned can do. A king move or a
+    // change of checks changes everything.
+    BitBoard lines = ~EMPTY_BOARD;
+    if ((m.from.type != King) && (ac.analysis.checking == prev.analysis.checking)) {
+      BitBoard vacated  = BitBoardAdd(EMPTY_BOARD, m.from.square);
+      BitBoard occupied = ChessBoardAll(curr);
+      lines = BitBoardAdd(vacated, m.to.square) | SINGLE_PUSH(vacated, !ChessBoardColor(curr));
+      if (m.to.type == Pawn)
+        lines |= LookupTableAttacks(l, m.to.square, King, EMPTY_BOARD);
+      else if (m.to.type != Knight)
+        lines |= LookupTableAttacks(l, m.to.square, m.to.type, occupied);
+      if (vacated & LookupTableAttacks(l, BitBoardPeek(ChessBoardTheir(curr, King)), King, EMPTY_BOARD))
+        lines |= LookupTableAttacks(l, m.from.square, Queen, occupied) | LookupTableAttacks(l, m.from.square, Knight, EMPTY_BOARD);
+      BitBoard diagonal = LookupTableAttacks(l, m.from.square, Bishop, occupied);
+      BitBoard straight = LookupTableAttacks(l, m.from.square, Rook, occupied);
+      BitBoard sliders  = (diagonal & (ChessBoardTheir(curr, Bishop) | ChessBoardTheir(curr, Queen))) |
+                          (straight & (ChessBoardTheir(curr, Rook)   | ChessBoardTheir(curr, Queen)));
+      while (sliders)
+        lines |= (diagonal | straight) & LookupTableLineOfSight(l, BitBoardPop(&sliders), m.from.square);
+      BitBoard b = (ac.analysis.pinned ^ prev.analysis.pinned) & ~BitBoardAdd(vacated, m.to.square);
+      while (b) {
+        Square s = BitBoardPop(&b);
+        lines |= LookupTableAttacks(l, s, Queen, EMPTY_BOARD) | LookupTableAttacks(l, s, Knight, EMPTY_BOARD);
+      }
+    }
+
+    MoveSet independent = quiet;
+    MoveSet dependent = theirs;
+    MoveSet seen = MoveSetNew();
+    independent.cb = dependent.cb = seen.cb = curr;
+    filterMoves(&independent, lines, &seen);
+
+    // Count the independent pairs as a product and play out the rest, unless too few
+    // pairs are left for that to beat multiplying at depth 2 after our move
+    if (2 * MoveSetCount(&independent) < MoveSetCount(&quiet) + MoveSetCount(&theirs)) {
+      MoveSet replies = MoveSetNew();
+      MoveSetFill(l, curr, &replies);
+      nodes += MoveSetMultiply(l, &replies, &ac) + countReplies(l, &replies, &ac);
+    } else {
+      ChessBoard passed = ChessBoardFlip(curr);
+      nodes += (long)MoveSetCount(&independent) * ChessBoardCountAnalyzed(l, &passed, &ac.analysis);
+      nodes += countReplies(l, &dependent, &ac) + countReplies(l, &seen, &ac);
+    }
+
+    ChessBoardUndoMove(curr, m);
+  }
+
+  return nodes;
+}
+
+// Move the moves of ms whose from or to square is in squares to removed
+static void filterMoves(MoveSet *ms, BitBoard squares, MoveSet *removed)
+{
+  for (int i = 0; i < ms->size;) {
+    BitBoard origTo   = ms->to[i];
+    BitBoard origFrom = ms->from[i];
+
+    if (ms->kind[i] == Injective) {
+      ms->to[i] = (origFrom & squares) ? EMPTY_BOARD : (origTo & ~squares);
+    } else if (ms->kind[i] == Bijective) {
+      int squareOffset = BitBoardPeek(origTo) - BitBoardPeek(origFrom);
+      BitBoard fromShifted = (squareOffset >= 0) ? ((origFrom & squares) << squareOffset) : ((origFrom & squares) >> -squareOffset);
+      ms->to[i]  &= ~(squares | fromShifted);
+      ms->from[i] = (squareOffset >= 0) ? (ms->to[i] >> squareOffset) : (ms->to[i] << -squareOffset);
+    } else {
+      ms->from[i] = (origTo & squares) ? EMPTY_BOARD : (origFrom & ~squares);
+    }
+
+    BitBoard removedTo   = origTo   & ~ms->to[i];
+    BitBoard removedFrom = origFrom & ~ms->from[i];
+    if (removedTo != EMPTY_BOARD || removedFrom != EMPTY_BOARD) {
+      addMap(removed, removedTo   != EMPTY_BOARD ? removedTo   : origTo,
+             removedFrom != EMPTY_BOARD ? removedFrom : origFrom, ms->type[i]);
+    }
+
+    if ((ms->to[i] == EMPTY_BOARD) || (ms->from[i] == EMPTY_BOARD))
+      removeMap(ms, i);
+    else
+      i++;
+  }
+}
+
+// Play each move of ms and count the moves that follow it
+static long countReplies(LookupTable l, MoveSet *ms, AnalysisCache *ac)
+{
+  long nodes = 0;
+  while (!MoveSetIsEmpty(ms))
+  {
+    Move m = MoveSetPop(ms);
+    ChessBoardPlayMove(ms->cb, m);
+    nodes += ChessBoardCountCached(l, ms->cb, ac, m);
+    ChessBoardUndoMove(ms->cb, m);
+  }
+  return nodes;
 }
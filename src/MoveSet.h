@@ -8,28 +8,60 @@
 #define MAPS_SIZE 32 // Assumes only regular chess positions will be given
 
 /*
- * Represents a mapping between a set of from squares and a set
- * of to squares for a given piece. It implicity stores the legal moves
- * for that piece. Can be injective, bijective or surjective mapping.
+ * Each map is a mapping between a set of from squares and a set of to squares
+ * for a given piece. It implicity stores the legal moves for that piece.
+ * The kind of mapping is fixed when the map is added to the set.
  */
-typedef struct
+typedef enum
+{
+  Injective,  // One from square, many to squares
+  Bijective,  // From squares and to squares are a shift of each other
+  Surjective  // Many from squares, one to square
+} Mapping;
+
+/*
+ * The piece classes a staged set of moves is filled with, in order, one at a time. The
+ * cheapest come first, so a caller who stops early skips the slider work.
+ */
+typedef enum
 {
-  BitBoard to;
-  BitBoard from;
-  Type type;
-} Map;
+  Kings,
+  Pawns,
+  Knights,
+  Sliders,
+  EnPassants,
+  Filled
+} Stage;
 
 /*
- * Representation of a set of moves
+ * Representation of a set of moves, stored as a structure of arrays of maps.
+ * Pawn maps either promote on every move or on none, so a promotion map
+ * yields each of its moves four times (Knight, Bishop, Rook, Queen).
  */
 typedef struct
 {
-  ChessBoard *cb; // The board that was used to generate the MoveSet
-  Map maps[MAPS_SIZE];
-  int size;  // Number of maps
-  Move prev; // The previous move that was removed from the set
+  BitBoard to[MAPS_SIZE];
+  BitBoard from[MAPS_SIZE];
+  uint8_t type[MAPS_SIZE];      // Piece type of each map
+  uint8_t kind[MAPS_SIZE];      // Mapping of each map
+  uint8_t promotion[MAPS_SIZE]; // Whether each map is a promotion map
+  ChessBoard *cb;               // The board that was used to generate the MoveSet
+  int size;                     // Number of maps
+  Type next;                    // Next promotion type of the last map's current move
 } MoveSet;
 
+/*
+ * A set of moves filled one piece class at a time, along with what filling the next class
+ * needs. It's kept apart from MoveSet, which every other path uses.
+ */
+typedef struct
+{
+  MoveSet ms;                   // The maps filled so far
+  LookupTable l;
+  Stage stage;                  // Next piece class to fill, Filled if none
+  Analysis analysis;            // Analysis of the board, shared by the stages
+} StagedMoveSet;
+
 /*
  * Returns a new empty set of moves
  */
@@ -41,6 +73,27 @@ MoveSet MoveSetNew(); // Stack allocated
  */
 void MoveSetFill(LookupTable l, ChessBoard *cb, MoveSet *ms);
 
+/*
+ * Given a chess board, fill the given set of moves with the legal moves that pass the
+ * given filter. A checking promotion gets a map of its own whose type is the promoted
+ * piece. Assumes that the moveset is empty.
+ */
+void MoveSetFillFiltered(LookupTable l, ChessBoard *cb, MoveSet *ms, Filter f);
+
+/*
+ * Given a chess board, prepare a staged set of moves to be filled with the legal moves one
+ * piece class at a time as MoveSetNext yields them. Only the analysis of the board is done
+ * up front, so a caller that stops early skips the remaining piece classes. The other
+ * functions, given its ms, only see the maps filled so far.
+ */
+void MoveSetStage(LookupTable l, ChessBoard *cb, StagedMoveSet *sms);
+
+/*
+ * Given a staged set of moves, remove the next move into m and return 1, filling the next
+ * piece class once the previous one has been yielded. Returns 0 if no move is left.
+ */
+int MoveSetNext(StagedMoveSet *sms, Move *m);
+
 /*
  * Given a set of moves, return the size of the set
  */
@@ -52,6 +105,24 @@ int MoveSetCount(MoveSet *ms);
  */
 Move MoveSetPop(MoveSet *ms);
 
+/*
+ * Given a set of moves and an index below its size, return the move at that index without
+ * removing it, so a uniformly random index picks a uniformly random move.
+ */
+Move MoveSetPick(MoveSet *ms, int index);
+
+/*
+ * Advance a SplitMix64 state and return its next number, small and good enough to pick the
+ * index of a random move
+ */
+static inline uint64_t MoveSetRandom(uint64_t *state)
+{
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
 /*
  * Given a set of moves, return whether the set is empty
  */
@@ -59,9 +130,23 @@ int MoveSetIsEmpty(MoveSet *ms);
 
 /*
  * Given a set of moves, remove a subset of those moves and return the size
- * of that subset multiplied by the size of the next set of moves
+ * of that subset multiplied by the size of the next set of moves. The analysis
+ * of the flipped board is cached so the remaining moves can be counted with
+ * ChessBoardCountCached.
+ */
+int MoveSetMultiply(LookupTable l, MoveSet *ms, AnalysisCache *ac);
+
+/*
+ * Like MoveSetMultiply, but adds the perft breakdown of the removed paths to stats instead.
+ * Only our moves that leave the breakdown of their replies unchanged are removed.
+ */
+void MoveSetMultiplyStats(LookupTable l, MoveSet *ms, Stats *stats);
+
+/*
+ * Given a set of moves, remove a subset of those moves and return the number of
+ * paths that would've been searched had those moves been explored to "depth 3"
  */
-int MoveSetMultiply(LookupTable l, MoveSet *ms);
+long MoveSetMultiplyDepth3(LookupTable l, MoveSet *ms);
 
 /*
  * Print a set of moves to stdout
@@ -0,0 +1,136 @@
+#include <string.h>
+
+#include "BitBoard.h"
+#include "LookupTable.h"
+#include "ChessBoard.h"
+#include "MoveSet.h"
+#include "Perft.h"
+#include "PackedBoard.h"
+
+#define COLOR_BIT 8
+
+_Static_assert(sizeof(PackedBoard) == 32, "A packed board must stay 32 bytes");
+
+// The castling squares of each castling bit of a packed board
+static const BitBoard castlingSquares[4] = {
+  KINGSIDE_CASTLING & SOUTH_EDGE, QUEENSIDE_CASTLING & SOUTH_EDGE,
+  KINGSIDE_CASTLING & NORTH_EDGE, QUEENSIDE_CASTLING & NORTH_EDGE
+};
+
+PackedBoard PackedBoardPack(ChessBoard *cb)
+{
+  PackedBoard pb;
+  memset(&pb, 0, sizeof(PackedBoard));
+  pb.occupancy = ChessBoardAll(cb);
+  pb.turn = cb->turn;
+  pb.enPassant = cb->enPassant;
+  for (int i = 0; i < 4; i++)
+    if ((cb->castling & castlingSquares[i]) == castlingSquares[i])
+      pb.castling |= 1 << i;
+
+  BitBoard pieces = pb.occupancy;
+  for (int i = 0; pieces && i < PACKED_PIECES; i++)
+  {
+    Square s = BitBoardPop(&pieces);
+    int color = (cb->colors[Black] & BitBoardAdd(EMPTY_BOARD, s)) ? COLOR_BIT : 0;
+    pb.pieces[i / 2] |= (color | cb->squares[s]) << (4 * (i % 2));
+  }
+  return pb;
+}
+
+ChessBoard PackedBoardUnpack(const PackedBoard *pb)
+{
+  ChessBoard cb;
+  memset(&cb, 0, sizeof(ChessBoard));
+  for (Square s = 0; s < BOARD_SIZE; s++)
+    cb.squares[s] = Empty;
+  cb.turn = pb->turn;
+  cb.enPassant = pb->enPassant;
+  for (int i = 0; i < 4; i++)
+    if (pb->castling & (1 << i))
+      cb.castling |= castlingSquares[i];
+
+  BitBoard pieces = pb->occupancy;
+  for (int i = 0; pieces; i++)
+  {
+    Square s = BitBoardPop(&pieces);
+    int piece = (pb->pieces[i / 2] >> (4 * (i % 2))) & 0xF;
+    Type t = piece & (COLOR_BIT - 1);
+    BitBoard b = BitBoardAdd(EMPTY_BOARD, s);
+    cb.types[t] |= b;
+    cb.colors[(piece & COLOR_BIT) ? Black : White] |= b;
+    cb.squares[s] = t;
+  }
+  ChessBoardResetMaterial(&cb);
+  return cb;
+}
+
+int PackedBoardValid(LookupTable l, const PackedBoard *pb)
+{
+  // What unpacking reads: at most 32 pieces each of a type, and nothing else set
+  int n = BitBoardCount(pb->occupancy);
+  if (n > PACKED_PIECES || pb->turn > Black || pb->castling > 0xF || pb->enPassant > EMPTY_SQUARE)
+    return 0;
+  for (size_t i = 0; i < sizeof(pb->reserved); i++)
+    if (pb->reserved[i])
+      return 0;
+  for (int i = 0; i < PACKED_PIECES; i++)
+  {
+    int piece = (pb->pieces[i / 2] >> (4 * (i % 2))) & 0xF;
+    if ((i < n) ? (piece & (COLOR_BIT - 1)) >= Empty : piece != 0)
+      return 0;
+  }
+
+  // What searching relies on: one king of each color, no pawn on a back rank, castling kings
+  // and rooks in place, an en passant square just crossed by their pawn, and their king not
+  // in check
+  ChessBoard cb = PackedBoardUnpack(pb);
+  Color us = cb.turn;
+  if (BitBoardCount(cb.types[King] & cb.colors[White]) != 1 || BitBoardCount(cb.types[King] & cb.colors[Black]) != 1 ||
+      (cb.types[Pawn] & (NORTH_EDGE | SOUTH_EDGE)))
+    return 0;
+  for (int i = 0; i < 4; i++)
+  {
+    BitBoard ours = cb.colors[(i < 2) ? White : Black];
+    BitBoard king = castlingSquares[i] & KINGSIDE_CASTLING & QUEENSIDE_CASTLING;
+    BitBoard rook = castlingSquares[i] & ~king;
+    if ((pb->castling & (1 << i)) && ((king & ~(cb.types[King] & ours)) || (rook & ~(cb.types[Rook] & ours))))
+      return 0;
+  }
+  if (cb.enPassant != EMPTY_SQUARE)
+  {
+    BitBoard crossed = BitBoardAdd(EMPTY_BOARD, cb.enPassant);
+    if (!(crossed & ENPASSANT_RANK(!us)) || (crossed & ChessBoardAll(&cb)) ||
+        (SINGLE_PUSH(crossed, us) & ChessBoardAll(&cb)) || !(SINGLE_PUSH(crossed, !us) & cb.types[Pawn] & cb.colors[!us]))
+      return 0;
+  }
+  cb.turn = !us;
+  return !(ChessBoardAttacked(l, &cb) & ChessBoardOur(&cb, King));
+}
+
+PackedBoard PackedBoardFromFEN(const char *fen)
+{
+  ChessBoard cb = ChessBoardNew(fen);
+  return PackedBoardPack(&cb);
+}
+
+char *PackedBoardToFEN(const PackedBoard *pb, char *fen)
+{
+  ChessBoard cb = PackedBoardUnpack(pb);
+  return ChessBoardWriteFEN(&cb, fen);
+}
+
+long PackedBoardPerft(LookupTable l, const PackedBoard *pbs, size_t n, int depth, long *nodes)
+{
+  long total = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    nodes[i] = -1;
+    if (!PackedBoardValid(l, &pbs[i]))
+      continue;
+    ChessBoard cb = PackedBoardUnpack(&pbs[i]);
+    nodes[i] = PerftCount(l, &cb, depth);
+    total += nodes[i];
+  }
+  return total;
+}
@@ -0,0 +1,65 @@
+#ifndef PACKEDBOARD_H
+#define PACKEDBOARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "BitBoard.h"
+#include "LookupTable.h"
+#include "ChessBoard.h"
+
+#define PACKED_PIECES 32 // At most as many pieces as a regular chess board starts with
+
+/*
+ * A chess board packed into 32 bytes, so a file of them can be read in place once mapped
+ * into memory. Each piece is a nibble holding its color in the high bit and its type in the
+ * others, in the order of the squares of the occupancy. Files of packed boards are only
+ * portable between machines with the same byte order.
+ */
+typedef struct
+{
+  BitBoard occupancy;                  // Squares with a piece
+  uint8_t pieces[PACKED_PIECES / 2];   // Two pieces per byte, the first in the low nibble
+  uint8_t turn;
+  uint8_t castling;                    // White kingside, white queenside, black kingside, black queenside bits
+  uint8_t enPassant;                   // EMPTY_SQUARE if none
+  uint8_t reserved[5];                 // Always zero
+} PackedBoard;
+
+/*
+ * Pack a chess board, which must have at most 32 pieces
+ */
+PackedBoard PackedBoardPack(ChessBoard *cb);
+
+/*
+ * Unpack a packed board into a chess board
+ */
+ChessBoard PackedBoardUnpack(const PackedBoard *pb);
+
+/*
+ * Returns whether a packed board, such as one read from a file, can be unpacked and searched
+ * safely: at most 32 pieces, each of a type, no reserved bit set, one king of each color, no
+ * pawn on a back rank, castling kings and rooks in place, an en passant square just crossed
+ * by a pawn, and the side not to move not in check
+ */
+int PackedBoardValid(LookupTable l, const PackedBoard *pb);
+
+/*
+ * Pack the chess board of a FEN string
+ */
+PackedBoard PackedBoardFromFEN(const char *fen);
+
+/*
+ * Given a packed board, write its FEN string representation to fen, of at least FEN_SIZE
+ * characters, and return it
+ */
+char *PackedBoardToFEN(const PackedBoard *pb, char *fen);
+
+/*
+ * Count the perft of the given depth of each of n packed boards into nodes, unpacking
+ * them one at a time. A packed board that isn't valid isn't searched and its nodes are -1.
+ * Returns the total of the valid ones.
+ */
+long PackedBoardPerft(LookupTable l, const PackedBoard *pbs, size_t n, int depth, long *nodes);
+
+#endif
@@ -0,0 +1,179 @@
+#include "BitBoard.h"
+#include "LookupTable.h"
+#include "ChessBoard.h"
+#include "MoveSet.h"
+#include "TransTable.h"
+#include "Perft.h"
+
+long PerftCount(LookupTable l, ChessBoard *cb, int depth)
+{
+  if (depth == 0)
+    return 1;
+  if (depth == 1)
+    return ChessBoardCount(l, cb);
+
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  return PerftMoves(l, cb, &ms, depth);
+}
+
+long PerftMoves(LookupTable l, ChessBoard *cb, MoveSet *ms, int depth)
+{
+  long nodes = 0;
+  if (depth == 1)
+  {
+    nodes = MoveSetCount(ms);
+    while (!MoveSetIsEmpty(ms))
+      MoveSetPop(ms);
+    return nodes;
+  }
+
+  // Moves whose replies don't depend on them are multiplied, the rest count their replies
+  if (depth == 2)
+  {
+    AnalysisCache ac;
+    nodes = MoveSetMultiply(l, ms, &ac);
+    while (!MoveSetIsEmpty(ms))
+    {
+      Move m = MoveSetPop(ms);
+      ChessBoardPlayMove(cb, m);
+      nodes += ChessBoardCountCached(l, cb, &ac, m);
+      ChessBoardUndoMove(cb, m);
+    }
+    return nodes;
+  }
+
+  if (depth == 3)
+    nodes += MoveSetMultiplyDepth3(l, ms);
+
+  while (!MoveSetIsEmpty(ms))
+  {
+    Move m = MoveSetPop(ms);
+    ChessBoardPlayMove(cb, m);
+    nodes += PerftCount(l, cb, depth - 1);
+    ChessBoardUndoMove(cb, m);
+  }
+  return nodes;
+}
+
+long PerftHashed(LookupTable l, ChessBoard *cb, int depth, TransTable tt)
+{
+  if (depth < PERFT_HASH_DEPTH)
+    return PerftCount(l, cb, depth);
+
+  long nodes;
+  uint64_t hash = ChessBoardCanonicalHash(l, cb);
+  if (TransTableProbe(tt, hash, depth, &nodes))
+    return nodes;
+
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  nodes = 0;
+  while (!MoveSetIsEmpty(&ms))
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, m);
+    nodes += PerftHashed(l, cb, depth - 1, tt);
+    ChessBoardUndoMove(cb, m);
+  }
+
+  TransTableStore(tt, hash, depth, nodes);
+  return nodes;
+}
+
+int PerftDivide(LookupTable l, ChessBoard *cb, int depth, TransTable tt, Move *moves, long *subTrees)
+{
+  if (depth == 0)
+    return 0;
+
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  ChessBoard mirrors[MAX_MOVES];
+  long mirrorTrees[MAX_MOVES];
+  int n = 0, numMirrors = 0;
+
+  while (!MoveSetIsEmpty(&ms))
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, m);
+
+    int mirrored = -1;
+    for (int i = 0; i < numMirrors && mirrored < 0; i++)
+      if (ChessBoardEqual(cb, &mirrors[i]))
+        mirrored = i;
+
+    long subTree;
+    if (mirrored >= 0)
+      subTree = mirrorTrees[mirrored];
+    else if (depth == 1)
+      subTree = 1;
+    else
+      subTree = tt ? PerftHashed(l, cb, depth - 1, tt) : PerftCount(l, cb, depth - 1);
+
+    // Boards with castling rights have no mirror image with the same subtree
+    if (!ChessBoardHasCastling(cb))
+    {
+      mirrors[numMirrors] = ChessBoardMirror(cb);
+      mirrorTrees[numMirrors++] = subTree;
+    }
+
+    moves[n] = m;
+    subTrees[n++] = subTree;
+    ChessBoardUndoMove(cb, m);
+  }
+  return n;
+}
+
+void PerftEvery(LookupTable l, ChessBoard *cb, int depth, long *counts)
+{
+  if (depth == 1)
+  {
+    counts[0] += ChessBoardCount(l, cb);
+    return;
+  }
+
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  counts[0] += MoveSetCount(&ms);
+
+  if (depth == 2)
+  {
+    counts[1] += PerftMoves(l, cb, &ms, 2);
+    return;
+  }
+
+  while (!MoveSetIsEmpty(&ms))
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, m);
+    PerftEvery(l, cb, depth - 1, counts + 1);
+    ChessBoardUndoMove(cb, m);
+  }
+}
+
+void PerftStats(LookupTable l, ChessBoard *cb, int depth, Stats *stats)
+{
+  if (depth == 0)
+  {
+    stats->nodes++;
+    return;
+  }
+  if (depth == 1)
+  {
+    ChessBoardCountStats(l, cb, stats, NULL);
+    return;
+  }
+
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  if (depth == 2)
+    MoveSetMultiplyStats(l, &ms, stats);
+
+  while (!MoveSetIsEmpty(&ms))
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, m);
+    PerftStats(l, cb, depth - 1, stats);
+    ChessBoardUndoMove(cb, m);
+  }
+}
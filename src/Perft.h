@@ -0,0 +1,56 @@
+#ifndef PERFT_H
+#define PERFT_H
+
+#include "BitBoard.h"
+#include "LookupTable.h"
+#include "ChessBoard.h"
+#include "MoveSet.h"
+#include "TransTable.h"
+
+#define PERFT_HASH_DEPTH 3 // Shallower subtrees are faster to search than to look up
+
+/*
+ * Count the paths of the given depth from a chess board. The last ply is counted directly,
+ * and the last two and three plies multiply the moves that don't change each other.
+ */
+long PerftCount(LookupTable l, ChessBoard *cb, int depth);
+
+/*
+ * Count the paths of the given depth from a chess board that start with the moves in ms,
+ * which must have been filled from that board. The moves are consumed.
+ */
+long PerftMoves(LookupTable l, ChessBoard *cb, MoveSet *ms, int depth);
+
+/*
+ * Count the paths of the given depth from a chess board like PerftCount, but look up the
+ * subtrees of boards with the same perft as a board already searched, by their canonical
+ * hash in tt. Subtrees shallower than PERFT_HASH_DEPTH are searched with PerftCount.
+ */
+long PerftHashed(LookupTable l, ChessBoard *cb, int depth, TransTable tt);
+
+/*
+ * Count the paths of the given depth below each move of a chess board, writing the moves to
+ * moves and their paths to subTrees, which hold MAX_MOVES each. A move leading to the mirror
+ * image of an earlier move's board has the same subtree, so it isn't searched again. Subtrees
+ * are searched with PerftHashed if tt isn't NULL, and PerftCount otherwise. Returns the
+ * number of moves.
+ */
+int PerftDivide(LookupTable l, ChessBoard *cb, int depth, TransTable tt, Move *moves, long *subTrees);
+
+/*
+ * Add the paths of every depth from 1 up to depth from a chess board to counts, counts[0]
+ * getting the paths of depth 1, in one search. Only the last two plies take the shortcuts of
+ * PerftCount, since the moves MoveSetMultiplyDepth3 removes would be missing from the ply
+ * before the last.
+ */
+void PerftEvery(LookupTable l, ChessBoard *cb, int depth, long *counts);
+
+/*
+ * Add the breakdown of the paths of the given depth from a chess board into captures,
+ * checks, checkmates etc. to stats, classifying the moves of the last ply. The last ply is
+ * classified by ChessBoardCountStats, and the last two by MoveSetMultiplyStats where they can
+ * be. A depth of 0 counts the board itself as the one node.
+ */
+void PerftStats(LookupTable l, ChessBoard *cb, int depth, Stats *stats);
+
+#endif
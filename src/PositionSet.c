@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PositionSet.h"
+#include "Memory.h"
+
+#define SHARD_BITS 6
+#define SHARD_SIZE (1 << SHARD_BITS)
+#define MIN_SLOTS 64
+#define RUN_BUFFER 1024
+#define EMPTY_HASH 0
+
+/*
+ * A shard is an open addressing table of hashes, plus the sorted runs of hashes
+ * that were spilled to its file each time the table filled up.
+ */
+typedef struct
+{
+  uint64_t *slots;   // Hashes in memory, EMPTY_HASH if the slot is free
+  size_t size;       // Number of hashes in memory
+  FILE *file;        // Spilled runs one after another, NULL if never spilled
+  long *runs;        // Number of hashes in each spilled run
+  int numRuns;
+} Shard;
+
+/*
+ * A reader over one spilled run of a shard's file
+ */
+typedef struct
+{
+  long offset;       // Index in the file of the next hash to read
+  long remaining;    // Hashes left to read from the file
+  uint64_t buffer[RUN_BUFFER];
+  int position, length;
+} Run;
+
+struct positionSet
+{
+  size_t mask;       // Slots per shard minus one
+  int hasEmpty;      // EMPTY_HASH can't be stored in a slot so it's kept aside
+  Shard shards[SHARD_SIZE];
+};
+
+static void spill(PositionSet ps, Shard *sh);
+static long countShard(Shard *sh);
+static int nextHash(FILE *file, Run *r, uint64_t *hash);
+static int compareHashes(const void *a, const void *b);
+static void *allocate(size_t bytes);
+
+PositionSet PositionSetNew(size_t bytes)
+{
+  PositionSet ps = allocate(sizeof(struct positionSet));
+  size_t slots = MIN_SLOTS;
+  while (slots * 2 * sizeof(uint64_t) * SHARD_SIZE <= bytes)
+    slots *= 2;
+
+  ps->mask = slots - 1;
+  ps->hasEmpty = 0;
+  for (int i = 0; i < SHARD_SIZE; i++)
+  {
+    Shard *sh = &ps->shards[i];
+    sh->slots = MemoryAlloc(slots * sizeof(uint64_t), MEMORY_LOCAL, "position set shard");
+    memset(sh->slots, EMPTY_HASH, slots * sizeof(uint64_t));
+    sh->size = 0;
+    sh->file = NULL;
+    sh->runs = NULL;
+    sh->numRuns = 0;
+  }
+  return ps;
+}
+
+void PositionSetFree(PositionSet ps)
+{
+  for (int i = 0; i < SHARD_SIZE; i++)
+  {
+    Shard *sh = &ps->shards[i];
+    if (sh->file != NULL)
+      fclose(sh->file); // Temporary files are removed when closed
+    free(sh->runs);
+    MemoryFree(sh->slots);
+  }
+  free(ps);
+}
+
+int PositionSetAdd(PositionSet ps, uint64_t hash)
+{
+  if (hash == EMPTY_HASH)
+  {
+    int added = !ps->hasEmpty;
+    ps->hasEmpty = 1;
+    return added;
+  }
+
+  Shard *sh = &ps->shards[hash >> (64 - SHARD_BITS)];
+  size_t i = hash & ps->mask;
+  while (sh->slots[i] != EMPTY_HASH)
+  {
+    if (sh->slots[i] == hash)
+      return 0;
+    i = (i + 1) & ps->mask;
+  }
+
+  sh->slots[i] = hash;
+  sh->size++;
+
+  // Keep the table at most three quarters full so probes stay short
+  if (sh->size > (ps->mask + 1) / 4 * 3)
+    spill(ps, sh);
+  return 1;
+}
+
+long PositionSetCount(PositionSet ps)
+{
+  long count = ps->hasEmpty;
+  for (int i = 0; i < SHARD_SIZE; i++)
+  {
+    Shard *sh = &ps->shards[i];
+    if (sh->numRuns == 0)
+    {
+      count += sh->size;
+      continue;
+    }
+    // Spill what's left in memory so every hash of the shard is in a sorted run
+    if (sh->size > 0)
+      spill(ps, sh);
+    count += countShard(sh);
+  }
+  return count;
+}
+
+// Sort the hashes of a shard, append them to its file as a new run and clear its table
+static void spill(PositionSet ps, Shard *sh)
+{
+  size_t n = 0;
+  for (size_t i = 0; i <= ps->mask; i++)
+    if (sh->slots[i] != EMPTY_HASH)
+      sh->slots[n++] = sh->slots[i];
+  qsort(sh->slots, n, sizeof(uint64_t), compareHashes);
+
+  if (sh->file == NULL)
+    sh->file = tmpfile();
+  if (sh->file == NULL)
+  {
+    fprintf(stderr, "Failed to create a file to spill positions to\n");
+    exit(EXIT_FAILURE);
+  }
+  fseek(sh->file, 0, SEEK_END);
+  if (fwrite(sh->slots, sizeof(uint64_t), n, sh->file) != n)
+  {
+    fprintf(stderr, "Failed to spill positions to disk\n");
+    exit(EXIT_FAILURE);
+  }
+
+  sh->runs = realloc(sh->runs, (sh->numRuns + 1) * sizeof(long));
+  if (sh->runs == NULL)
+  {
+    fprintf(stderr, "Insufficient memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  sh->runs[sh->numRuns++] = n;
+
+  memset(sh->slots, EMPTY_HASH, (ps->mask + 1) * sizeof(uint64_t));
+  sh->size = 0;
+}
+
+// Count the distinct hashes of a shard's runs by merging them in sorted order
+static long countShard(Shard *sh)
+{
+  Run *runs = allocate(sh->numRuns * sizeof(Run));
+  uint64_t *heads = allocate(sh->numRuns * sizeof(uint64_t));
+  int *active = allocate(sh->numRuns * sizeof(int));
+
+  long offset = 0;
+  for (int i = 0; i < sh->numRuns; i++)
+  {
+    runs[i].offset = offset;
+    runs[i].remaining = sh->runs[i];
+    runs[i].position = runs[i].length = 0;
+    offset += sh->runs[i];
+    active[i] = nextHash(sh->file, &runs[i], &heads[i]);
+  }
+
+  long count = 0;
+  uint64_t last = EMPTY_HASH;
+  for (;;)
+  {
+    int min = -1;
+    for (int i = 0; i < sh->numRuns; i++)
+      if (active[i] && (min < 0 || heads[i] < heads[min]))
+        min = i;
+    if (min < 0)
+      break;
+
+    // Runs are sorted and never hold EMPTY_HASH, so a hash differing from the last is new
+    if (heads[min] != last)
+      count++;
+    last = heads[min];
+    active[min] = nextHash(sh->file, &runs[min], &heads[min]);
+  }
+
+  free(active);
+  free(heads);
+  free(runs);
+  return count;
+}
+
+// Read the next hash of a run, returns 0 if the run is exhausted
+static int nextHash(FILE *file, Run *r, uint64_t *hash)
+{
+  if (r->position == r->length)
+  {
+    if (r->remaining == 0)
+      return 0;
+    int n = (r->remaining < RUN_BUFFER) ? r->remaining : RUN_BUFFER;
+    fseek(file, r->offset * sizeof(uint64_t), SEEK_SET);
+    if (fread(r->buffer, sizeof(uint64_t), n, file) != (size_t)n)
+    {
+      fprintf(stderr, "Failed to read spilled positions from disk\n");
+      exit(EXIT_FAILURE);
+    }
+    r->offset += n;
+    r->remaining -= n;
+    r->position = 0;
+    r->length = n;
+  }
+  *hash = r->buffer[r->position++];
+  return 1;
+}
+
+static int compareHashes(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void *allocate(size_t bytes)
+{
+  void *p = malloc(bytes);
+  if (p == NULL)
+  {
+    fprintf(stderr, "Insufficient memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
@@ -0,0 +1,32 @@
+#ifndef POSITIONSET_H
+#define POSITIONSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct positionSet *PositionSet;
+
+/*
+ * Creates a new set of position hashes using at most the given number of bytes of memory.
+ * The set is split into shards by the top bits of each hash, a shard that fills up is
+ * sorted and spilled to a temporary file so the set can grow beyond its memory.
+ */
+PositionSet PositionSetNew(size_t bytes);
+
+/*
+ * Free the set from memory, along with any spilled files.
+ */
+void PositionSetFree(PositionSet ps);
+
+/*
+ * Add a hash to the set. Returns 1 if the hash wasn't in memory, note that a hash that
+ * has been spilled to disk is reported as new again.
+ */
+int PositionSetAdd(PositionSet ps, uint64_t hash);
+
+/*
+ * Return the number of distinct hashes added to the set, merging any spilled files.
+ */
+long PositionSetCount(PositionSet ps);
+
+#endif
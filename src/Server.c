@@ -0,0 +1,548 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "BitBoard.h"
+#include "LookupTable.h"
+#include "ChessBoard.h"
+#include "MoveSet.h"
+#include "TransTable.h"
+#include "Perft.h"
+#include "Server.h"
+
+#define BUFFER_SIZE 4096     // Longest request line, and requests read ahead of a search
+#define ANSWER_SIZE 8192     // Longest answer line, a divide of every legal move
+#define BACKLOG 64           // Connections waiting for a thread
+#define IDLE_MILLISECONDS 100 // How often an idle thread checks for a shutdown
+#define IDLE_TIMEOUT 10000    // Milliseconds a connection may wait between requests by default
+#define POLL_DEPTH 3          // Subtrees this shallow are searched, and not looked up, without a stop
+#define POLL_INTERVAL 16      // Checks for a stop between looks at the connection
+#define LATENCY_WINDOW 4096   // Latest latencies the percentiles are taken over
+
+/*
+ * Why a search stopped before it finished
+ */
+typedef enum
+{
+  Searching,
+  Expired,
+  Cancelled
+} Stop;
+
+/*
+ * What all the threads share: the listening socket, whether to shut down, and the
+ * metrics of every request answered so far
+ */
+typedef struct
+{
+  LookupTable l;
+  int listener;
+  int shutdown;
+  long idleTimeout; // Milliseconds
+  pthread_mutex_t lock;
+  long requests, completed, expired, cancelled, failed;
+  double latencies[LATENCY_WINDOW]; // Milliseconds, of the latest completed requests
+} Server;
+
+/*
+ * A client connection, along with the requests read from it ahead of the current one
+ */
+typedef struct
+{
+  int fd;
+  int closed;
+  size_t length;
+  char buffer[BUFFER_SIZE];
+} Connection;
+
+/*
+ * A thread serving one connection at a time, with its own transposition table and the
+ * lookup table of its node
+ */
+typedef struct
+{
+  Server *s;
+  LookupTable l;
+  TransTable tt;
+  Connection c;
+  struct timespec deadline; // Zero for none
+  int checks;
+  Stop stop;
+} Worker;
+
+static void *serve(void *arg);
+static void answer(Worker *w, char *line, char *out);
+static long search(Worker *w, ChessBoard *cb, int depth);
+static int stopped(Worker *w);
+static int readLine(Worker *w, char *line);
+static int takeLine(Connection *c, char *line);
+static int firstLine(Connection *c, const char *line);
+static int fill(Connection *c, int milliseconds);
+static void reply(Connection *c, char *out);
+static void stats(Server *s, char *out);
+static void record(Server *s, Stop stop, int failed, double milliseconds);
+static int compareLatencies(const void *a, const void *b);
+static double elapsed(struct timespec *start);
+static int removeStale(const char *path, struct sockaddr_un *address);
+
+int ServerRun(LookupTable l, const char *path, ServerOptions *o)
+{
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(address.sun_path))
+  {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+
+  // A socket left by a server that's gone is replaced, anything else at path is kept
+  if (removeStale(path, &address) != 0)
+  {
+    fprintf(stderr, "Path in use, not a stale socket: %s\n", path);
+    return -1;
+  }
+
+  Server s = {.l = l, .idleTimeout = (o->idleTimeout > 0) ? o->idleTimeout : IDLE_TIMEOUT};
+  s.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (s.listener < 0 || bind(s.listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(s.listener, BACKLOG) != 0)
+  {
+    fprintf(stderr, "Could not listen on socket: %s\n", path);
+    if (s.listener >= 0)
+      close(s.listener);
+    return -1;
+  }
+  pthread_mutex_init(&s.lock, NULL);
+
+  int threads = (o->threads > 0) ? o->threads : 1;
+  Worker *workers = malloc(threads * sizeof(Worker));
+  pthread_t *ids = malloc(threads * sizeof(pthread_t));
+  if (workers == NULL || ids == NULL)
+  {
+    fprintf(stderr, "Insufficient memory!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Each table is first touched by the thread searching it, so its memory ends up local
+  for (int i = 0; i < threads; i++)
+  {
+    workers[i].s = &s;
+    workers[i].tt = o->tableBytes ? TransTableNew(o->tableBytes / threads, MEMORY_LOCAL) : NULL;
+  }
+  if (o->report)
+    MemoryReport(stderr);
+
+  for (int i = 0; i < threads; i++)
+  {
+    if (pthread_create(&ids[i], NULL, serve, &workers[i]) != 0)
+    {
+      fprintf(stderr, "Failed to create a server thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int i = 0; i < threads; i++)
+  {
+    pthread_join(ids[i], NULL);
+    if (workers[i].tt)
+      TransTableFree(workers[i].tt);
+  }
+
+  close(s.listener);
+  removeStale(path, &address);
+  pthread_mutex_destroy(&s.lock);
+  free(ids);
+  free(workers);
+  return 0;
+}
+
+// Accept connections and answer their requests one by one, until a shutdown
+static void *serve(void *arg)
+{
+  Worker *w = arg;
+  Server *s = w->s;
+  w->l = LookupTableLocal(s->l);
+  char line[BUFFER_SIZE], out[ANSWER_SIZE];
+  struct pollfd listener = {.fd = s->listener, .events = POLLIN};
+
+  while (!__atomic_load_n(&s->shutdown, __ATOMIC_RELAXED))
+  {
+    if (poll(&listener, 1, IDLE_MILLISECONDS) <= 0)
+      continue;
+    int fd = accept(s->listener, NULL, NULL);
+    if (fd < 0)
+      continue; // Another thread took the connection
+
+    w->c.fd = fd;
+    w->c.closed = 0;
+    w->c.length = 0;
+    while (readLine(w, line))
+    {
+      answer(w, line, out);
+      reply(&w->c, out);
+    }
+    close(fd);
+  }
+  return NULL;
+}
+
+// Parse a request, search it and write its answer to out
+static void answer(Worker *w, char *line, char *out)
+{
+  Server *s = w->s;
+  LookupTable l = w->l;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  char mode[16];
+  int offset = 0;
+  if (sscanf(line, "%15s %n", mode, &offset) != 1)
+  {
+    sprintf(out, "error empty request");
+    return;
+  }
+  if (strcmp(mode, "stats") == 0)
+  {
+    stats(s, out);
+    return;
+  }
+  if (strcmp(mode, "shutdown") == 0)
+  {
+    __atomic_store_n(&s->shutdown, 1, __ATOMIC_RELAXED);
+    sprintf(out, "ok");
+    return;
+  }
+  if (strcmp(mode, "cancel") == 0)
+  {
+    sprintf(out, "error nothing to cancel");
+    return;
+  }
+
+  // Options come before the FEN, which has none of their equal signs
+  int depth = -1;
+  long milliseconds = 0;
+  char *fen = line + offset;
+  char option[32];
+  offset = 0;
+  while (sscanf(fen, "%31[a-z]=%n", option, &offset) == 1 && offset > 0)
+  {
+    char *value = fen + offset;
+    char *end;
+    long n = strtol(value, &end, 10);
+    if (end == value || (*end != ' ' && *end != '\0') || n < 0)
+      break;
+    if (strcmp(option, "depth") == 0)
+      depth = n;
+    else if (strcmp(option, "deadline") == 0)
+      milliseconds = n;
+    else
+      break;
+    fen = end + strspn(end, " ");
+    offset = 0;
+  }
+
+  int searched = strcmp(mode, "perft") == 0 || strcmp(mode, "divide") == 0;
+  if (!searched && strcmp(mode, "moves") != 0 && strcmp(mode, "count") != 0)
+  {
+    sprintf(out, "error unknown mode %s", mode);
+    record(s, Searching, 1, 0);
+    return;
+  }
+  if (!ChessBoardValidFEN(fen) || (searched && (depth < 0 || depth > MAX_PLY)))
+  {
+    sprintf(out, "error %s", ChessBoardValidFEN(fen) ? "depth missing or out of range" : "invalid fen");
+    record(s, Searching, 1, 0);
+    return;
+  }
+
+  ChessBoard cb = ChessBoardNew(fen);
+  w->stop = Searching;
+  w->checks = 0;
+  w->deadline = (struct timespec){0};
+  if (milliseconds > 0)
+  {
+    w->deadline = start;
+    w->deadline.tv_sec += milliseconds / 1000;
+    w->deadline.tv_nsec += (milliseconds % 1000) * 1000000;
+    if (w->deadline.tv_nsec >= 1000000000)
+    {
+      w->deadline.tv_sec++;
+      w->deadline.tv_nsec -= 1000000000;
+    }
+  }
+
+  int length = 0;
+  char move[MOVE_SIZE];
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, &cb, &ms);
+  if (strcmp(mode, "count") == 0)
+    length = sprintf(out, "ok moves=%d", MoveSetCount(&ms));
+  else if (strcmp(mode, "moves") == 0)
+  {
+    length = sprintf(out, "ok moves=%d", MoveSetCount(&ms));
+    while (!MoveSetIsEmpty(&ms))
+      length += sprintf(out + length, " %s", ChessBoardWriteMove(MoveSetPop(&ms), move));
+  }
+  else if (strcmp(mode, "perft") == 0)
+  {
+    long nodes = (depth == 0) ? 1 : 0;
+    while (!MoveSetIsEmpty(&ms) && depth > 0 && w->stop == Searching)
+    {
+      Move m = MoveSetPop(&ms);
+      ChessBoardPlayMove(&cb, m);
+      nodes += search(w, &cb, depth - 1);
+      ChessBoardUndoMove(&cb, m);
+    }
+    length = sprintf(out, "ok nodes=%ld", nodes);
+  }
+  else
+  {
+    // Divide lists the subtrees after the total, which is only known once they're searched
+    char moves[ANSWER_SIZE];
+    int movesLength = 0;
+    long nodes = (depth == 0) ? 1 : 0;
+    while (!MoveSetIsEmpty(&ms) && depth > 0 && w->stop == Searching)
+    {
+      Move m = MoveSetPop(&ms);
+      ChessBoardPlayMove(&cb, m);
+      long subTree = search(w, &cb, depth - 1);
+      ChessBoardUndoMove(&cb, m);
+      nodes += subTree;
+      movesLength += sprintf(moves + movesLength, " %s=%ld", ChessBoardWriteMove(m, move), subTree);
+    }
+    moves[movesLength] = '\0';
+    length = sprintf(out, "ok nodes=%ld", nodes);
+    strcpy(out + length, moves);
+    length += movesLength;
+  }
+
+  double latency = elapsed(&start) * 1000;
+  if (w->stop == Expired)
+    sprintf(out, "expired ms=%.3f", latency);
+  else if (w->stop == Cancelled)
+    sprintf(out, "cancelled ms=%.3f", latency);
+  else
+    sprintf(out + length, " ms=%.3f", latency);
+  record(s, w->stop, 0, latency);
+}
+
+// Search the tree like PerftCount, checking for a stop above the last plies, and looking
+// up subtrees by their canonical hash if the thread has a transposition table
+static long search(Worker *w, ChessBoard *cb, int depth)
+{
+  LookupTable l = w->l;
+  if (depth <= POLL_DEPTH)
+    return PerftCount(l, cb, depth);
+  if (stopped(w))
+    return 0;
+
+  long nodes;
+  uint64_t hash = 0;
+  if (w->tt)
+  {
+    hash = ChessBoardCanonicalHash(l, cb);
+    if (TransTableProbe(w->tt, hash, depth, &nodes))
+      return nodes;
+  }
+
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  nodes = 0;
+  while (!MoveSetIsEmpty(&ms))
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, m);
+    nodes += search(w, cb, depth - 1);
+    ChessBoardUndoMove(cb, m);
+  }
+
+  // A stopped subtree is incomplete, and mustn't be looked up later
+  if (w->tt && w->stop == Searching)
+    TransTableStore(w->tt, hash, depth, nodes);
+  return nodes;
+}
+
+// Returns whether the search past its deadline, or cancelled by its client sending cancel
+// or hanging up. The connection is only looked at every so often, since it's a system call.
+static int stopped(Worker *w)
+{
+  if (w->stop != Searching)
+    return 1;
+
+  if (w->deadline.tv_sec != 0)
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > w->deadline.tv_sec ||
+        (now.tv_sec == w->deadline.tv_sec && now.tv_nsec >= w->deadline.tv_nsec))
+      w->stop = Expired;
+  }
+
+  if (w->stop == Searching && ++w->checks % POLL_INTERVAL == 0)
+  {
+    Connection *c = &w->c;
+    char line[BUFFER_SIZE];
+    fill(c, 0);
+    if (c->closed)
+      w->stop = Cancelled;
+    else if (firstLine(c, "cancel"))
+    {
+      takeLine(c, line);
+      w->stop = Cancelled;
+    }
+  }
+  return w->stop != Searching;
+}
+
+// Read the next request of the connection into line, returns 0 once it's closed, idle for
+// longer than the timeout, or the server is shutting down. Carriage returns are dropped.
+static int readLine(Worker *w, char *line)
+{
+  Connection *c = &w->c;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (;;)
+  {
+    if (takeLine(c, line))
+      return 1;
+    if (c->length == BUFFER_SIZE)
+    {
+      reply(c, "error request too long");
+      c->length = 0;
+    }
+    if (c->closed || __atomic_load_n(&w->s->shutdown, __ATOMIC_RELAXED) ||
+        elapsed(&start) * 1000 >= w->s->idleTimeout)
+      return 0;
+    fill(c, IDLE_MILLISECONDS);
+  }
+}
+
+// Move the first complete line of the connection's buffer into line, if there is one
+static int takeLine(Connection *c, char *line)
+{
+  char *end = memchr(c->buffer, '\n', c->length);
+  if (end == NULL)
+    return 0;
+
+  size_t length = end - c->buffer;
+  memcpy(line, c->buffer, length);
+  line[length] = '\0';
+  if (length > 0 && line[length - 1] == '\r')
+    line[length - 1] = '\0';
+  c->length -= length + 1;
+  memmove(c->buffer, end + 1, c->length);
+  return 1;
+}
+
+// Returns whether the first complete line of the connection's buffer is the given one
+static int firstLine(Connection *c, const char *line)
+{
+  size_t length = strlen(line);
+  char *end = memchr(c->buffer, '\n', c->length);
+  if (end == NULL || strncmp(c->buffer, line, length) != 0)
+    return 0;
+  return end - c->buffer == (long)length || (end - c->buffer == (long)length + 1 && c->buffer[length] == '\r');
+}
+
+// Read what the client sent into the connection's buffer, waiting up to the given time
+static int fill(Connection *c, int milliseconds)
+{
+  struct pollfd p = {.fd = c->fd, .events = POLLIN};
+  if (c->closed || c->length == BUFFER_SIZE || poll(&p, 1, milliseconds) <= 0)
+    return 0;
+
+  ssize_t n = recv(c->fd, c->buffer + c->length, BUFFER_SIZE - c->length, MSG_DONTWAIT);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+    c->closed = 1;
+  else if (n > 0)
+    c->length += n;
+  return n > 0;
+}
+
+// Send a line to the client, unless it hung up
+static void reply(Connection *c, char *out)
+{
+  size_t length = strlen(out);
+  out[length] = '\n';
+  for (size_t sent = 0; sent <= length && !c->closed;)
+  {
+    ssize_t n = send(c->fd, out + sent, length + 1 - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno != EINTR)
+      c->closed = 1;
+    else if (n > 0)
+      sent += n;
+  }
+  out[length] = '\0';
+}
+
+// Write the request counts and latency percentiles so far to out
+static void stats(Server *s, char *out)
+{
+  double latencies[LATENCY_WINDOW];
+
+  pthread_mutex_lock(&s->lock);
+  long n = (s->completed < LATENCY_WINDOW) ? s->completed : LATENCY_WINDOW;
+  memcpy(latencies, s->latencies, n * sizeof(double));
+  long requests = s->requests, completed = s->completed;
+  long expired = s->expired, cancelled = s->cancelled, failed = s->failed;
+  pthread_mutex_unlock(&s->lock);
+
+  qsort(latencies, n, sizeof(double), compareLatencies);
+  double p50 = n ? latencies[(n - 1) / 2] : 0;
+  double p99 = n ? latencies[(n - 1) * 99 / 100] : 0;
+  sprintf(out, "ok requests=%ld completed=%ld expired=%ld cancelled=%ld failed=%ld p50=%.3fms p99=%.3fms",
+          requests, completed, expired, cancelled, failed, p50, p99);
+}
+
+// Count a request, and the latency of a completed one
+static void record(Server *s, Stop stop, int failed, double milliseconds)
+{
+  pthread_mutex_lock(&s->lock);
+  s->requests++;
+  if (failed)
+    s->failed++;
+  else if (stop == Expired)
+    s->expired++;
+  else if (stop == Cancelled)
+    s->cancelled++;
+  else
+    s->latencies[s->completed++ % LATENCY_WINDOW] = milliseconds;
+  pthread_mutex_unlock(&s->lock);
+}
+
+static int compareLatencies(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double elapsed(struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Remove the socket at path if no server answers on it anymore. Returns 0 if there's
+// nothing at path by then, and -1 if something else is there or a server is listening.
+static int removeStale(const char *path, struct sockaddr_un *address)
+{
+  struct stat st;
+  if (lstat(path, &st) != 0)
+    return (errno == ENOENT) ? 0 : -1;
+  if (!S_ISSOCK(st.st_mode))
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  int listening = (fd >= 0) && connect(fd, (struct sockaddr *)address, sizeof(*address)) == 0;
+  if (fd >= 0)
+    close(fd);
+  return (listening || unlink(path) != 0) ? -1 : 0;
+}
@@ -0,0 +1,41 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+
+#include "BitBoard.h"
+#include "LookupTable.h"
+#include "ChessBoard.h"
+
+/*
+ * How a server searches the requests it's sent
+ */
+typedef struct
+{
+  int threads;       // Connections served at once, each by its own thread
+  size_t tableBytes; // Memory for the transposition tables of the threads, 0 for none
+  int report;        // Write the memory report to stderr once the tables are allocated
+  long idleTimeout;  // Milliseconds a connection may wait between requests, 0 for 10 seconds
+} ServerOptions;
+
+/*
+ * Serves line-delimited requests over a Unix domain socket at path, until a client sends
+ * shutdown. The lookup table and every thread's transposition table stay warm between
+ * requests. A request is a mode, options and a FEN:
+ *
+ *   perft depth=<plies> [deadline=<milliseconds>] <fen>
+ *   divide depth=<plies> [deadline=<milliseconds>] <fen>
+ *   moves <fen>
+ *   count <fen>
+ *
+ * and its answer is a line starting with ok, error, expired or cancelled. A search is
+ * cancelled by sending cancel on its connection, or closing it. Sending stats answers the
+ * number of requests so far, and the median and 99th percentile of their latencies.
+ * A connection that sends no request within the idle timeout is closed, so that a thread
+ * isn't held by a client that doesn't use it. A socket already at path is only replaced if
+ * no server is listening on it anymore, and nothing else there is ever removed.
+ * Returns 0 after a shutdown, or -1 if the socket couldn't be set up.
+ */
+int ServerRun(LookupTable l, const char *path, ServerOptions *o);
+
+#endif
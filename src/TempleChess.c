@@ -0,0 +1,119 @@
+#include <pthread.h>
+
+#include "BitBoard.h"
+#include "LookupTable.h"
+#include "ChessBoard.h"
+#include "MoveSet.h"
+#include "Perft.h"
+#include "TempleChess.h"
+
+_Static_assert(TEMPLECHESS_MOVE_SIZE == MOVE_SIZE, "TEMPLECHESS_MOVE_SIZE must match MOVE_SIZE");
+_Static_assert(TEMPLECHESS_MAX_MOVES == MAX_MOVES, "TEMPLECHESS_MAX_MOVES must match MAX_MOVES");
+
+// The one lookup table shared by every caller, never written after it's built
+static LookupTable table = NULL;
+static pthread_once_t tableOnce = PTHREAD_ONCE_INIT;
+
+static void buildTable(void);
+static LookupTable getTable(void);
+static LookupTable newBoard(const char *fen, ChessBoard *cb);
+
+int TempleChessInit(void)
+{
+  return (getTable() != NULL) ? 0 : -1;
+}
+
+long TempleChessPerft(const char *fen, int depth)
+{
+  if (depth < 0)
+    return -1;
+
+  ChessBoard cb;
+  LookupTable l = newBoard(fen, &cb);
+  if (l == NULL)
+    return -1;
+  return PerftCount(l, &cb, depth);
+}
+
+int TempleChessCount(const char *fen)
+{
+  ChessBoard cb;
+  LookupTable l = newBoard(fen, &cb);
+  if (l == NULL)
+    return -1;
+  return ChessBoardCount(l, &cb);
+}
+
+int TempleChessMoves(const char *fen, char moves[][TEMPLECHESS_MOVE_SIZE], int size)
+{
+  if (size < 0)
+    return -1;
+
+  ChessBoard cb;
+  LookupTable l = newBoard(fen, &cb);
+  if (l == NULL)
+    return -1;
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, &cb, &ms);
+
+  int n = 0;
+  while (!MoveSetIsEmpty(&ms))
+  {
+    Move m = MoveSetPop(&ms);
+    if (n < size)
+      ChessBoardWriteMove(m, moves[n]);
+    n++;
+  }
+  return n;
+}
+
+int TempleChessDivide(const char *fen, int depth, char moves[][TEMPLECHESS_MOVE_SIZE],
+                      long *nodes, int size)
+{
+  if (depth < 1 || size < 0)
+    return -1;
+
+  ChessBoard cb;
+  LookupTable l = newBoard(fen, &cb);
+  if (l == NULL)
+    return -1;
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, &cb, &ms);
+
+  int n = 0;
+  while (!MoveSetIsEmpty(&ms))
+  {
+    Move m = MoveSetPop(&ms);
+    if (n < size)
+    {
+      ChessBoardWriteMove(m, moves[n]);
+      ChessBoardPlayMove(&cb, m);
+      nodes[n] = PerftCount(l, &cb, depth - 1);
+      ChessBoardUndoMove(&cb, m);
+    }
+    n++;
+  }
+  return n;
+}
+
+// Left NULL if the table couldn't be built, which every entry point reports as an error
+static void buildTable(void)
+{
+  table = LookupTableNew();
+}
+
+static LookupTable getTable(void)
+{
+  pthread_once(&tableOnce, buildTable);
+  return table;
+}
+
+// Parse a FEN into cb and return the lookup table, or NULL if the FEN isn't valid or the
+// table couldn't be built
+static LookupTable newBoard(const char *fen, ChessBoard *cb)
+{
+  if (fen == NULL || !ChessBoardValidFEN(fen))
+    return NULL;
+  *cb = ChessBoardNew(fen);
+  return getTable();
+}
@@ -0,0 +1,50 @@
+#ifndef TEMPLECHESS_H
+#define TEMPLECHESS_H
+
+/*
+ * Stable C API of the templechess library. Every function is reentrant: the only shared
+ * state is the lookup table, built once on first use and read-only afterwards, and all
+ * results are written to buffers owned by the caller. Positions are passed as FEN strings,
+ * checked with ChessBoardValidFEN before they're searched, and moves are returned in UCI
+ * notation. A FEN that isn't valid fails the call, which returns -1.
+ */
+
+#define TEMPLECHESS_MOVE_SIZE 6 // Longer than any move in UCI notation, e.g. e7e8q
+#define TEMPLECHESS_MAX_MOVES 256 // More than the legal moves of any position
+
+/*
+ * Build the lookup table ahead of the first call that needs it, returns 0 on success or -1 if
+ * there wasn't enough memory for it. Calling it is optional, and calling it again does nothing:
+ * a table that failed to build fails every later call too, which returns -1 like Init.
+ */
+int TempleChessInit(void);
+
+/*
+ * Count the paths of the given depth from a position, returns -1 if the FEN isn't valid, depth
+ * is negative or the lookup table couldn't be built
+ */
+long TempleChessPerft(const char *fen, int depth);
+
+/*
+ * Count the legal moves of a position, returns -1 if the FEN isn't valid or the lookup table
+ * couldn't be built
+ */
+int TempleChessCount(const char *fen);
+
+/*
+ * Write up to size legal moves of a position to moves, returns the number of legal moves,
+ * which may be larger than size, or -1 if the FEN isn't valid, size is negative or the lookup
+ * table couldn't be built
+ */
+int TempleChessMoves(const char *fen, char moves[][TEMPLECHESS_MOVE_SIZE], int size);
+
+/*
+ * Write up to size legal moves of a position to moves, and the paths of the given depth
+ * starting with each of them to nodes. Returns the number of legal moves, which may be
+ * larger than size, or -1 if the FEN isn't valid, depth is less than 1, size is negative or
+ * the lookup table couldn't be built.
+ */
+int TempleChessDivide(const char *fen, int depth, char moves[][TEMPLECHESS_MOVE_SIZE],
+                      long *nodes, int size);
+
+#endif
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "TransTable.h"
+#include "Memory.h"
+
+#define MIN_ENTRIES 1024
+#define DEPTH_BITS 8 // Low bits of an entry's data hold the depth, the rest the nodes
+
+/*
+ * The perft of a position hash at a depth
+ */
+typedef struct
+{
+  uint64_t hash;
+  uint64_t data;
+} Entry;
+
+struct transTable
+{
+  size_t mask;       // Number of entries minus one
+  Entry *entries;
+};
+
+TransTable TransTableNew(size_t bytes, int node)
+{
+  TransTable tt = malloc(sizeof(struct transTable));
+  size_t entries = MIN_ENTRIES;
+  while (entries * 2 * sizeof(Entry) <= bytes)
+    entries *= 2;
+
+  if (tt == NULL)
+  {
+    fprintf(stderr, "Insufficient memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  tt->entries = MemoryAlloc(entries * sizeof(Entry), node, "transposition table");
+  tt->mask = entries - 1;
+  return tt;
+}
+
+void TransTableFree(TransTable tt)
+{
+  MemoryFree(tt->entries);
+  free(tt);
+}
+
+int TransTableProbe(TransTable tt, uint64_t hash, int depth, long *nodes)
+{
+  Entry *e = &tt->entries[hash & tt->mask];
+  if (e->hash != hash || (int)(e->data & ((1 << DEPTH_BITS) - 1)) != depth)
+    return 0;
+  *nodes = e->data >> DEPTH_BITS;
+  return 1;
+}
+
+void TransTableStore(TransTable tt, uint64_t hash, int depth, long nodes)
+{
+  Entry *e = &tt->entries[hash & tt->mask];
+  e->hash = hash;
+  e->data = ((uint64_t)nodes << DEPTH_BITS) | depth;
+}
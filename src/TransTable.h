@@ -0,0 +1,35 @@
+#ifndef TRANSTABLE_H
+#define TRANSTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Memory.h"
+
+typedef struct transTable *TransTable;
+
+/*
+ * Creates a new transposition table of perft results using at most the given number
+ * of bytes of memory. Each result is stored in the slot of its hash, replacing whatever
+ * was there. node places the table's memory as in MemoryAlloc: MEMORY_LOCAL for a table
+ * searched by one thread, MEMORY_INTERLEAVED for one shared by threads on several nodes.
+ */
+TransTable TransTableNew(size_t bytes, int node);
+
+/*
+ * Free the table from memory.
+ */
+void TransTableFree(TransTable tt);
+
+/*
+ * Look up the perft of the given depth of a position hash. Returns 1 and sets nodes if
+ * it's in the table.
+ */
+int TransTableProbe(TransTable tt, uint64_t hash, int depth, long *nodes);
+
+/*
+ * Store the perft of the given depth of a position hash.
+ */
+void TransTableStore(TransTable tt, uint64_t hash, int depth, long nodes);
+
+#endif
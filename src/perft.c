@@ -7,74 +7,443 @@
 #include "LookupTable.h"
 #include "ChessBoard.h"
 #include "MoveSet.h"
+#include "PositionSet.h"
+#include "Estimator.h"
+#include "TransTable.h"
+#include "Batch.h"
+#include "Perft.h"
+#include "PackedBoard.h"
+#include "Game.h"
+#include "Server.h"
+#include "Memory.h"
+#include "Frontier.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-static long treeSearch(LookupTable l, ChessBoard *cb, int depth);
-static long root(LookupTable l, ChessBoard *cb, int depth);
+#define MEGABYTE (1 << 20)
+#define DEFAULT_MEMORY 1024 // Megabytes for the sets of unique positions or the frontier
+#define DEFAULT_SEED 2026   // Seed of the random paths of an estimate
+#define PACK_LINE_SIZE 256
+
+static long root(LookupTable l, ChessBoard *cb, int depth, TransTable tt);
+static long unique(LookupTable l, ChessBoard *cb, int depth, size_t memory, int report);
+static void uniqueSearch(LookupTable l, ChessBoard *cb, PositionSet *sets, int ply, int depth);
+static void printStats(Stats *stats);
+static int packedSearch(char *file, int depth, int replicate, int report);
+static int packFENs(char *file);
+static LookupTable newTable(int replicate);
+static void usage(char *name);
 
 int main(int argc, char **argv)
 {
-  // Check arguments
-  if (argc != 3)
+  int incremental = 0, distinct = 0, breakdown = 0, estimate = 0, expand = 0, every = 0, replicate = 0, report = 0;
+  int split = -1;
+  char *batch = NULL, *packed = NULL, *pack = NULL, *positions = NULL, *server = NULL;
+  long games = 0;
+  size_t memory = DEFAULT_MEMORY, table = 0;
+  EstimateOptions eo = {.threads = 1, .seed = DEFAULT_SEED};
+  int opt;
+  while ((opt = getopt(argc, argv, "iusanrm:e:l:k:j:H:b:P:W:g:o:S:f:")) != -1)
   {
-    fprintf(stderr, "Usage: %s <fen> <depth>\n", argv[0]);
-    return 1;
+    switch (opt)
+    {
+    case 'i':
+      incremental = 1;
+      break;
+    case 'u':
+      distinct = 1;
+      break;
+    case 's':
+      breakdown = 1;
+      break;
+    case 'a':
+      every = 1;
+      break;
+    case 'n':
+      replicate = 1;
+      break;
+    case 'r':
+      report = 1;
+      break;
+    case 'm':
+      memory = strtoul(optarg, NULL, 10);
+      break;
+    case 'e':
+      estimate = 1;
+      eo.error = strtod(optarg, NULL) / 100;
+      if (!(eo.error > 0)) // Sampling would never stop
+        usage(argv[0]);
+      break;
+    case 'l':
+      estimate = 1;
+      eo.seconds = strtod(optarg, NULL);
+      if (!(eo.seconds > 0))
+        usage(argv[0]);
+      break;
+    case 'k':
+      expand = 1;
+      eo.expand = atoi(optarg);
+      if (eo.expand < 0)
+        usage(argv[0]);
+      break;
+    case 'j':
+      eo.threads = atoi(optarg);
+      break;
+    case 'H':
+      table = strtoul(optarg, NULL, 10);
+      break;
+    case 'b':
+      batch = optarg;
+      break;
+    case 'P':
+      packed = optarg;
+      break;
+    case 'W':
+      pack = optarg;
+      break;
+    case 'g':
+      games = strtol(optarg, NULL, 10);
+      break;
+    case 'o':
+      positions = optarg;
+      break;
+    case 'S':
+      server = optarg;
+      break;
+    case 'f':
+      split = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
   }
+  if (expand && !estimate)
+    usage(argv[0]);
 
-  LookupTable l = LookupTableNew();
-  ChessBoard cb = ChessBoardNew(argv[1]);
-  int depth = atoi(argv[2]);
-  long nodes = root(l, &cb, depth);
-  printf("\nNodes searched: %ld\n", nodes);
+  if (batch)
+  {
+    FILE *in = strcmp(batch, "-") ? fopen(batch, "r") : stdin;
+    if (in == NULL)
+    {
+      fprintf(stderr, "Could not open file: %s\n", batch);
+      return 1;
+    }
+    LookupTable l = newTable(replicate);
+    if (report)
+      MemoryReport(stderr);
+    BatchStats bs;
+    long failed = BatchRun(l, in, stdout, eo.threads, PerftCount, &bs);
+    fprintf(stderr, "Positions: %ld, failed: %ld, rejected: %ld, positions per second: %.0f\n", bs.positions,
+            bs.failed, bs.rejected, (bs.seconds > 0) ? bs.positions / bs.seconds : 0);
+    LookupTableFree(l);
+    if (in != stdin)
+      fclose(in);
+    return failed != 0;
+  }
+
+  if (server)
+  {
+    LookupTable l = newTable(replicate);
+    ServerOptions so = {.threads = eo.threads, .tableBytes = table * MEGABYTE, .report = report};
+    int status = ServerRun(l, server, &so);
+    LookupTableFree(l);
+    return status != 0;
+  }
+
+  if (pack)
+    return packFENs(pack);
+  if (packed)
+  {
+    if (argc - optind != 1)
+      usage(argv[0]);
+    return packedSearch(packed, atoi(argv[optind]), replicate, report);
+  }
+
+  // Check arguments
+  if (argc - optind != 2)
+    usage(argv[0]);
+
+  LookupTable l = newTable(replicate);
+  ChessBoard cb = ChessBoardNew(argv[optind]);
+  int depth = atoi(argv[optind + 1]);
+  AttackStack as;
+  if (incremental)
+    ChessBoardTrack(l, &cb, &as);
+  if (distinct)
+  {
+    long positions = unique(l, &cb, depth, memory * MEGABYTE, report);
+    printf("\nUnique positions: %ld\n", positions);
+  }
+  else if (split >= 0)
+  {
+    FrontierStats fs;
+    long nodes = FrontierCount(l, &cb, depth, split, memory * MEGABYTE, &fs);
+    printf("Frontier paths: %ld\nFrontier positions: %ld\nRuns spilled: %d\n", fs.paths, fs.positions,
+           fs.runs);
+    printf("\nNodes searched: %ld\n", nodes);
+  }
+  else if (games)
+  {
+    FILE *out = positions ? fopen(positions, "wb") : NULL;
+    if (positions && out == NULL)
+    {
+      fprintf(stderr, "Could not open file: %s\n", positions);
+      return 1;
+    }
+    long plies = GameGenerate(l, &cb, games, depth, eo.threads, eo.seed, stdout, out);
+    fprintf(stderr, "Games: %ld, plies: %ld\n", games, plies);
+    if (out)
+      fclose(out);
+  }
+  else if (estimate)
+  {
+    eo.depth = depth;
+    Estimate e = EstimatorRun(l, &cb, &eo);
+    printf("Estimated nodes: %.6e +/- %.2e (95%% confidence, %.3f%%)\n", e.nodes, e.halfWidth,
+           (e.nodes > 0) ? 100 * e.halfWidth / e.nodes : 0);
+    printf("Samples: %ld\n", e.samples);
+  }
+  else if (every)
+  {
+    if (depth > MAX_PLY)
+      usage(argv[0]);
+    long counts[MAX_PLY + 1] = {1};
+    if (depth > 0)
+      PerftEvery(l, &cb, depth, counts + 1);
+    for (int d = 1; d <= depth; d++)
+      printf("Depth %d: %ld\n", d, counts[d]);
+  }
+  else if (breakdown)
+  {
+    Stats stats = {0};
+    PerftStats(l, &cb, depth, &stats);
+    printStats(&stats);
+  }
+  else
+  {
+    TransTable tt = table ? TransTableNew(table * MEGABYTE, MEMORY_LOCAL) : NULL;
+    if (report)
+      MemoryReport(stderr);
+    long nodes = root(l, &cb, depth, tt);
+    printf("\nNodes searched: %ld\n", nodes);
+    if (tt)
+      TransTableFree(tt);
+  }
   LookupTableFree(l);
   return 0;
 }
 
-// Base-level function: prints moves and calls treeSearch for each move
-static long root(LookupTable l, ChessBoard *cb, int depth)
+// Builds the lookup table, copying it onto every NUMA node if asked, or exits if it can't
+static LookupTable newTable(int replicate)
+{
+  LookupTable l = LookupTableNew();
+  if (l == NULL)
+  {
+    fprintf(stderr, "Insufficient memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  if (replicate)
+    LookupTableReplicate(l);
+  return l;
+}
+
+static void usage(char *name)
+{
+  fprintf(stderr, "Usage: %s [-i] [-u] [-s] [-a] [-n] [-r] [-m megabytes] [-e percent] [-l seconds] [-k plies] [-j threads] [-H megabytes] [-f plies] <fen> <depth>\n", name);
+  fprintf(stderr, "       %s [-n] [-r] [-j threads] -b <file>\n", name);
+  fprintf(stderr, "       %s [-n] [-r] -P <file> <depth>\n", name);
+  fprintf(stderr, "       %s -W <file> < fens\n", name);
+  fprintf(stderr, "       %s -g <games> [-j threads] [-o file] <fen> <plies>\n", name);
+  fprintf(stderr, "       %s [-n] [-r] [-j threads] [-H megabytes] -S <socket>\n", name);
+  fprintf(stderr, "  -i  maintain attacks and pins incrementally\n");
+  fprintf(stderr, "  -u  count unique positions at each ply instead of paths\n");
+  fprintf(stderr, "  -s  break the paths down into captures, checks, checkmates etc.\n");
+  fprintf(stderr, "  -a  count the paths of every depth up to depth in one search\n");
+  fprintf(stderr, "  -n  copy the lookup table onto every NUMA node, for threads to read locally\n");
+  fprintf(stderr, "  -r  report the pages and NUMA placement the tables got once they're allocated\n");
+  fprintf(stderr, "  -m  memory for the unique positions or the frontier before spilling to disk (default %d)\n", DEFAULT_MEMORY);
+  fprintf(stderr, "  -e  estimate the perft by sampling random paths until within this relative error, above 0\n");
+  fprintf(stderr, "  -l  estimate the perft by sampling random paths for this many seconds, above 0\n");
+  fprintf(stderr, "  -k  plies of an estimate searched exhaustively before sampling, with -e or -l (default 0)\n");
+  fprintf(stderr, "  -j  threads sampling an estimate, searching a batch, playing games or serving (default 1)\n");
+  fprintf(stderr, "  -H  memory for a transposition table keyed by symmetry-reduced hashes\n");
+  fprintf(stderr, "  -f  search breadth first, merging identical boards this many plies down before searching them\n");
+  fprintf(stderr, "  -P  search every packed board of a file, mapped into memory\n");
+  fprintf(stderr, "  -W  pack the FEN of every line of stdin into a file\n");
+  fprintf(stderr, "  -g  play random games of at most plies from the board instead\n");
+  fprintf(stderr, "  -o  write every position of the random games to a file as packed boards\n");
+  fprintf(stderr, "  -S  serve perft requests on a Unix domain socket until one asks for a shutdown\n");
+  fprintf(stderr, "  -b  search every \"FEN depth nodes\" or EPD \";Dn nodes\" line of a file, - for stdin, and check the nodes\n");
+  exit(1);
+}
+
+// Base-level function: prints each move and the paths below it
+static long root(LookupTable l, ChessBoard *cb, int depth, TransTable tt)
+{
+  if (depth == 0)
+    return 1;
+
+  Move moves[MAX_MOVES];
+  long subTrees[MAX_MOVES], nodes = 0;
+  int n = PerftDivide(l, cb, depth, tt, moves, subTrees);
+  for (int i = 0; i < n; i++)
+  {
+    ChessBoardPrintMove(moves[i]);
+    printf(": %ld\n", subTrees[i]);
+    nodes += subTrees[i];
+  }
+  return nodes;
+}
+
+// Counts the unique positions at each ply, printing them, and returns the count at depth.
+// Deeper plies get more of the memory since they hold more positions.
+static long unique(LookupTable l, ChessBoard *cb, int depth, size_t memory, int report)
 {
   if (depth == 0)
     return 1;
 
+  PositionSet *sets = malloc((depth + 1) * sizeof(PositionSet));
+  for (int ply = 1; ply <= depth; ply++)
+    sets[ply] = PositionSetNew(memory >> (depth - ply + 1));
+  if (report)
+    MemoryReport(stderr);
+
+  uniqueSearch(l, cb, sets, 1, depth);
+
+  long positions = 0;
+  for (int ply = 1; ply <= depth; ply++)
+  {
+    positions = PositionSetCount(sets[ply]);
+    printf("Ply %d: %ld\n", ply, positions);
+    PositionSetFree(sets[ply]);
+  }
+  free(sets);
+  return positions;
+}
+
+// Adds the positions after each move to the set of their ply. A position already in the
+// set has had its subtree searched, so only new positions are searched further.
+static void uniqueSearch(LookupTable l, ChessBoard *cb, PositionSet *sets, int ply, int depth)
+{
   MoveSet ms = MoveSetNew();
   MoveSetFill(l, cb, &ms);
-  long nodes = 0;
 
   while (!MoveSetIsEmpty(&ms))
   {
     Move m = MoveSetPop(&ms);
     ChessBoardPlayMove(cb, m);
-    long subTree = (depth > 1) ? treeSearch(l, cb, depth - 1) : 1;
-    ChessBoardPrintMove(m);
-    printf(": %ld\n", subTree);
-    nodes += subTree;
+    if (PositionSetAdd(sets[ply], ChessBoardHash(l, cb)) && (ply < depth))
+      uniqueSearch(l, cb, sets, ply + 1, depth);
     ChessBoardUndoMove(cb, m);
   }
+}
 
-  return nodes;
+static void printStats(Stats *stats)
+{
+  printf("Nodes searched: %ld\n", stats->nodes);
+  printf("Captures: %ld\n", stats->captures);
+  printf("En passant: %ld\n", stats->enPassant);
+  printf("Castles: %ld\n", stats->castles);
+  printf("Promotions: %ld\n", stats->promotions);
+  printf("Checks: %ld\n", stats->checks);
+  printf("Discovered checks: %ld\n", stats->discoveredChecks);
+  printf("Double checks: %ld\n", stats->doubleChecks);
+  printf("Checkmates: %ld\n", stats->checkmates);
 }
 
-// Recursively search the tree (for non-root levels)
-static long treeSearch(LookupTable l, ChessBoard *cb, int depth)
+// Count the perft of every packed board of a file, read in place from memory
+static int packedSearch(char *file, int depth, int replicate, int report)
 {
-  if (depth == 1) 
-    return ChessBoardCount(l, cb);
-  
-  MoveSet ms = MoveSetNew();
-  MoveSetFill(l, cb, &ms);
+  int fd = open(file, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+  {
+    fprintf(stderr, "Could not open file: %s\n", file);
+    if (fd >= 0)
+      close(fd);
+    return 1;
+  }
+  size_t n = st.st_size / sizeof(PackedBoard);
+  if (n == 0)
+  {
+    close(fd);
+    printf("Positions: 0\nNodes searched: 0\n");
+    return 0;
+  }
 
-  long nodes = 0;
-  if (depth == 2)
-    nodes += MoveSetMultiply(l, &ms);
+  // The mapping outlives the descriptor, so it's closed whether or not the file was mapped
+  const PackedBoard *pbs = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (pbs == MAP_FAILED)
+  {
+    fprintf(stderr, "Could not map file: %s\n", file);
+    return 1;
+  }
+  long *nodes = malloc(n * sizeof(long));
+  if (nodes == NULL)
+  {
+    fprintf(stderr, "Insufficient memory!\n");
+    munmap((void *)pbs, st.st_size);
+    return 1;
+  }
 
-  while (!MoveSetIsEmpty(&ms))
+  LookupTable l = newTable(replicate);
+  if (report)
+    MemoryReport(stderr);
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  long total = PackedBoardPerft(l, pbs, n, depth, nodes);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  // Invalid records were skipped rather than unpacked
+  size_t invalid = 0;
+  for (size_t i = 0; i < n; i++)
+    if (nodes[i] < 0)
+    {
+      fprintf(stderr, "Skipped invalid packed board: record %zu\n", i);
+      invalid++;
+    }
+  printf("Positions: %zu\nNodes searched: %ld\n", n - invalid, total);
+  fprintf(stderr, "Positions per second: %.0f\n", (seconds > 0) ? n / seconds : 0);
+  LookupTableFree(l);
+  free(nodes);
+  munmap((void *)pbs, st.st_size);
+  return invalid != 0;
+}
+
+// Pack the FEN at the start of every line of stdin into a file
+static int packFENs(char *file)
+{
+  FILE *out = fopen(file, "wb");
+  if (out == NULL)
   {
-    Move m = MoveSetPop(&ms);
-    ChessBoardPlayMove(cb, m);
-    nodes += treeSearch(l, cb, depth - 1);
-    ChessBoardUndoMove(cb, m);
+    fprintf(stderr, "Could not open file: %s\n", file);
+    return 1;
   }
 
-  return nodes;
+  char buffer[PACK_LINE_SIZE];
+  long n = 0;
+  while (fgets(buffer, sizeof(buffer), stdin))
+  {
+    if (buffer[strspn(buffer, " \t\r\n")] == '\0')
+      continue;
+    PackedBoard pb = PackedBoardFromFEN(buffer);
+    if (fwrite(&pb, sizeof(PackedBoard), 1, out) != 1)
+    {
+      fprintf(stderr, "Failed to write to file: %s\n", file);
+      fclose(out);
+      return 1;
+    }
+    n++;
+  }
+  fclose(out);
+  fprintf(stderr, "Packed %ld positions\n", n);
+  return 0;
 }
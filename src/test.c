@@ -2,77 +2,412 @@
 #include "LookupTable.h"
 #include "ChessBoard.h"
 #include "MoveSet.h"
+#include "PositionSet.h"
+#include "Estimator.h"
+#include "TransTable.h"
+#include "PackedBoard.h"
+#include "Game.h"
+#include "Perft.h"
+#include "TempleChess.h"
+#include "Server.h"
+#include "Memory.h"
+#include "Frontier.h"
+#include "Batch.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
-#define POSITIONS "data/testPositions.in"
+#define POSITIONS "data/perftSuite.epd"
 #define BUFFER_SIZE 128
-#define NUM_TESTS 3
+#define LINE_SIZE 512
+#define MAX_POSITIONS 1024
+#define MAX_DEPTH 16     // Deeper than any depth of a position
+#define QUICK_DEPTH 3    // Deepest depth of the quick tier
+#define MEDIUM_DEPTH 5   // Deepest depth of the medium tier, the full tier has none
+#define NUM_TESTS 26
+#define HASH_DEPTH 3
+#define STATS_DEPTH 3
+#define ESTIMATE_ERROR 0.02 // Relative error an estimate samples down to
+#define ESTIMATE_WIDTHS 5     // Half-widths an estimate may be off by
+#define TABLE_BYTES (1 << 16)  // Small enough for entries to be replaced
+#define PICK_DEPTH 2
+#define GAMES 8
+#define GAME_PLIES 400
+#define LIBRARY_DEPTH 3
+#define SERVER_SOCKET "test%d.sock" // One per test process
+#define SERVER_DEPTH 3
+#define SERVER_IDLE 100 // Milliseconds before the server closes an idle connection
+#define STATUS_DEPTH 3
+#define STAGE_DEPTH 2
+#define FILTER_DEPTH 2
+#define MOBILITY_DEPTH 2
+#define MEMORY_DEPTH 3
+#define EVASION_DEPTH 4
+#define MATERIAL_DEPTH 4
+#define FRONTIER_DEPTH 4
+#define FRONTIER_BYTES (1 << 12) // Small enough for the frontier to be spilled
+#define FRONTIER_ROOM (1 << 24)  // Large enough for it to stay in memory
+#define LEGAL_GAMES 2
+#define LEGAL_PLIES 32
+#define EVERY_DEPTH 4
+#define BATCH_DEPTH 3
+#define BATCH_THREADS 2
 
 typedef int (*TestFunction)(LookupTable, ChessBoard *, int, long);
+typedef int (*TreeCheck)(LookupTable, ChessBoard *, int); // Whether every board of a tree passes
+
+/*
+ * A position of the suite, along with its perft at each depth, 0 if unknown
+ */
+typedef struct
+{
+  char fen[BUFFER_SIZE];
+  long nodes[MAX_DEPTH];
+  int depth; // Depth it's tested at
+} Position;
+
+typedef enum
+{
+  Passed,
+  Failed,
+  TimedOut,
+  Crashed
+} Result;
+
+/*
+ * A test run on a position by a child process, whose output is kept until it's reported
+ */
+typedef struct
+{
+  int test;
+  Position *position;
+  pid_t pid;
+  FILE *out;
+  struct timespec start;
+  double seconds;
+  int done;
+  Result result;
+} Item;
+
+// Socket path of the server a test runs, unique to its process
+static char serverPath[BUFFER_SIZE];
+
+static int readPositions(FILE *file, Position *positions, int maxDepth);
+static void startItem(LookupTable l, Item *item, TestFunction *testFns, int budget);
+static void finishItem(Item *item, int status);
+static int reportItem(Item *item, int budget);
+static double elapsed(struct timespec *start);
 
 static long treeSearch(LookupTable l, ChessBoard *cb, TestFunction t, int depth);
+static int capDepth(LookupTable l, ChessBoard *cb, int depth, long nodes, int max, long *expected);
+static int checkTree(LookupTable l, ChessBoard *cb, int depth, int max, TreeCheck check, const char *failure);
 static int testChessBoardCount(LookupTable l, ChessBoard *cb, int depth, long nodes);
 static int testMoveSetCount(LookupTable l, ChessBoard *cb, int depth, long nodes);
 static int testMoveSetMultiply(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int testMoveSetMultiplyDepth3(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int testIncremental(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static long incrementalSearch(LookupTable l, ChessBoard *cb, int depth);
+static int testChessBoardAnalyze(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int testPositionSet(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int hashSearch(LookupTable l, ChessBoard *cb, PositionSet large, PositionSet small, int depth);
+static int testStats(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static void bruteStatsSearch(LookupTable l, ChessBoard *cb, int depth, Stats *stats);
+static int testEstimator(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int testSymmetry(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int testPackedBoard(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int testMoveSetPick(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int pickSearch(LookupTable l, ChessBoard *cb, int depth);
+static int testGame(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int testTempleChess(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int testServer(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static void *runServer(void *arg);
+static int connectServer(struct sockaddr_un *address);
+static int checkDivide(LookupTable l, ChessBoard *cb, const char *answer, long nodes);
+static int testStatus(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int statusSearch(LookupTable l, ChessBoard *cb, int depth);
+static int testMoveSetStage(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int stageSearch(LookupTable l, ChessBoard *cb, int depth);
+static int testFilters(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int filterSearch(LookupTable l, ChessBoard *cb, int depth);
+static int passesFilter(LookupTable l, ChessBoard *cb, Move m, Filter f);
+static int testMobility(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int mobilityBatch(LookupTable l, ChessBoard *cb, int depth);
+static int mobilitySearch(LookupTable l, ChessBoard *cb, int depth);
+static int checkMobility(LookupTable l, ChessBoard *cb, Mobility *m);
+static int testMemory(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int checkRegion(size_t bytes, int node);
+static int testEvasions(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int evasionSearch(LookupTable l, ChessBoard *cb, int depth);
+static int testMaterial(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int materialSearch(LookupTable l, ChessBoard *cb, int depth);
+static int checkMaterial(ChessBoard *cb);
+static int testFrontier(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int testIsLegal(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int checkIsLegal(LookupTable l, ChessBoard *cb, int *filled);
+static int testEvery(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int testBatch(LookupTable l, ChessBoard *cb, int depth, long nodes);
+static int isLegal(LookupTable l, ChessBoard *cb, Move m);
+static int compareMoves(const void *a, const void *b);
 
-int main()
+int main(int argc, char **argv)
 {
-  FILE *file = fopen(POSITIONS, "r");
-  if (file == NULL)
+  int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN), maxDepth = MAX_DEPTH, budget = 0;
+  char *only = NULL, *tier = "full";
+  int opt;
+  while ((opt = getopt(argc, argv, "j:t:b:k:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'j':
+      jobs = atoi(optarg);
+      break;
+    case 't':
+      tier = optarg;
+      break;
+    case 'b':
+      budget = atoi(optarg);
+      break;
+    case 'k':
+      only = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-j jobs] [-t quick|medium|full] [-b seconds] [-k test] [positions]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (!strcmp(tier, "quick"))
+    maxDepth = QUICK_DEPTH;
+  else if (!strcmp(tier, "medium"))
+    maxDepth = MEDIUM_DEPTH;
+  else if (strcmp(tier, "full"))
   {
-    fprintf(stderr, "Could not open file: %s\n", POSITIONS);
+    fprintf(stderr, "Unknown tier: %s\n", tier);
     return 1;
   }
+  jobs = (jobs > 0) ? jobs : 1;
 
-  char buffer[BUFFER_SIZE];
-  int depth;
-  long nodes;
-  char *fen;
-  LookupTable l = LookupTableNew();
+  const char *path = (optind < argc) ? argv[optind] : POSITIONS;
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+  {
+    fprintf(stderr, "Could not open file: %s\n", path);
+    return 1;
+  }
+  Position *positions = malloc(MAX_POSITIONS * sizeof(Position));
+  int numPositions = readPositions(file, positions, maxDepth);
+  fclose(file);
 
-  TestFunction testFns[NUM_TESTS] = {testChessBoardCount, testMoveSetCount, testMoveSetMultiply};
-  const char *testNames[NUM_TESTS] = {"ChessBoardCount", "MoveSetCount", "MoveSetMultiply"};
+  TestFunction testFns[NUM_TESTS] = {testChessBoardCount, testMoveSetCount, testMoveSetMultiply, testIncremental,
+                                    testChessBoardAnalyze, testMoveSetMultiplyDepth3, testPositionSet, testStats,
+                                    testEstimator, testSymmetry, testPackedBoard,
+                                    testMoveSetPick, testGame, testTempleChess, testServer,
+                                    testStatus, testMoveSetStage, testFilters, testMobility, testMemory,
+                                    testEvasions, testMaterial, testFrontier, testIsLegal,
+                                    testEvery, testBatch};
+  const char *testNames[NUM_TESTS] = {"ChessBoardCount", "MoveSetCount", "MoveSetMultiply", "Incremental",
+                                      "ChessBoardAnalyze", "MoveSetMultiplyDepth3", "PositionSet", "Stats",
+                                      "Estimator", "Symmetry", "PackedBoard",
+                                      "MoveSetPick", "Game", "TempleChess", "Server",
+                                      "Status", "MoveSetStage", "Filters", "Mobility", "Memory",
+                                      "Evasions", "Material", "Frontier", "IsLegal",
+                                      "Every", "Batch"};
 
+  // One item per test and position, in the order they're reported
+  Item *items = malloc(NUM_TESTS * numPositions * sizeof(Item));
+  int numItems = 0;
   for (int i = 0; i < NUM_TESTS; i++)
+    for (int j = 0; j < numPositions && (!only || !strcmp(only, testNames[i])); j++)
+      items[numItems++] = (Item){.test = i, .position = &positions[j]};
+
+  LookupTable l = LookupTableNew();
+  if (l == NULL)
+  {
+    fprintf(stderr, "Insufficient memory!\n");
+    return 1;
+  }
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // Each item runs in a child of its own, at most jobs at a time, and is reported once
+  // every item before it has been
+  int next = 0, running = 0, reported = 0, passed = 0;
+  while (reported < numItems)
   {
-    printf("\n\033[1;34m============== Running Test: %s ==============\033[0m\n", testNames[i]);
-    while (fgets(buffer, sizeof(buffer), file))
+    while (running < jobs && next < numItems)
     {
-      buffer[strcspn(buffer, "\n")] = 0;
+      startItem(l, &items[next++], testFns, budget);
+      running++;
+    }
 
-      char *ptr = buffer;
-      while (*ptr != '\0' && isspace((unsigned char)*ptr))
-        ptr++;
-      if (*ptr == '\0')
-        continue;
+    int status;
+    pid_t pid = wait(&status);
+    for (int i = 0; i < next; i++)
+      if (items[i].pid == pid && !items[i].done)
+        finishItem(&items[i], status);
+    running--;
 
-      char *lastSpace = strrchr(buffer, ' ');
+    for (; reported < next && items[reported].done; reported++)
+    {
+      Item *item = &items[reported];
+      if (reported == 0 || items[reported - 1].test != item->test)
+        printf("\n\033[1;34m============== Running Test: %s ==============\033[0m\n", testNames[item->test]);
+      passed += reportItem(item, budget);
+    }
+    fflush(stdout);
+  }
+
+  // Summary of the failures, by test and position
+  printf("\n%d passed, %d failed in %.1fs (%s tier, %d jobs)\n", passed, numItems - passed,
+         elapsed(&start), tier, jobs);
+  for (int i = 0; i < numItems; i++)
+  {
+    Item *item = &items[i];
+    if (item->result != Passed)
+      printf("  %s %s: %s at depth %d\n", (item->result == TimedOut) ? "TIMED OUT" :
+             (item->result == Crashed) ? "CRASHED" : "FAILED", testNames[item->test],
+             item->position->fen, item->position->depth);
+  }
+
+  LookupTableFree(l);
+  free(items);
+  free(positions);
+  return passed != numItems;
+}
 
+// Reads positions either as a FEN followed by its perft at each depth (;D1 20 ;D2 400 ...),
+// or as a FEN followed by a depth and its perft. Each position is tested at its deepest known
+// depth no deeper than maxDepth, positions without one are skipped.
+static int readPositions(FILE *file, Position *positions, int maxDepth)
+{
+  char buffer[LINE_SIZE];
+  int n = 0;
+  while (n < MAX_POSITIONS && fgets(buffer, sizeof(buffer), file))
+  {
+    buffer[strcspn(buffer, "\n")] = 0;
+    char *ptr = buffer;
+    while (*ptr != '\0' && isspace((unsigned char)*ptr))
+      ptr++;
+    if (*ptr == '\0' || *ptr == '#')
+      continue;
+
+    Position *p = &positions[n];
+    memset(p->nodes, 0, sizeof(p->nodes));
+    int depth;
+    long nodes;
+    char *fields = strchr(buffer, ';');
+    if (fields)
+    {
+      *fields = '\0';
+      for (char *f = fields + 1; f; f = strchr(f, ';'))
+      {
+        if (*f == ';')
+          f++;
+        if (sscanf(f, " D%d %ld", &depth, &nodes) == 2 && depth > 0 && depth < MAX_DEPTH)
+          p->nodes[depth] = nodes;
+      }
+    }
+    else
+    {
+      char *lastSpace = strrchr(buffer, ' ');
       sscanf(lastSpace, " %ld", &nodes);
       *lastSpace = '\0';
-
       lastSpace = strrchr(buffer, ' ');
       sscanf(lastSpace, " %d", &depth);
       *lastSpace = '\0';
+      if (depth > 0 && depth < MAX_DEPTH)
+        p->nodes[depth] = nodes;
+    }
 
-      fen = buffer;
-
-      ChessBoard cb = ChessBoardNew(fen);
+    // Trailing spaces aren't part of the FEN
+    size_t length = strlen(buffer);
+    while (length > 0 && isspace((unsigned char)buffer[length - 1]))
+      buffer[--length] = '\0';
+    snprintf(p->fen, sizeof(p->fen), "%s", buffer);
 
-      // Call the appropriate test function
-      int result = testFns[i](l, &cb, depth, nodes);
+    p->depth = 0;
+    for (int d = 1; d <= maxDepth && d < MAX_DEPTH; d++)
+      if (p->nodes[d])
+        p->depth = d;
+    n += (p->depth > 0);
+  }
+  return n;
+}
 
-      if (result)
-        printf("\033[0;32mTest PASSED: %s at depth %d\033[0m\n", fen, depth);
-    }
-    rewind(file);
+// Forks the child running an item, its output and errors go to a temporary file until it's
+// reported, so errors a test expects stay with it
+static void startItem(LookupTable l, Item *item, TestFunction *testFns, int budget)
+{
+  item->out = tmpfile();
+  clock_gettime(CLOCK_MONOTONIC, &item->start);
+  fflush(stdout);
+  fflush(stderr);
+  item->pid = fork();
+  if (item->pid == 0)
+  {
+    dup2(fileno(item->out), STDOUT_FILENO);
+    dup2(fileno(item->out), STDERR_FILENO);
+    alarm(budget);
+    Position *p = item->position;
+    ChessBoard cb = ChessBoardNew(p->fen);
+    int result = testFns[item->test](l, &cb, p->depth, p->nodes[p->depth]);
+    fflush(stdout);
+    _exit(result ? EXIT_SUCCESS : EXIT_FAILURE);
   }
-  LookupTableFree(l);
-  fclose(file);
-  return 0;
+  if (item->pid < 0)
+  {
+    fprintf(stderr, "Could not fork a test\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Records how the child of an item ended, and removes the socket a server test may have left
+static void finishItem(Item *item, int status)
+{
+  item->seconds = elapsed(&item->start);
+  item->done = 1;
+  if (WIFEXITED(status))
+    item->result = (WEXITSTATUS(status) == EXIT_SUCCESS) ? Passed : Failed;
+  else
+    item->result = (WTERMSIG(status) == SIGALRM) ? TimedOut : Crashed;
+
+  char path[BUFFER_SIZE];
+  snprintf(path, sizeof(path), SERVER_SOCKET, (int)item->pid);
+  unlink(path);
+}
+
+// Prints the output of an item followed by its result, returns whether it passed
+static int reportItem(Item *item, int budget)
+{
+  char buffer[LINE_SIZE];
+  rewind(item->out);
+  while (fgets(buffer, sizeof(buffer), item->out))
+    fputs(buffer, stdout);
+  fclose(item->out);
+
+  Position *p = item->position;
+  if (item->result == Passed)
+    printf("\033[0;32mTest PASSED: %s at depth %d (%.2fs)\033[0m\n", p->fen, p->depth, item->seconds);
+  else if (item->result == TimedOut)
+    printf("\033[0;31mTest FAILED: %s at depth %d, over its budget of %ds\033[0m\n", p->fen, p->depth, budget);
+  else if (item->result == Crashed)
+    printf("\033[0;31mTest FAILED: %s at depth %d, crashed\033[0m\n", p->fen, p->depth);
+  return item->result == Passed;
+}
+
+static double elapsed(struct timespec *start)
+{
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
 }
 
 static long treeSearch(LookupTable l, ChessBoard *cb, TestFunction t, int depth)
@@ -89,7 +424,21 @@ static long treeSearch(LookupTable l, ChessBoard *cb, TestFunction t, int depth)
   }
 
   if ((depth == 2) && (t == testMoveSetMultiply))
-    nodes += MoveSetMultiply(l, &ms);
+  {
+    AnalysisCache ac;
+    nodes += MoveSetMultiply(l, &ms, &ac);
+    while (!MoveSetIsEmpty(&ms))
+    {
+      Move m = MoveSetPop(&ms);
+      ChessBoardPlayMove(cb, m);
+      nodes += ChessBoardCountCached(l, cb, &ac, m);
+      ChessBoardUndoMove(cb, m);
+    }
+    return nodes;
+  }
+
+  if ((depth == 3) && (t == testMoveSetMultiplyDepth3))
+    nodes += MoveSetMultiplyDepth3(l, &ms);
 
   while (!MoveSetIsEmpty(&ms))
   {
@@ -102,6 +451,31 @@ static long treeSearch(LookupTable l, ChessBoard *cb, TestFunction t, int depth)
   return nodes;
 }
 
+// Caps the depth of a test and returns it, with the paths of that depth in expected unless
+// it's NULL: the count the position came with if the depth wasn't capped, searched otherwise
+static int capDepth(LookupTable l, ChessBoard *cb, int depth, long nodes, int max, long *expected)
+{
+  int d = (depth < max) ? depth : max;
+  if (expected != NULL)
+    *expected = (d == depth) ? nodes : treeSearch(l, cb, testChessBoardCount, d);
+  return d;
+}
+
+// Runs a check over the tree of a board to the capped depth of a test, and reports the board
+// along with what differed if it fails
+static int checkTree(LookupTable l, ChessBoard *cb, int depth, int max, TreeCheck check, const char *failure)
+{
+  int d = capDepth(l, cb, depth, 0, max, NULL);
+  if (!check(l, cb, d))
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), d);
+    if (failure != NULL)
+      printf("%s\n", failure);
+    return 0; // Failure
+  }
+  return 1; // Success
+}
+
 static int testChessBoardCount(LookupTable l, ChessBoard *cb, int depth, long nodes) {
   long result = treeSearch(l, cb, testChessBoardCount, depth);
 
@@ -140,7 +514,7 @@ static int testMoveSetCount(LookupTable l, ChessBoard *cb, int depth, long nodes
 static int testMoveSetMultiply(LookupTable l, ChessBoard *cb, int depth, long nodes)
 {
   (void)nodes;
-  if (depth == 1)
+  if (depth <= 1)
     return 1; // Success
   long count = treeSearch(l, cb, testMoveSetCount, 2);
   long multiply = treeSearch(l, cb, testMoveSetMultiply, 2);
@@ -166,4 +540,1102 @@ static int testMoveSetMultiply(LookupTable l, ChessBoard *cb, int depth, long no
   }
 
   return 1; // Success
-}
\ No newline at end of file
+}
+
+// Traverses the tree and at each node compares MoveSetCount to MoveSetMultiplyDepth3
+// If they're not equal, print the chessboard that failed, assume depth > 2
+static int testMoveSetMultiplyDepth3(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  (void)nodes;
+  if (depth <= 2)
+    return 1; // Success
+  long count = treeSearch(l, cb, testMoveSetCount, 3);
+  long multiply = treeSearch(l, cb, testMoveSetMultiplyDepth3, 3);
+
+  if (count != multiply)
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), depth);
+    printf("Expected: %ld, got: %ld\n", count, multiply);
+    return 0; // Failure
+  }
+
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+
+  while (!MoveSetIsEmpty(&ms))
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, m);
+    int ok = testMoveSetMultiplyDepth3(l, cb, depth - 1, nodes);
+    ChessBoardUndoMove(cb, m);
+    if (!ok)
+      return 0; // Failure
+  }
+
+  return 1; // Success
+}
+
+// Counts the nodes with incremental attacks, the attacks, checks and pins
+// must match the from-scratch functions at every node
+static int testIncremental(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  AttackStack as;
+  ChessBoardTrack(l, cb, &as);
+  long result = incrementalSearch(l, cb, depth);
+  ChessBoardTrack(l, cb, NULL);
+
+  if (result != nodes)
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), depth);
+    printf("Expected: %ld, got: %ld\n", nodes, result);
+    return 0; // Failure
+  }
+  return 1; // Success
+}
+
+// Returns -1 if the incremental attacks differ from the from-scratch ones
+static long incrementalSearch(LookupTable l, ChessBoard *cb, int depth)
+{
+  ChessBoard scratch = *cb;
+  ChessBoardTrack(l, &scratch, NULL);
+  BitBoard checking1, pinned1, checking2, pinned2;
+  ChessBoardCheckingAndPinned(l, cb, &checking1, &pinned1);
+  ChessBoardCheckingAndPinned(l, &scratch, &checking2, &pinned2);
+  if ((ChessBoardAttacked(l, cb) != ChessBoardAttacked(l, &scratch)) ||
+      (checking1 != checking2) || (pinned1 != pinned2))
+  {
+    printf("Attacks differ from scratch: %s\n", ChessBoardToFEN(cb));
+    return -1;
+  }
+
+  if (depth == 1)
+    return ChessBoardCount(l, cb);
+
+  long nodes = 0;
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  while (!MoveSetIsEmpty(&ms))
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, m);
+    long subTree = incrementalSearch(l, cb, depth - 1);
+    ChessBoardUndoMove(cb, m);
+    if (subTree < 0)
+      return -1;
+    nodes += subTree;
+  }
+
+  return nodes;
+}
+
+// Traverses the tree and at each node compares the fused analysis to the separate
+// attacked, checking and pinned functions, assume depth > 1
+static int testChessBoardAnalyze(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  Analysis a;
+  BitBoard checking, pinned;
+  ChessBoardAnalyze(l, cb, &a);
+  ChessBoardCheckingAndPinned(l, cb, &checking, &pinned);
+
+  if ((a.attacked != ChessBoardAttacked(l, cb)) || (a.checking != checking) || (a.pinned != pinned))
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), depth);
+    return 0; // Failure
+  }
+  if (depth == 1)
+    return 1; // Success
+
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+
+  while (!MoveSetIsEmpty(&ms))
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, m);
+    int ok = testChessBoardAnalyze(l, cb, depth - 1, nodes);
+    ChessBoardUndoMove(cb, m);
+    if (!ok)
+      return 0; // Failure
+  }
+
+  return 1; // Success
+}
+
+// Adds the positions at a shallow depth to a set that fits in memory and to one that
+// has to spill to disk, the sets must agree on the number of unique positions
+static int testPositionSet(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  PositionSet large = PositionSetNew(1 << 24);
+  PositionSet small = PositionSetNew(0);
+  int d = capDepth(l, cb, depth, nodes, HASH_DEPTH, NULL);
+  int ok = hashSearch(l, cb, large, small, d);
+  long expected = PositionSetCount(large);
+  long result = PositionSetCount(small);
+  PositionSetFree(large);
+  PositionSetFree(small);
+
+  if (!ok || (result != expected))
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), d);
+    printf("Expected: %ld, got: %ld\n", expected, result);
+    return 0; // Failure
+  }
+  return 1; // Success
+}
+
+// Returns 0 if the hash of a position differs from the hash of a copy made from its FEN
+static int hashSearch(LookupTable l, ChessBoard *cb, PositionSet large, PositionSet small, int depth)
+{
+  ChessBoard copy = ChessBoardNew(ChessBoardToFEN(cb));
+  if (ChessBoardHash(l, cb) != ChessBoardHash(l, &copy))
+  {
+    printf("Hash differs from its FEN: %s\n", ChessBoardToFEN(cb));
+    return 0;
+  }
+
+  if (depth == 0)
+  {
+    PositionSetAdd(large, ChessBoardHash(l, cb));
+    PositionSetAdd(small, ChessBoardHash(l, cb));
+    return 1;
+  }
+
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  while (!MoveSetIsEmpty(&ms))
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, m);
+    int ok = hashSearch(l, cb, large, small, depth - 1);
+    ChessBoardUndoMove(cb, m);
+    if (!ok)
+      return 0;
+  }
+  return 1;
+}
+
+static int testStats(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  long paths;
+  int d = capDepth(l, cb, depth, nodes, STATS_DEPTH, &paths);
+  Stats expected = {0}, result = {0};
+  bruteStatsSearch(l, cb, d, &expected);
+  PerftStats(l, cb, d, &result);
+
+  if (result.nodes != paths || memcmp(&expected, &result, sizeof(Stats)))
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), d);
+    printf("Expected: %ld nodes %ld captures %ld en passant %ld castles %ld promotions "
+           "%ld checks %ld discovered %ld double %ld checkmates\n",
+           expected.nodes, expected.captures, expected.enPassant, expected.castles, expected.promotions,
+           expected.checks, expected.discoveredChecks, expected.doubleChecks, expected.checkmates);
+    printf("Got:      %ld nodes %ld captures %ld en passant %ld castles %ld promotions "
+           "%ld checks %ld discovered %ld double %ld checkmates\n",
+           result.nodes, result.captures, result.enPassant, result.castles, result.promotions,
+           result.checks, result.discoveredChecks, result.doubleChecks, result.checkmates);
+    return 0; // Failure
+  }
+  return 1; // Success
+}
+
+// Breakdown by playing every move of the last ply and classifying the position it reaches
+static void bruteStatsSearch(LookupTable l, ChessBoard *cb, int depth, Stats *stats)
+{
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+
+  while (!MoveSetIsEmpty(&ms))
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, m);
+    if (depth > 1)
+    {
+      bruteStatsSearch(l, cb, depth - 1, stats);
+      ChessBoardUndoMove(cb, m);
+      continue;
+    }
+
+    int castle = (m.from.type == King) && abs(m.to.square - m.from.square) == 2;
+    stats->nodes++;
+    stats->captures   += (m.captured.type != Empty);
+    stats->enPassant  += (m.from.type == Pawn) && (m.to.square == m.enPassant);
+    stats->castles    += castle;
+    stats->promotions += (m.from.type != m.to.type);
+
+    Analysis a;
+    ChessBoardAnalyze(l, cb, &a);
+    int checkers = BitBoardCount(a.checking);
+    if (checkers)
+    {
+      BitBoard moved = BitBoardAdd(EMPTY_BOARD, m.to.square);
+      if (castle)
+        moved = BitBoardAdd(moved, (m.from.square + m.to.square) / 2);
+      stats->checks++;
+      stats->discoveredChecks += (checkers == 1) && !(a.checking & moved);
+      stats->doubleChecks     += (checkers == 2);
+      stats->checkmates       += (ChessBoardCount(l, cb) == 0);
+    }
+    ChessBoardUndoMove(cb, m);
+  }
+}
+
+static int testEstimator(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  // Fully expanding all but the last ply is exact
+  long expected;
+  int d = capDepth(l, cb, depth, nodes, STATS_DEPTH, &expected);
+  EstimateOptions exact = {.depth = d, .expand = d - 1, .threads = 1};
+  Estimate e = EstimatorRun(l, cb, &exact);
+  if ((long)e.nodes != expected || e.halfWidth != 0)
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), d);
+    printf("Expected: %ld, got: %.0f +/- %.0f\n", expected, e.nodes, e.halfWidth);
+    return 0; // Failure
+  }
+
+  // Sampling from the root with a few threads stays within its confidence interval
+  EstimateOptions sampled = {.depth = depth, .error = ESTIMATE_ERROR, .threads = 2, .seed = depth};
+  e = EstimatorRun(l, cb, &sampled);
+  if (fabs(e.nodes - nodes) > ESTIMATE_WIDTHS * e.halfWidth)
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), depth);
+    printf("Expected: %ld, got: %.0f +/- %.0f\n", nodes, e.nodes, e.halfWidth);
+    return 0; // Failure
+  }
+  return 1; // Success
+}
+
+static int testSymmetry(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  // Swapping colors, and mirroring without castling rights, keeps the perft and canonical hash
+  long expected;
+  int d = capDepth(l, cb, depth, nodes, STATS_DEPTH, &expected);
+  uint64_t hash = ChessBoardCanonicalHash(l, cb);
+  ChessBoard swapped = ChessBoardSwapColors(cb);
+  ChessBoard back = ChessBoardSwapColors(&swapped);
+  ChessBoard mirrored = ChessBoardMirror(cb);
+  int mirror = !ChessBoardHasCastling(cb);
+  int ok = ChessBoardEqual(cb, &back) &&
+           (treeSearch(l, &swapped, testChessBoardCount, d) == expected) &&
+           (ChessBoardCanonicalHash(l, &swapped) == hash) &&
+           (!mirror || treeSearch(l, &mirrored, testChessBoardCount, d) == expected) &&
+           (!mirror || ChessBoardCanonicalHash(l, &mirrored) == hash);
+  if (!ok)
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), d);
+    printf("Swapped: %s, mirrored: %s\n", ChessBoardToFEN(&swapped), ChessBoardToFEN(&mirrored));
+    return 0; // Failure
+  }
+
+  // Looking up subtrees by canonical hash, in a table small enough to replace entries
+  TransTable tt = TransTableNew(TABLE_BYTES, MEMORY_INTERLEAVED);
+  long result = PerftHashed(l, cb, depth, tt);
+  if (result != nodes)
+  {
+    TransTableFree(tt);
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), depth);
+    printf("Expected: %ld, got: %ld\n", nodes, result);
+    return 0; // Failure
+  }
+
+  // Dividing, with mirrored boards reusing the subtree of the first, with and without the table
+  Move moves[MAX_MOVES], hashedMoves[MAX_MOVES];
+  long subTrees[MAX_MOVES], hashedTrees[MAX_MOVES];
+  int n = PerftDivide(l, cb, d, NULL, moves, subTrees);
+  ok = (n == ChessBoardCount(l, cb)) && (PerftDivide(l, cb, d, tt, hashedMoves, hashedTrees) == n);
+  for (int i = 0; i < n && ok; i++)
+  {
+    ChessBoardPlayMove(cb, moves[i]);
+    ok = (subTrees[i] == PerftCount(l, cb, d - 1)) && (hashedTrees[i] == subTrees[i]) &&
+         !compareMoves(&moves[i], &hashedMoves[i]);
+    ChessBoardUndoMove(cb, moves[i]);
+    expected -= subTrees[i];
+  }
+  TransTableFree(tt);
+  if (!ok || expected != 0)
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), d);
+    printf("Divided subtrees differ from the perft of each move\n");
+    return 0; // Failure
+  }
+  return 1; // Success
+}
+
+static int testPackedBoard(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  // A board unpacks to itself, from the board or from its FEN
+  PackedBoard pb = PackedBoardPack(cb);
+  ChessBoard unpacked = PackedBoardUnpack(&pb);
+  PackedBoard fromFEN = PackedBoardFromFEN(ChessBoardToFEN(cb));
+  int ok = ChessBoardEqual(cb, &unpacked) && !memcmp(&pb, &fromFEN, sizeof(PackedBoard));
+  for (Square s = 0; s < BOARD_SIZE; s++)
+    ok = ok && (ChessBoardSquare(cb, s) == ChessBoardSquare(&unpacked, s));
+  if (!ok)
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), depth);
+    char fen[FEN_SIZE];
+    printf("Unpacked: %s\n", PackedBoardToFEN(&pb, fen));
+    return 0; // Failure
+  }
+
+  // Counting an array of packed boards, each the same board
+  PackedBoard pbs[2] = {pb, fromFEN};
+  long counts[2], expected;
+  int d = capDepth(l, cb, depth, nodes, STATS_DEPTH, &expected);
+  long result = PackedBoardPerft(l, pbs, 2, d, counts);
+  if (result != 2 * expected || counts[0] != expected || counts[1] != expected)
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), d);
+    printf("Expected: %ld, got: %ld and %ld\n", expected, counts[0], counts[1]);
+    return 0; // Failure
+  }
+
+  // A record that can't be unpacked safely is skipped: too many pieces, a type past the last,
+  // a reserved bit, a missing king or the side not to move in check
+  PackedBoard bad[5] = {pb, pb, pb, pb, PackedBoardFromFEN("4k3/8/8/8/8/8/8/4RK2 w - - 0 1")};
+  bad[0].occupancy = ~EMPTY_BOARD;
+  bad[1].pieces[0] |= 0x7;
+  bad[2].reserved[4] = 1;
+  BitBoard pieces = pb.occupancy;
+  for (int i = 0; pieces; i++)
+    if (BitBoardPop(&pieces) == BitBoardPeek(ChessBoardOur(cb, King)))
+      bad[3].pieces[i / 2] += (Queen - King) << (4 * (i % 2));
+  long skipped[5];
+  ok = PackedBoardValid(l, &pb) && PackedBoardPerft(l, bad, 5, d, skipped) == 0;
+  for (int i = 0; i < 5 && ok; i++)
+    ok = !PackedBoardValid(l, &bad[i]) && skipped[i] == -1;
+  if (!ok)
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), d);
+    printf("Invalid packed boards weren't rejected\n");
+    return 0; // Failure
+  }
+  return 1; // Success
+}
+
+static int testMoveSetPick(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  (void)nodes;
+  return checkTree(l, cb, depth, PICK_DEPTH, pickSearch, "Picked moves differ from popped moves");
+}
+
+// Whether picking every index of each move set yields the same moves as popping them
+static int pickSearch(LookupTable l, ChessBoard *cb, int depth)
+{
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  int n = MoveSetCount(&ms);
+  Move picked[MAX_MOVES], popped[MAX_MOVES];
+  for (int i = 0; i < n; i++)
+    picked[i] = MoveSetPick(&ms, i);
+  for (int i = 0; i < n; i++)
+    popped[i] = MoveSetPop(&ms);
+  qsort(picked, n, sizeof(Move), compareMoves);
+  qsort(popped, n, sizeof(Move), compareMoves);
+
+  int ok = 1;
+  for (int i = 0; i < n && ok; i++)
+    ok = !compareMoves(&picked[i], &popped[i]) && picked[i].captured.type == popped[i].captured.type &&
+         picked[i].captured.square == popped[i].captured.square && picked[i].from.type == popped[i].from.type;
+  for (int i = 0; i < n && ok && depth > 1; i++)
+  {
+    ChessBoardPlayMove(cb, popped[i]);
+    ok = pickSearch(l, cb, depth - 1);
+    ChessBoardUndoMove(cb, popped[i]);
+  }
+  return ok;
+}
+
+static int testGame(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  (void)nodes;
+  Game *g = malloc(sizeof(Game));
+  int ok = 1;
+  for (int i = 0; i < GAMES && ok; i++)
+  {
+    // Every move is legal, and the game ends as it says
+    GamePlayRandom(l, cb, GAME_PLIES, i, g);
+    ChessBoard board = g->start;
+    for (int j = 0; j < g->plies && ok; j++)
+    {
+      ok = isLegal(l, &board, g->moves[j]);
+      ChessBoardPlayMove(&board, g->moves[j]);
+    }
+
+    Analysis a;
+    ChessBoardAnalyze(l, &board, &a);
+    int moves = ChessBoardCount(l, &board);
+    ok = ok && (g->turn == ChessBoardColor(&board));
+    ok = ok && ((g->ending == Checkmate) == (moves == 0 && a.checking != EMPTY_BOARD));
+    ok = ok && ((g->ending == Stalemate) == (moves == 0 && a.checking == EMPTY_BOARD));
+    ok = ok && (g->ending != Unfinished || g->plies == GAME_PLIES);
+    if (!ok)
+      printf("Game %d ended with %s after %d plies: %s\n", i, GameEnding(g), g->plies, ChessBoardToFEN(&board));
+  }
+  free(g);
+
+  if (!ok)
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), depth);
+    return 0; // Failure
+  }
+  return 1; // Success
+}
+
+static int isLegal(LookupTable l, ChessBoard *cb, Move m)
+{
+  StagedMoveSet sms;
+  Move legal;
+  MoveSetStage(l, cb, &sms);
+  while (MoveSetNext(&sms, &legal))
+    if (!compareMoves(&m, &legal))
+      return 1;
+  return 0;
+}
+
+static int compareMoves(const void *a, const void *b)
+{
+  const Move *m1 = a, *m2 = b;
+  int k1 = (m1->from.square << 16) | (m1->to.square << 8) | m1->to.type;
+  int k2 = (m2->from.square << 16) | (m2->to.square << 8) | m2->to.type;
+  return (k1 > k2) - (k1 < k2);
+}
+
+static int testTempleChess(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  char fen[FEN_SIZE];
+  ChessBoardWriteFEN(cb, fen);
+  long expected;
+  int d = capDepth(l, cb, depth, nodes, LIBRARY_DEPTH, &expected);
+
+  // The library counts the same paths and moves as the board it was given
+  char moves[TEMPLECHESS_MAX_MOVES][TEMPLECHESS_MOVE_SIZE];
+  char divided[TEMPLECHESS_MAX_MOVES][TEMPLECHESS_MOVE_SIZE];
+  long subTrees[TEMPLECHESS_MAX_MOVES];
+  int n = TempleChessMoves(fen, moves, TEMPLECHESS_MAX_MOVES);
+  int ok = (TempleChessInit() == 0) && (TempleChessPerft(fen, d) == expected) && (n == TempleChessCount(fen));
+  ok = ok && (n == ChessBoardCount(l, cb));
+
+  if (ok && d > 0)
+  {
+    ok = (TempleChessDivide(fen, d, divided, subTrees, TEMPLECHESS_MAX_MOVES) == n);
+    long sum = 0;
+    for (int i = 0; i < n && ok; i++)
+    {
+      ok = (strcmp(moves[i], divided[i]) == 0);
+      sum += subTrees[i];
+    }
+    ok = ok && (sum == expected);
+  }
+
+  // A FEN that isn't valid, kingless or with the side not to move in check, fails every call
+  const char *invalid[] = {"garbage", "8/8/8/8/8/8/8/8 w - - 0 1", "4k3/8/8/8/8/8/8/4RK2 w - - 0 1",
+                           "8/8/8/3kK3/8/8/8/8 b - - 0 1", "4k3/8/8/8/8/8/3p4/4K3 b - - 0 1",
+                           "4k3/8/8/8/8/3n4/8/4K3 b - - 0 1"};
+  for (int i = 0; i < (int)(sizeof(invalid) / sizeof(invalid[0])) && ok; i++)
+    ok = TempleChessPerft(invalid[i], 1) == -1 && TempleChessCount(invalid[i]) == -1 &&
+         TempleChessMoves(invalid[i], moves, TEMPLECHESS_MAX_MOVES) == -1 &&
+         TempleChessDivide(invalid[i], 1, divided, subTrees, TEMPLECHESS_MAX_MOVES) == -1;
+  ok = ok && (TempleChessCount("4k3/8/8/8/8/8/3p4/4K3 w - - 0 1") == 5);
+
+  if (!ok)
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", fen, d);
+    return 0; // Failure
+  }
+  return 1; // Success
+}
+
+static int testServer(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  // A file at the socket's path is left alone, while a socket left behind is replaced
+  ServerOptions o = {.threads = 1, .idleTimeout = SERVER_IDLE};
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  snprintf(serverPath, sizeof(serverPath), SERVER_SOCKET, (int)getpid());
+  snprintf(address.sun_path, sizeof(address.sun_path), SERVER_SOCKET, (int)getpid());
+  FILE *file = fopen(serverPath, "w");
+  int ok = file != NULL && !fclose(file) && ServerRun(l, serverPath, &o) != 0 && !unlink(serverPath);
+  int stale = socket(AF_UNIX, SOCK_STREAM, 0);
+  ok = ok && bind(stale, (struct sockaddr *)&address, sizeof(address)) == 0;
+  close(stale);
+
+  // The server's one thread serves the second client once the first is idle for too long
+  pthread_t id;
+  pthread_create(&id, NULL, runServer, l);
+  int idle = connectServer(&address);
+  FILE *in = fdopen(connectServer(&address), "r+");
+
+  // The server answers the same perft and divide as the board, and rejects an invalid FEN
+  char fen[FEN_SIZE], answer[BUFFER_SIZE * 64] = "";
+  ChessBoardWriteFEN(cb, fen);
+  long expected, served = -1;
+  int d = capDepth(l, cb, depth, nodes, SERVER_DEPTH, &expected);
+  fprintf(in, "perft depth=%d %s\n", d, fen);
+  fflush(in);
+  ok = ok && fgets(answer, sizeof(answer), in) && sscanf(answer, "ok nodes=%ld", &served) == 1;
+  ok = ok && served == expected;
+  close(idle);
+
+  fprintf(in, "divide depth=%d %s\nperft depth=1 8/8/8/8/8/8/8/8 w - - 0 1\n", d, fen);
+  fflush(in);
+  ok = ok && fgets(answer, sizeof(answer), in) && checkDivide(l, cb, answer, expected);
+  ok = ok && fgets(answer, sizeof(answer), in) && strcmp(answer, "error invalid fen\n") == 0;
+
+  // A search is cancelled, and another expires past its deadline, unless there's no move
+  int moves = ChessBoardCount(l, cb);
+  fprintf(in, "perft depth=%d %s\ncancel\nperft depth=%d deadline=1 %s\nstats\nshutdown\n", MAX_PLY, fen,
+          MAX_PLY, fen);
+  fflush(in);
+  const char *cancelled = moves ? "cancelled" : "ok nodes=0", *expired = moves ? "expired" : "ok nodes=0";
+  ok = ok && fgets(answer, sizeof(answer), in) && strncmp(answer, cancelled, strlen(cancelled)) == 0;
+  if (!moves)
+    ok = ok && fgets(answer, sizeof(answer), in) && strcmp(answer, "error nothing to cancel\n") == 0;
+  ok = ok && fgets(answer, sizeof(answer), in) && strncmp(answer, expired, strlen(expired)) == 0;
+
+  // Every request but the stats themselves is counted by how it ended
+  long requests = 0, completed = 0, expiredRequests = 0, cancelledRequests = 0, failed = 0;
+  ok = ok && fgets(answer, sizeof(answer), in) &&
+       sscanf(answer, "ok requests=%ld completed=%ld expired=%ld cancelled=%ld failed=%ld", &requests,
+              &completed, &expiredRequests, &cancelledRequests, &failed) == 5;
+  ok = ok && requests == 5 && failed == 1 && completed == (moves ? 2 : 4) &&
+       expiredRequests == (moves > 0) && cancelledRequests == (moves > 0);
+  ok = ok && fgets(answer, sizeof(answer), in) && strcmp(answer, "ok\n") == 0;
+  fclose(in);
+  pthread_join(id, NULL);
+
+  if (!ok)
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d, served %ld\033[0m\n", fen, d, served);
+    printf("Last answer: %s", answer);
+    return 0; // Failure
+  }
+  return 1; // Success
+}
+
+static void *runServer(void *arg)
+{
+  ServerOptions o = {.threads = 1, .tableBytes = TABLE_BYTES, .idleTimeout = SERVER_IDLE};
+  ServerRun(arg, serverPath, &o);
+  return NULL;
+}
+
+static int connectServer(struct sockaddr_un *address)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  while (connect(fd, (struct sockaddr *)address, sizeof(*address)) != 0)
+    usleep(1000); // Until the server listens
+  return fd;
+}
+
+// Whether a divide answer has as many moves as the board, whose subtrees add up to nodes
+static int checkDivide(LookupTable l, ChessBoard *cb, const char *answer, long nodes)
+{
+  long total, subTree, sum = 0;
+  int offset, moves = 0;
+  char move[8];
+  if (sscanf(answer, "ok nodes=%ld%n", &total, &offset) != 1)
+    return 0;
+  for (answer += offset; sscanf(answer, " %7[a-h1-8nbrq]=%ld%n", move, &subTree, &offset) == 2; answer += offset)
+  {
+    sum += subTree;
+    moves++;
+  }
+  return total == nodes && sum == nodes && moves == ChessBoardCount(l, cb) && strncmp(answer, " ms=", 4) == 0;
+}
+
+static int testStatus(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  (void)nodes;
+  return checkTree(l, cb, depth, STATUS_DEPTH, statusSearch, NULL);
+}
+
+// Every board of the tree has a legal move if it has any moves counted, and is checkmated
+// or stalemated otherwise, depending on whether it's in check
+static int statusSearch(LookupTable l, ChessBoard *cb, int depth)
+{
+  Analysis a;
+  ChessBoardAnalyze(l, cb, &a);
+  int count = ChessBoardCount(l, cb);
+  Status expected = count ? Ongoing : (a.checking ? Checkmated : Stalemated);
+  if (ChessBoardHasLegalMove(l, cb) != (count > 0) || ChessBoardStatus(l, cb) != expected)
+  {
+    printf("Status %d instead of %d: %s\n", ChessBoardStatus(l, cb), expected, ChessBoardToFEN(cb));
+    return 0;
+  }
+  if (depth == 0)
+    return 1;
+
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  int ok = 1;
+  while (!MoveSetIsEmpty(&ms) && ok)
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, m);
+    ok = statusSearch(l, cb, depth - 1);
+    ChessBoardUndoMove(cb, m);
+  }
+  return ok;
+}
+
+static int testMoveSetStage(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  (void)nodes;
+  return checkTree(l, cb, depth, STAGE_DEPTH, stageSearch, "Staged moves differ from filled moves");
+}
+
+// Whether a staged move set yields the same moves as a filled one
+static int stageSearch(LookupTable l, ChessBoard *cb, int depth)
+{
+  MoveSet filled = MoveSetNew();
+  StagedMoveSet staged;
+  MoveSetFill(l, cb, &filled);
+  MoveSetStage(l, cb, &staged);
+  int n = MoveSetCount(&filled), m = 0;
+  Move expected[MAX_MOVES], yielded[MAX_MOVES];
+  for (int i = 0; i < n; i++)
+    expected[i] = MoveSetPop(&filled);
+  while (m < MAX_MOVES && MoveSetNext(&staged, &yielded[m]))
+    m++;
+  qsort(expected, n, sizeof(Move), compareMoves);
+  qsort(yielded, m, sizeof(Move), compareMoves);
+
+  int ok = (n == m);
+  for (int i = 0; i < n && ok; i++)
+    ok = !compareMoves(&expected[i], &yielded[i]) && expected[i].captured.type == yielded[i].captured.type;
+  for (int i = 0; i < n && ok && depth > 1; i++)
+  {
+    ChessBoardPlayMove(cb, expected[i]);
+    ok = stageSearch(l, cb, depth - 1);
+    ChessBoardUndoMove(cb, expected[i]);
+  }
+  return ok;
+}
+
+static int testFilters(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  (void)nodes;
+  return checkTree(l, cb, depth, FILTER_DEPTH, filterSearch, NULL);
+}
+
+// Whether every filter generates and counts the moves of the full generator that pass it
+static int filterSearch(LookupTable l, ChessBoard *cb, int depth)
+{
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  int n = MoveSetCount(&ms);
+  Move all[MAX_MOVES];
+  for (int i = 0; i < n; i++)
+    all[i] = MoveSetPop(&ms);
+
+  int ok = 1;
+  for (Filter f = AllMoves; f <= Checks && ok; f++)
+  {
+    Move expected[MAX_MOVES], filtered[MAX_MOVES];
+    int e = 0, m = 0;
+    for (int i = 0; i < n; i++)
+      if (passesFilter(l, cb, all[i], f))
+        expected[e++] = all[i];
+    MoveSet fs = MoveSetNew();
+    MoveSetFillFiltered(l, cb, &fs, f);
+    while (!MoveSetIsEmpty(&fs) && m < MAX_MOVES)
+      filtered[m++] = MoveSetPop(&fs);
+    qsort(expected, e, sizeof(Move), compareMoves);
+    qsort(filtered, m, sizeof(Move), compareMoves);
+
+    int count = ChessBoardCountFiltered(l, cb, f);
+    ok = (e == m) && (count == e);
+    for (int i = 0; i < e && ok; i++)
+      ok = !compareMoves(&expected[i], &filtered[i]) && expected[i].captured.type == filtered[i].captured.type;
+    if (!ok)
+      printf("Filter %d: %d moves filled, %d counted, %d expected\n", f, m, count, e);
+  }
+  for (int i = 0; i < n && ok && depth > 1; i++)
+  {
+    ChessBoardPlayMove(cb, all[i]);
+    ok = filterSearch(l, cb, depth - 1);
+    ChessBoardUndoMove(cb, all[i]);
+  }
+  return ok;
+}
+
+// Classifies a move from its pieces, or by playing it for checks
+static int passesFilter(LookupTable l, ChessBoard *cb, Move m, Filter f)
+{
+  int capture = (m.captured.type != Empty) || (m.from.type != m.to.type);
+  if (f == Captures)
+    return capture;
+  if (f == Quiets)
+    return !capture;
+  if (f == Checks)
+  {
+    Analysis a;
+    ChessBoardPlayMove(cb, m);
+    ChessBoardAnalyze(l, cb, &a);
+    ChessBoardUndoMove(cb, m);
+    return a.checking != EMPTY_BOARD;
+  }
+  return 1;
+}
+
+static int testMobility(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  (void)nodes;
+  return checkTree(l, cb, depth, MOBILITY_DEPTH, mobilityBatch, NULL);
+}
+
+// Whether the mobility of the tree matches, and so does a batch over the boards after each
+// move, each board's generated moves
+static int mobilityBatch(LookupTable l, ChessBoard *cb, int depth)
+{
+  int ok = mobilitySearch(l, cb, depth);
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  int n = MoveSetCount(&ms);
+  ChessBoard *boards = malloc(MAX_MOVES * sizeof(ChessBoard));
+  Mobility *batch = malloc(MAX_MOVES * sizeof(Mobility));
+  for (int i = 0; i < n; i++)
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, m);
+    boards[i] = *cb;
+    ChessBoardUndoMove(cb, m);
+  }
+  ChessBoardMobilityBatch(l, boards, batch, n);
+  for (int i = 0; i < n && ok; i++)
+    ok = checkMobility(l, &boards[i], &batch[i]);
+  free(boards);
+  free(batch);
+  return ok;
+}
+
+// Whether the mobility of every board of the tree matches each color's generated moves
+static int mobilitySearch(LookupTable l, ChessBoard *cb, int depth)
+{
+  Mobility m;
+  ChessBoardMobility(l, cb, &m);
+  if (!checkMobility(l, cb, &m))
+    return 0;
+  if (depth == 0)
+    return 1;
+
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  int ok = 1;
+  while (!MoveSetIsEmpty(&ms) && ok)
+  {
+    Move mv = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, mv);
+    ok = mobilitySearch(l, cb, depth - 1);
+    ChessBoardUndoMove(cb, mv);
+  }
+  return ok;
+}
+
+// Tallies each color's moves by piece type but those capturing a king in check, which the
+// color not to move generates, and its attacks square by square
+static int checkMobility(LookupTable l, ChessBoard *cb, Mobility *m)
+{
+  const BitBoard all = ChessBoardAll(cb);
+  for (Color c = White; c <= Black; c++)
+  {
+    ChessBoard side = (c == ChessBoardColor(cb)) ? *cb : ChessBoardFlip(cb);
+    int mobility[TYPE_SIZE] = {0}, moves = 0, kingCaptures = 0;
+    MoveSet ms = MoveSetNew();
+    MoveSetFill(l, &side, &ms);
+    while (!MoveSetIsEmpty(&ms))
+    {
+      Move mv = MoveSetPop(&ms);
+      if (mv.captured.type == King)
+        kingCaptures++;
+      else
+      {
+        mobility[mv.from.type]++;
+        moves++;
+      }
+    }
+
+    BitBoard attacked = EMPTY_BOARD;
+    BitBoard b = cb->colors[c];
+    while (b)
+    {
+      Square s = BitBoardPop(&b);
+      Type t = ChessBoardSquare(cb, s);
+      attacked |= (t == Pawn) ? PAWN_ATTACKS(BitBoardAdd(EMPTY_BOARD, s), c) : LookupTableAttacks(l, s, t, all);
+    }
+
+    int ok = (m->moves[c] == moves) && (m->attacked[c] == attacked) &&
+             (moves + kingCaptures == ChessBoardCount(l, &side));
+    for (Type t = Pawn; t < Empty; t++)
+      ok = ok && (m->mobility[c][t] == mobility[t]);
+    if (!ok)
+    {
+      printf("Mobility of color %d: %d moves instead of %d\n", c, m->moves[c], moves);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int testMemory(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  long expected;
+  int d = capDepth(l, cb, depth, nodes, MEMORY_DEPTH, &expected);
+
+  // Every placement hands out zeroed memory, whether or not the system honors it
+  int ok = checkRegion(1, MEMORY_LOCAL) && checkRegion((2 << 20) + 1, MEMORY_LOCAL) &&
+           checkRegion((2 << 20) + 1, MEMORY_INTERLEAVED) && checkRegion((2 << 20) + 1, 0);
+
+  // A replica searches like the table it was copied from, and shows up in the report
+  LookupTableReplicate(l);
+  LookupTable local = LookupTableLocal(l);
+  ok = ok && local != l && PerftCount(local, cb, d) == expected;
+
+  char line[LINE_SIZE];
+  int reported = 0;
+  FILE *out = tmpfile();
+  MemoryReport(out);
+  rewind(out);
+  while (fgets(line, LINE_SIZE, out) != NULL)
+    reported |= strstr(line, "lookup table replica") != NULL;
+  fclose(out);
+
+  if (!ok || !reported)
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), d);
+    return 0; // Failure
+  }
+  return 1; // Success
+}
+
+// Whether memory with the given placement starts zeroed and can be written at both ends
+static int checkRegion(size_t bytes, int node)
+{
+  char *p = MemoryAlloc(bytes, node, "test region");
+  int ok = p[0] == 0 && p[bytes - 1] == 0;
+  p[0] = p[bytes - 1] = 1;
+  ok = ok && p[0] == 1 && p[bytes - 1] == 1;
+  MemoryFree(p);
+  return ok;
+}
+
+static int testEvasions(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  (void)nodes;
+  return checkTree(l, cb, depth, EVASION_DEPTH, evasionSearch, "Evasions differ from the moves of every piece filtered through the check");
+}
+
+// Whether every board of the tree in check has the same moves filled and counted by the
+// evasion kernels as staged one piece class at a time, which doesn't special case checks
+static int evasionSearch(LookupTable l, ChessBoard *cb, int depth)
+{
+  BitBoard checking, pinned;
+  ChessBoardCheckingAndPinned(l, cb, &checking, &pinned);
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  int ok = !checking || (stageSearch(l, cb, 1) && ChessBoardCount(l, cb) == MoveSetCount(&ms));
+  while (!MoveSetIsEmpty(&ms) && ok && depth > 0)
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, m);
+    ok = evasionSearch(l, cb, depth - 1);
+    ChessBoardUndoMove(cb, m);
+  }
+  return ok;
+}
+
+static int testMaterial(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  (void)nodes;
+  return checkTree(l, cb, depth, MATERIAL_DEPTH, materialSearch, "Material kept up by playing and undoing moves differs from the pieces on the board,\n"
+                   "or the kernel it picks differs from the moves of every piece class");
+}
+
+// Whether the material of every board of the tree is the same as recomputed, before and
+// after its moves are played and undone, and its kernel has the same moves as staged
+static int materialSearch(LookupTable l, ChessBoard *cb, int depth)
+{
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  int ok = checkMaterial(cb) && stageSearch(l, cb, 1) && ChessBoardCount(l, cb) == MoveSetCount(&ms);
+  while (!MoveSetIsEmpty(&ms) && ok && depth > 0)
+  {
+    Move m = MoveSetPop(&ms);
+    ChessBoardPlayMove(cb, m);
+    ok = materialSearch(l, cb, depth - 1);
+    ChessBoardUndoMove(cb, m);
+  }
+  return ok && checkMaterial(cb);
+}
+
+static int checkMaterial(ChessBoard *cb)
+{
+  ChessBoard reset = *cb;
+  ChessBoardResetMaterial(&reset);
+  return cb->material[White] == reset.material[White] && cb->material[Black] == reset.material[Black];
+}
+
+static int testFrontier(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  long expected;
+  int d = capDepth(l, cb, depth, nodes, FRONTIER_DEPTH, &expected);
+  for (int split = 0; split <= d; split++)
+  {
+    // Once in memory and once spilled to disk, whenever the frontier outgrows the small one
+    FrontierStats inMemory, spilled;
+    long found = FrontierCount(l, cb, d, split, FRONTIER_ROOM, &inMemory);
+    long foundSpilled = FrontierCount(l, cb, d, split, FRONTIER_BYTES, &spilled);
+    if (found != expected || foundSpilled != expected || inMemory.positions > inMemory.paths ||
+        spilled.positions != inMemory.positions || spilled.paths != inMemory.paths)
+    {
+      printf("\033[0;31mTest FAILED: %s at depth %d split %d\033[0m\n", ChessBoardToFEN(cb), d, split);
+      printf("Expected: %ld, in memory: %ld from %ld positions, spilled: %ld from %ld positions in %d runs\n",
+             expected, found, inMemory.positions, foundSpilled, spilled.positions, spilled.runs);
+      return 0; // Failure
+    }
+  }
+  return 1; // Success
+}
+
+static int testIsLegal(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  (void)depth;
+  (void)nodes;
+  Game *g = malloc(sizeof(Game));
+  int *filled = malloc(BOARD_SIZE * BOARD_SIZE * TYPE_SIZE * sizeof(int));
+  int ok = 1;
+  for (int i = 0; i < LEGAL_GAMES && ok; i++)
+  {
+    // Every board of a random game, the last one included
+    GamePlayRandom(l, cb, LEGAL_PLIES, i, g);
+    ChessBoard board = g->start;
+    for (int j = 0; j <= g->plies && ok; j++)
+    {
+      ok = checkIsLegal(l, &board, filled);
+      if (j < g->plies)
+        ChessBoardPlayMove(&board, g->moves[j]);
+    }
+    if (!ok)
+      printf("Legality differs from the filled moves after %d plies of game %d: %s\n", g->plies, i,
+             ChessBoardToFEN(&board));
+  }
+  free(filled);
+  free(g);
+
+  if (!ok)
+  {
+    printf("\033[0;31mTest FAILED: %s\033[0m\n", ChessBoardToFEN(cb));
+    return 0; // Failure
+  }
+  return 1; // Success
+}
+
+// Whether exactly the filled moves of a board are legal among every origin, destination and
+// promotion, and each is written out the same as filled
+static int checkIsLegal(LookupTable l, ChessBoard *cb, int *filled)
+{
+  static const Type promotions[] = {Empty, Knight, Bishop, Rook, Queen};
+  Move moves[MAX_MOVES];
+  MoveSet ms = MoveSetNew();
+  MoveSetFill(l, cb, &ms);
+  int n = 0;
+  while (!MoveSetIsEmpty(&ms))
+    moves[n++] = MoveSetPop(&ms);
+
+  // Each filled move by its origin, destination and promotion, Empty if it doesn't promote
+  memset(filled, -1, BOARD_SIZE * BOARD_SIZE * TYPE_SIZE * sizeof(int));
+  for (int i = 0; i < n; i++)
+  {
+    Type promotion = (moves[i].to.type != moves[i].from.type) ? moves[i].to.type : Empty;
+    filled[(moves[i].from.square * BOARD_SIZE + moves[i].to.square) * TYPE_SIZE + promotion] = i;
+  }
+
+  int legal = 0;
+  for (Square from = 0; from < BOARD_SIZE; from++)
+    for (Square to = 0; to < BOARD_SIZE; to++)
+      for (size_t p = 0; p < sizeof(promotions) / sizeof(Type); p++)
+      {
+        Move m;
+        int i = filled[(from * BOARD_SIZE + to) * TYPE_SIZE + promotions[p]];
+        if (ChessBoardIsLegal(l, cb, from, to, promotions[p], &m) != (i >= 0))
+          return 0;
+        if (i < 0)
+          continue;
+        legal++;
+        if (m.from.type != moves[i].from.type || m.to.type != moves[i].to.type ||
+            m.captured.type != moves[i].captured.type || m.captured.square != moves[i].captured.square ||
+            m.enPassant != moves[i].enPassant || m.castling != moves[i].castling)
+          return 0;
+      }
+  return legal == n;
+}
+
+static int testEvery(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  // One search counts the paths of every depth, each the same as counted on its own
+  long expected, counts[EVERY_DEPTH] = {0};
+  int d = capDepth(l, cb, depth, nodes, EVERY_DEPTH, &expected);
+  PerftEvery(l, cb, d, counts);
+  int ok = (counts[d - 1] == expected);
+  for (int i = 1; i < d && ok; i++)
+    ok = (counts[i - 1] == PerftCount(l, cb, i));
+
+  if (!ok)
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d\033[0m\n", ChessBoardToFEN(cb), d);
+    for (int i = 1; i <= d; i++)
+      printf("Depth %d: %ld\n", i, counts[i - 1]);
+    return 0; // Failure
+  }
+  return 1; // Success
+}
+
+static int testBatch(LookupTable l, ChessBoard *cb, int depth, long nodes)
+{
+  // Both kinds of line are searched and written in order, a wrong count fails, and a malformed
+  // line or one whose FEN isn't valid is written as is, while comments are skipped
+  char fen[FEN_SIZE], answer[LINE_SIZE], line[LINE_SIZE];
+  ChessBoardWriteFEN(cb, fen);
+  long expected;
+  int d = capDepth(l, cb, depth, nodes, BATCH_DEPTH, &expected);
+  FILE *in = tmpfile(), *out = tmpfile();
+  fprintf(in, "# %s\n%s %d %ld\n%s ;D1 %ld ;D%d %ld\n\n%s %d %ld\n%s\ngarbage 3 10\n8/8/8/8/8/8/8/8 w - - 1 1\n",
+          fen, fen, d, expected, fen, PerftCount(l, cb, 1), d, expected, fen, d, expected + 1, fen);
+  rewind(in);
+  BatchStats bs;
+  long failed = BatchRun(l, in, out, BATCH_THREADS, PerftCount, &bs);
+  rewind(out);
+
+  int ok = (failed == 4 && bs.positions == 3 && bs.failed == 1 && bs.rejected == 3);
+  const char *results[] = {"PASSED", "PASSED", "FAILED"};
+  for (int i = 0; i < 3 && ok; i++)
+  {
+    snprintf(line, sizeof(line), "%s %d %ld %s ", fen, d, expected, results[i]);
+    ok = fgets(answer, sizeof(answer), out) && strncmp(answer, line, strlen(line)) == 0;
+  }
+  const char *malformed[] = {fen, "garbage 3 10", "8/8/8/8/8/8/8/8 w - - 1 1"};
+  for (int i = 0; i < 3 && ok; i++)
+  {
+    snprintf(line, sizeof(line), "%s MALFORMED\n", malformed[i]);
+    ok = fgets(answer, sizeof(answer), out) && strcmp(answer, line) == 0;
+  }
+  ok = ok && !fgets(answer, sizeof(answer), out);
+  fclose(out);
+  fclose(in);
+
+  // A batch without a line to search fails as a whole, and writes nothing
+  in = tmpfile();
+  out = tmpfile();
+  fprintf(in, "# %s\n", fen);
+  rewind(in);
+  ok = ok && (BatchRun(l, in, out, BATCH_THREADS, PerftCount, NULL) == -1) && ftell(out) == 0;
+  fclose(out);
+  fclose(in);
+
+  if (!ok)
+  {
+    printf("\033[0;31mTest FAILED: %s at depth %d, %ld lines failed\033[0m\n", fen, d, failed);
+    return 0; // Failure
+  }
+  return 1; // Success
+}